@@ -0,0 +1,58 @@
+#pragma once
+#ifndef AFFINE_TRANSFORM_H_
+#define AFFINE_TRANSFORM_H_
+#include "Matrix4x4.h"
+#include "Vector3.h"
+// Top three rows of a 4x4 transformation matrix whose last row is 0 0 0 1.
+// Identity and translation only transforms skip the multiplications, the
+// other ones add the terms in the same order as Matrix4x4::multiply.
+class Affine_transform {
+ public:
+  Affine_transform();
+  // Last row of the matrix is ignored
+  explicit Affine_transform(const Matrix4x4& matrix);
+  Matrix4x4 to_matrix() const;
+  inline Vector3 transform_point(const Vector3& point) const {
+    if (kind_ == k_identity) {
+      return point;
+    } else if (kind_ == k_translation) {
+      return Vector3(rows_[0][3] + point.x, rows_[1][3] + point.y,
+                     rows_[2][3] + point.z);
+    }
+    return Vector3(rows_[0][3] + rows_[0][0] * point.x +
+                       rows_[0][1] * point.y + rows_[0][2] * point.z,
+                   rows_[1][3] + rows_[1][0] * point.x +
+                       rows_[1][1] * point.y + rows_[1][2] * point.z,
+                   rows_[2][3] + rows_[2][0] * point.x +
+                       rows_[2][1] * point.y + rows_[2][2] * point.z);
+  }
+  inline Vector3 transform_vector(const Vector3& vector) const {
+    if (kind_ != k_general) {
+      return vector;
+    }
+    return Vector3(rows_[0][0] * vector.x + rows_[0][1] * vector.y +
+                       rows_[0][2] * vector.z,
+                   rows_[1][0] * vector.x + rows_[1][1] * vector.y +
+                       rows_[1][2] * vector.z,
+                   rows_[2][0] * vector.x + rows_[2][1] * vector.y +
+                       rows_[2][2] * vector.z);
+  }
+  // Returns false when the linear part is singular
+  bool invert(Affine_transform& inverse_out) const;
+  // Transpose of the linear part without the translation, the normal
+  // transform when called on the inverse
+  Affine_transform transpose_linear() const;
+  // Transform that translates by delta after this one
+  Affine_transform translated_after(const Vector3& delta) const;
+  // Transform that translates by delta before this one
+  Affine_transform translated_before(const Vector3& delta) const;
+  bool is_identity() const { return kind_ == k_identity; }
+  bool is_translation() const { return kind_ != k_general; }
+
+ private:
+  enum Kind { k_identity, k_translation, k_general };
+  float rows_[3][4];
+  Kind kind_;
+  void update_kind();
+};
+#endif
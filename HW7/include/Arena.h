@@ -0,0 +1,65 @@
+#pragma once
+#ifndef ARENA_H_
+#define ARENA_H_
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+// Objects are carved out of blocks of this size, larger objects get a block
+// of their own
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+// Scene lifetime memory for shapes, lights and BVH nodes. Objects are
+// placed one after another in large blocks in the order they are created
+// and are all freed with the arena. Destructors are only called for objects
+// that own memory outside the arena, so dropping a BVH costs nothing.
+// Creating objects is thread safe.
+class Arena {
+ public:
+  Arena();
+  ~Arena();
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  template <typename T, typename... Args>
+  T* create(Args&&... args) {
+    T* object = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      add_destructor(object,
+                     [](void* pointer) { static_cast<T*>(pointer)->~T(); });
+    }
+    return object;
+  }
+  // For objects whose destructor frees nothing, e.g. BVH nodes whose
+  // children are in the arena too, they are dropped without a call
+  template <typename T, typename... Args>
+  T* create_without_destructor(Args&&... args) {
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  size_t get_allocation_count() const { return allocation_count_; }
+  size_t get_allocated_bytes() const { return allocated_bytes_; }
+  size_t get_block_count() const { return blocks_.size(); }
+
+ private:
+  struct Destructor {
+    void* object;
+    void (*destroy)(void*);
+  };
+  void* allocate(size_t size, size_t alignment);
+  void add_destructor(void* object, void (*destroy)(void*));
+
+  std::mutex mutex_;
+  std::vector<char*> blocks_;
+  char* current_;
+  size_t remaining_;
+  // Called in reverse order of creation
+  std::vector<Destructor> destructors_;
+  size_t allocation_count_;
+  size_t allocated_bytes_;
+};
+#endif
@@ -1,12 +1,123 @@
+#pragma once
 #ifndef BRDF_H_
 #define BRDF_H_
+#include <algorithm>
+#include <cmath>
+#include "Surface_interaction.h"
 #include "Vector3.h"
-class Hit_data;
+// Exponents that are whole numbers up to this value are evaluated with
+// multiplications instead of std::pow
+#define BRDF_MAX_INTEGER_EXPONENT 1024
+
+enum BRDF_type {
+  bt_none,
+  bt_phong,
+  bt_modified_phong,
+  bt_blinn_phong,
+  bt_modified_blinn_phong,
+  bt_torrance_sparrow
+};
+
+// All BRDF models in one value type, the model is a tag that is switched on
+// instead of a virtual call. Normalization factors and the Fresnel
+// reflectance at normal incidence are computed once when the scene is
+// loaded.
 class BRDF {
  public:
-  virtual Vector3 get_reflectance(const Hit_data& hit_data,
-                                  const Vector3& diffuse,
-                                  const Vector3& specular, const Vector3& w_i,
-                                  const Vector3& w_o) const = 0;
+  // bt_none, materials that use it are shaded without a BRDF
+  BRDF();
+  static BRDF create_phong(float exponent);
+  static BRDF create_modified_phong(float exponent, bool normalized);
+  static BRDF create_blinn_phong(float exponent);
+  static BRDF create_modified_blinn_phong(float exponent, bool normalized);
+  static BRDF create_torrance_sparrow(float exponent, float refractive_index);
+
+  BRDF_type get_type() const { return type_; }
+
+  inline Vector3 get_reflectance(const Surface_interaction& interaction,
+                                 const Vector3& diffuse,
+                                 const Vector3& specular, const Vector3& w_i,
+                                 const Vector3& w_o) const {
+    const Vector3& normal = interaction.normal;
+    const float cos_theta_i = normal.dot(w_i);
+    if (cos_theta_i > 1.0f || cos_theta_i <= 0.0f) {
+      return 0.0f;
+    }
+    switch (type_) {
+      case bt_phong: {
+        const Vector3 reflected_wi = 2 * cos_theta_i * normal - w_i;
+        const float cos_alpha_r = std::max(0.0f, w_o.dot(reflected_wi));
+        return specular * (power(cos_alpha_r) / cos_theta_i) + diffuse;
+      }
+      case bt_modified_phong: {
+        const Vector3 reflected_wi = 2 * cos_theta_i * normal - w_i;
+        const float cos_alpha_r = std::max(0.0f, w_o.dot(reflected_wi));
+        return specular * (power(cos_alpha_r) * specular_scale_) +
+               diffuse * diffuse_scale_;
+      }
+      case bt_blinn_phong: {
+        const float cos_alpha_h = (w_i + w_o).normalize().dot(normal);
+        return specular * (power(cos_alpha_h) / cos_theta_i) + diffuse;
+      }
+      case bt_modified_blinn_phong: {
+        const float cos_alpha_h = (w_i + w_o).normalize().dot(normal);
+        return specular * (power(cos_alpha_h) * specular_scale_) +
+               diffuse * diffuse_scale_;
+      }
+      case bt_torrance_sparrow:
+        return get_torrance_sparrow_reflectance(normal, diffuse, specular,
+                                                cos_theta_i, w_i, w_o);
+      case bt_none:
+        break;
+    }
+    return 0.0f;
+  }
+
+ private:
+  BRDF_type type_;
+  float exponent_;
+  // Exponent as a whole number, -1 when std::pow is needed
+  int integer_exponent_;
+  // Normalization of the diffuse and specular terms, 1 when unnormalized
+  float diffuse_scale_;
+  float specular_scale_;
+  // Fresnel reflectance at normal incidence
+  float r_0_;
+
+  BRDF(BRDF_type type, float exponent, float diffuse_scale,
+       float specular_scale, float r_0);
+
+  inline float power(float base) const {
+    if (integer_exponent_ < 0) {
+      return std::pow(base, exponent_);
+    }
+    float result = 1.0f;
+    for (int exponent = integer_exponent_; exponent > 0; exponent >>= 1) {
+      if (exponent & 1) {
+        result *= base;
+      }
+      base *= base;
+    }
+    return result;
+  }
+  inline Vector3 get_torrance_sparrow_reflectance(
+      const Vector3& normal, const Vector3& diffuse, const Vector3& specular,
+      float cos_theta_i, const Vector3& w_i, const Vector3& w_o) const {
+    const Vector3 w_h = (w_i + w_o).normalize();
+    const float cos_alpha = w_h.dot(normal);
+    const float d_alpha = specular_scale_ * power(cos_alpha);
+    const float cos_theta_o = w_o.dot(normal);
+    const float cos_beta = w_o.dot(w_h);
+    const float g_wi_wo =
+        std::min(1.0f, std::min(2 * cos_alpha * cos_theta_o / cos_beta,
+                                2 * cos_alpha * cos_theta_i / cos_beta));
+    const float one_minus_cos_beta = 1 - cos_beta;
+    const float squared = one_minus_cos_beta * one_minus_cos_beta;
+    const float f_beta =
+        r_0_ + (1 - r_0_) * (squared * squared * one_minus_cos_beta);
+    return diffuse * diffuse_scale_ +
+           specular * (d_alpha * f_beta * g_wi_wo /
+                       (4 * cos_theta_i * cos_theta_o));
+  }
 };
 #endif
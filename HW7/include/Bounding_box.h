@@ -15,7 +15,12 @@ class Bounding_box {
         delta(max - min),
         center((max + min) / 2) {}
   void expand(const Bounding_box& bounding_box);
+  // Entry distance, or the exit distance when the ray starts inside. kInf
+  // when the ray misses the box.
   float intersect(const Ray& ray) const;
+  // Distances where the ray enters and leaves the box, false when it misses
+  // the box
+  bool intersect(const Ray& ray, float& t_entry, float& t_exit) const;
   Vector3 min_corner;
   Vector3 max_corner;
   Vector3 delta;
@@ -1,32 +1,29 @@
 #ifndef BOUNDING_VOLUME_HIERARCHY_H_
 #define BOUNDING_VOLUME_HIERARCHY_H_
 #include <vector>
+#include "Arena.h"
 #include "Bounding_box.h"
 #include "Shape.h"
 #include "Vector3.h"
 class BVH : public Shape {
  public:
-  static Shape* create_bvh(std::vector<Shape*>& objects) {
+  // Nodes are created in the arena, which also owns the objects
+  static Shape* create_bvh(std::vector<Shape*>& objects, Arena& arena) {
     int size = (int)objects.size();
     if (size == 0) {
       return NULL;
     } else if (size == 1) {
       return objects[0];
     } else {
-      return new BVH(objects, 0, size, 0);
+      return arena.create_without_destructor<BVH>(objects, 0, size, 0, arena);
     }
   }
-  BVH(std::vector<Shape*>& objects, int start, int end, int dimension);
-  ~BVH() {
-    if (left) {
-      delete left;
-    }
-    if (right) {
-      delete right;
-    }
-  }
-  bool intersect(const Ray& ray, Hit_data& hit_data,
+  BVH(std::vector<Shape*>& objects, int start, int end, int dimension,
+      Arena& arena);
+  bool intersect(const Ray& ray, Hit_record& hit_record,
                  bool culling) const override;
+  void get_surface_interaction(const Ray& ray, const Hit_record& hit_record,
+                               Surface_interaction& interaction) const override;
   int get_material_id() const override { return -1; }
   int get_texture_id() const override { return -1; }
   const Bounding_box& get_bounding_box() const override { return bounding_box; }
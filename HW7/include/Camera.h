@@ -3,6 +3,7 @@
 #define CAMERA_H_
 #include <string>
 #include "Image_plane.h"
+#include "Image_writer.h"
 #include "Ray.h"
 #include "Tonemapping_operator.h"
 #include "Vector3.h"
@@ -12,14 +13,16 @@ class Camera {
          int number_of_samples, const std::string& filename, float left,
          float right, float bottom, float top, float distance, int image_width,
          int image_height, float focus_distance, float aperture_size,
-         Tonemapping_operator* tmo, bool left_handed)
+         Tonemapping_operator* tmo, bool left_handed,
+         const Image_output_settings& output_settings)
       : e(position),
         number_of_samples_(number_of_samples),
         aperture_size_(aperture_size),
         filename_(filename),
         image_plane_(left, right, bottom, top, distance, image_width,
                      image_height),
-        tmo_(tmo) {
+        tmo_(tmo),
+        output_settings_(output_settings) {
     w = -(gaze.normalize());
     if (left_handed) {
       u = w.cross(up.normalize()).normalize();
@@ -54,7 +57,8 @@ class Camera {
         aperture_size_(rhs.aperture_size_),
         filename_(rhs.filename_),
         image_plane_(rhs.image_plane_),
-        tmo_(rhs.tmo_) {
+        tmo_(rhs.tmo_),
+        output_settings_(rhs.output_settings_) {
     rhs.tmo_ = nullptr;
   }
 
@@ -69,6 +73,8 @@ class Camera {
     Ray ray(e, (s - e).normalize(), r_primary, time);
     ray.bg_u = x / image_plane_.width;
     ray.bg_v = y / image_plane_.height;
+    ray.set_differentials(e, (s + s_u_constant - e).normalize(), e,
+                          (s - s_v_constant - e).normalize());
     return ray;
   }
   Ray calculate_ray_at(float x, float y, float x_offset_ratio,
@@ -80,6 +86,8 @@ class Camera {
     Ray ray(new_e, (s - new_e).normalize(), r_primary, time);
     ray.bg_u = x / image_plane_.width;
     ray.bg_v = y / image_plane_.height;
+    ray.set_differentials(new_e, (s + s_u_constant - new_e).normalize(),
+                          new_e, (s - s_v_constant - new_e).normalize());
     return ray;
   }
   const Image_plane& get_image_plane() const { return image_plane_; }
@@ -87,6 +95,9 @@ class Camera {
   int get_number_of_samples() const { return number_of_samples_; }
   float get_aperture_size() const { return aperture_size_; }
   const Tonemapping_operator* get_tmo() const { return tmo_; }
+  const Image_output_settings& get_output_settings() const {
+    return output_settings_;
+  }
 
  private:
   // implement a matrix frame for both basis and position?
@@ -104,5 +115,6 @@ class Camera {
   const std::string filename_;
   Image_plane image_plane_;
   Tonemapping_operator* tmo_;
+  Image_output_settings output_settings_;
 };
 #endif
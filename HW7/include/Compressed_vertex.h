@@ -0,0 +1,44 @@
+#pragma once
+#ifndef COMPRESSED_VERTEX_H_
+#define COMPRESSED_VERTEX_H_
+#include <cmath>
+#include <cstdint>
+#include "Quantization.h"
+#include "Vector3.h"
+
+// Unit vector projected onto an octahedron whose lower half is unfolded
+// into a square, the two coordinates are 16 bit signed normalized numbers
+struct Octahedral_normal {
+  uint32_t bits;
+  static Octahedral_normal pack(const Vector3& normal);
+  inline Vector3 unpack() const { return unpack_raw().normalize(); }
+  // Not normalized, enough for sign tests
+  inline Vector3 unpack_raw() const {
+    const float x = snorm16_to_float((int16_t)(bits & 0xffff));
+    const float y = snorm16_to_float((int16_t)(bits >> 16));
+    Vector3 normal(x, y, 1.0f - std::fabs(x) - std::fabs(y));
+    if (normal.z < 0.0f) {
+      normal.x = (1.0f - std::fabs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+      normal.y = (1.0f - std::fabs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+    }
+    return normal;
+  }
+};
+
+// Texture coordinates as IEEE half precision floats, z of the unpacked
+// vector is 0
+struct Half_uv {
+  uint16_t u, v;
+  static Half_uv pack(const Vector3& uv);
+  inline Vector3 unpack() const {
+    return Vector3(half_to_float(u), half_to_float(v), 0.0f);
+  }
+};
+
+// Position and normal of a vertex in 16 bytes instead of the 28 bytes of
+// Vertex. The position stays a float, intersection tests read it directly.
+struct Compressed_vertex {
+  Vector3 position;
+  Octahedral_normal normal;
+};
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+#ifndef FLOAT8_H_
+#define FLOAT8_H_
+#include <cstdint>
+#include <cstring>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+// Eight lane floats for testing one ray against the eight child boxes of a
+// compressed BVH node. AVX is used when the compiler targets it, otherwise
+// the lanes are plain arrays the compiler may vectorize itself. Both give
+// the same results as the scalar code. Only the operations the node test
+// needs are provided.
+class Mask8 {
+ public:
+#ifdef __AVX__
+  __m256 lanes;
+  inline explicit Mask8(__m256 value) : lanes(value) {}
+  // Bit i is set when lane i is set
+  inline int bits() const { return _mm256_movemask_ps(lanes); }
+#else
+  int32_t lanes[8];
+  // Bit i is set when lane i is set
+  inline int bits() const {
+    int result = 0;
+    for (int i = 0; i < 8; i++) result |= (lanes[i] & 1) << i;
+    return result;
+  }
+#endif
+};
+
+class Float8 {
+ public:
+#ifdef __AVX__
+  __m256 lanes;
+  inline Float8(float value) : lanes(_mm256_set1_ps(value)) {}
+  inline explicit Float8(__m256 value) : lanes(value) {}
+  static inline Float8 load(const float* values) {
+    return Float8(_mm256_loadu_ps(values));
+  }
+  inline void store(float* values) const { _mm256_storeu_ps(values, lanes); }
+  inline Float8 operator+(const Float8& rhs) const {
+    return Float8(_mm256_add_ps(lanes, rhs.lanes));
+  }
+  inline Float8 operator-(const Float8& rhs) const {
+    return Float8(_mm256_sub_ps(lanes, rhs.lanes));
+  }
+  inline Float8 operator*(const Float8& rhs) const {
+    return Float8(_mm256_mul_ps(lanes, rhs.lanes));
+  }
+  inline Mask8 operator<=(const Float8& rhs) const {
+    return Mask8(_mm256_cmp_ps(lanes, rhs.lanes, _CMP_LE_OQ));
+  }
+  // a < b ? a : b for every lane, so b is returned when either one is NaN
+  friend inline Float8 min(const Float8& a, const Float8& b) {
+    return Float8(_mm256_min_ps(a.lanes, b.lanes));
+  }
+  // a > b ? a : b for every lane, so b is returned when either one is NaN
+  friend inline Float8 max(const Float8& a, const Float8& b) {
+    return Float8(_mm256_max_ps(a.lanes, b.lanes));
+  }
+#else
+  float lanes[8];
+  inline Float8() {}
+  inline Float8(float value) {
+    for (int i = 0; i < 8; i++) lanes[i] = value;
+  }
+  static inline Float8 load(const float* values) {
+    Float8 result;
+    std::memcpy(result.lanes, values, sizeof(result.lanes));
+    return result;
+  }
+  inline void store(float* values) const {
+    std::memcpy(values, lanes, sizeof(lanes));
+  }
+#define FLOAT8_BINARY_OPERATOR(op)                                        \
+  inline Float8 operator op(const Float8& rhs) const {                    \
+    Float8 result;                                                        \
+    for (int i = 0; i < 8; i++) result.lanes[i] = lanes[i] op rhs.lanes[i]; \
+    return result;                                                        \
+  }
+  FLOAT8_BINARY_OPERATOR(+)
+  FLOAT8_BINARY_OPERATOR(-)
+  FLOAT8_BINARY_OPERATOR(*)
+#undef FLOAT8_BINARY_OPERATOR
+  inline Mask8 operator<=(const Float8& rhs) const {
+    Mask8 result;
+    for (int i = 0; i < 8; i++) {
+      result.lanes[i] = lanes[i] <= rhs.lanes[i] ? -1 : 0;
+    }
+    return result;
+  }
+  // a < b ? a : b for every lane, so b is returned when either one is NaN
+  friend inline Float8 min(const Float8& a, const Float8& b) {
+    Float8 result;
+    for (int i = 0; i < 8; i++) {
+      result.lanes[i] = a.lanes[i] < b.lanes[i] ? a.lanes[i] : b.lanes[i];
+    }
+    return result;
+  }
+  // a > b ? a : b for every lane, so b is returned when either one is NaN
+  friend inline Float8 max(const Float8& a, const Float8& b) {
+    Float8 result;
+    for (int i = 0; i < 8; i++) {
+      result.lanes[i] = a.lanes[i] > b.lanes[i] ? a.lanes[i] : b.lanes[i];
+    }
+    return result;
+  }
+#endif
+  // Eight unsigned bytes converted to floats
+  static inline Float8 load_bytes(const uint8_t* values) {
+#ifdef __AVX2__
+    const __m128i bytes = _mm_loadl_epi64((const __m128i*)values);
+    return Float8(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)));
+#else
+    float floats[8];
+    for (int i = 0; i < 8; i++) floats[i] = values[i];
+    return load(floats);
+#endif
+  }
+};
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+#ifndef HIT_RECORD_H_
+#define HIT_RECORD_H_
+#include <limits>
+class Shape;
+// What traversal keeps of the closest hit so far. t is the limit for the
+// next candidates, a shape only writes the record when it finds a closer
+// hit in front of the ray origin. The surface at the hit is evaluated once
+// for the final record with Shape::get_surface_interaction.
+struct Hit_record {
+  Hit_record()
+      : t(std::numeric_limits<float>::infinity()),
+        shape(nullptr),
+        primitive(-1),
+        beta(0.0f),
+        gamma(0.0f) {}
+  float t;
+  // Outermost object that was hit, e.g. the instance and not its mesh
+  const Shape* shape;
+  // Triangle of a mesh, -1 for single primitives
+  int primitive;
+  // Barycentric coordinates of the hit point in the triangle
+  float beta, gamma;
+};
+#endif
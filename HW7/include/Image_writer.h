@@ -0,0 +1,62 @@
+#pragma once
+#ifndef IMAGE_WRITER_H_
+#define IMAGE_WRITER_H_
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Pixel.h"
+#include "Tonemapping_operator.h"
+#include "Vector3.h"
+// Images waiting to be written before write blocks the renderer
+#define IMAGE_WRITER_MAX_QUEUED_IMAGES 2
+struct Image_output_settings {
+  bool write_png = true;
+  bool write_exr = false;
+  bool write_pfm = false;
+  // One of TINYEXR_COMPRESSIONTYPE_*
+  int exr_compression_type = 0;
+  bool is_exr_half = true;
+};
+// Writes rendered images on a background thread so that the next camera can
+// be rendered meanwhile. The pixels are read in place, the formats of an
+// image are encoded on their own threads.
+class Image_writer {
+ public:
+  Image_writer();
+  ~Image_writer();
+  Image_writer(const Image_writer&) = delete;
+  Image_writer& operator=(const Image_writer&) = delete;
+  // Takes ownership of pixels, file_name is without extension. tmo is only
+  // used for the png image and must live until finish returns.
+  void write(Pixel* pixels, int width, int height, const std::string& file_name,
+             const Tonemapping_operator* tmo,
+             const Image_output_settings& settings);
+  // Waits until all images are written
+  void finish();
+
+ private:
+  struct Job {
+    Pixel* pixels;
+    int width;
+    int height;
+    std::string file_name;
+    const Tonemapping_operator* tmo;
+    Image_output_settings settings;
+  };
+  std::deque<Job> jobs_;
+  std::mutex mutex_;
+  std::condition_variable job_added_;
+  std::condition_variable job_done_;
+  bool is_writing_;
+  bool is_stopped_;
+  std::thread thread_;
+  void run();
+  static void write_job(const Job& job);
+  static void write_png(const Job& job);
+  static void write_exr(const Job& job);
+  static void write_pfm(const Job& job);
+};
+#endif
@@ -1,5 +1,7 @@
 #ifndef LIGHT_H_
 #define LIGHT_H_
+#include <random>
+#include "Ray.h"
 #include "Vector3.h"
 class Light {
  public:
@@ -10,5 +12,36 @@ class Light {
   // Incoming radiance to the point from the light
   virtual Vector3 incoming_radiance(const Vector3& from_point_to_light,
                                     float probability) const = 0;
+
+  // Fills the first count elements of photon_rays and fluxes, the generator
+  // is owned by the calling thread. Fluxes are the power of the light divided
+  // by the sampling probability, so they are not divided by the photon count.
+  // Returns the number of generated photons, lights that cannot emit photons
+  // return 0.
+  virtual int generate_photons(Ray*, Vector3*, int, std::mt19937&) const {
+    return 0;
+  }
+
+ protected:
+  // Builds u and v so that u, v and w are orthonormal, w must be normalized
+  static void orthonormal_basis(const Vector3& w, Vector3& u, Vector3& v) {
+    u = ((w.x != 0.0f || w.y != 0.0f) ? Vector3(-w.y, w.x, 0.0f)
+                                      : Vector3(0.0f, 1.0f, 0.0f))
+            .normalize();
+    v = w.cross(u);
+  }
+
+  // Cosine weighted direction around w, probability is cos_theta / pi
+  static Vector3 sample_cosine_direction(const Vector3& w, float epsilon_1,
+                                         float epsilon_2) {
+    Vector3 u, v;
+    orthonormal_basis(w, u, v);
+    const float phi = 2 * M_PI * epsilon_1;
+    const float sin_theta = std::sqrt(epsilon_2);
+    const float cos_theta = std::sqrt(1.0f - epsilon_2);
+    return (w * cos_theta + v * sin_theta * std::cos(phi) +
+            u * sin_theta * std::sin(phi))
+        .normalize();
+  }
 };
 #endif
@@ -4,67 +4,51 @@
 #include <vector>
 #include "Light.h"
 #include "Mesh.h"
-#include "Mesh_triangle.h"
 #include "Scene.h"
 #include "Transformation.h"
 #include "Vector3.h"
 class Light_mesh : public Light, public Mesh {
  public:
-  Light_mesh(const Scene* scene, int material_id,
-             const Transformation& transformation,
-             std::vector<Shape*>& triangles, const Vector3& radiance)
-      : scene_(scene),
-        radiance_(radiance),
-        triangles_(triangles),
-        Mesh(material_id, -1, triangles, transformation, 0.0f) {
+  Light_mesh(int material_id, const Transformation& transformation,
+             Triangle_mesh* triangle_mesh, const Vector3& radiance)
+      : Mesh(material_id, -1, triangle_mesh, transformation, 0.0f),
+        radiance_(radiance) {
     total_area_ = 0.0f;
     std::vector<float> pdf;
-    const Matrix4x4& transformation_matrix =
-        transformation.get_transformation_matrix();
+    const Affine_transform& transformation_matrix =
+        transformation.get_transformation();
 
-    for (int i = 0; i < triangles.size(); i++) {
-      Mesh_triangle* triangle = (Mesh_triangle*)triangles[i];
-      Vector3 v_0 = transformation_matrix.multiply(
-          scene_
-              ->get_vertex_at(triangle->vertex_index_0 +
-                              triangle->vertex_offset)
-              .get_vertex_position());
-      Vector3 v_1 = transformation_matrix.multiply(
-          scene_
-              ->get_vertex_at(triangle->vertex_index_1 +
-                              triangle->vertex_offset)
-              .get_vertex_position());
-      Vector3 v_2 = transformation_matrix.multiply(
-          scene_
-              ->get_vertex_at(triangle->vertex_index_2 +
-                              triangle->vertex_offset)
-              .get_vertex_position());
+    const int triangle_count = triangle_mesh->get_triangle_count();
+    for (int i = 0; i < triangle_count; i++) {
+      Vector3 v_0 = transformation_matrix.transform_point(
+          triangle_mesh->get_vertex_position(i, 0));
+      Vector3 v_1 = transformation_matrix.transform_point(
+          triangle_mesh->get_vertex_position(i, 1));
+      Vector3 v_2 = transformation_matrix.transform_point(
+          triangle_mesh->get_vertex_position(i, 2));
       float area = (v_1 - v_0).cross(v_2 - v_0).length() / 2;
       total_area_ += area;
       pdf.push_back(area);
     }
     float current_cumulative_area = 0.0f;
-    for (int i = 0; i < triangles.size(); i++) {
+    for (int i = 0; i < triangle_count; i++) {
       current_cumulative_area += pdf[i];
       cdf_.push_back(current_cumulative_area / total_area_);
     }
   }
-  bool intersect(const Ray& ray, Hit_data& hit_data,
+  bool intersect(const Ray& ray, Hit_record& hit_record,
                  bool culling) const override {
-    const Matrix4x4& inverse_transformation_matrix =
-        base_transform.get_inverse_transformation_matrix();
-    Ray ray_local(inverse_transformation_matrix.multiply(ray.o),
-                  inverse_transformation_matrix.multiply(ray.d, true),
-                  ray.ray_type, ray.time);
-    if (Mesh::intersect(ray_local, hit_data, culling)) {
-      hit_data.normal = base_transform.get_normal_transformation_matrix()
-                            .multiply(hit_data.normal, true)
-                            .normalize();
-      hit_data.is_light_object = true;
-      hit_data.radiance = radiance_;
-      return true;
-    }
-    return false;
+    return Mesh::intersect(get_local_ray(ray), hit_record, culling);
+  }
+  void get_surface_interaction(
+      const Ray& ray, const Hit_record& hit_record,
+      Surface_interaction& interaction) const override {
+    Mesh::get_surface_interaction(get_local_ray(ray), hit_record, interaction);
+    interaction.normal = base_transform.get_normal_transformation()
+                             .transform_vector(interaction.normal)
+                             .normalize();
+    interaction.is_light_object = true;
+    interaction.radiance = radiance_;
   }
   Vector3 direction_and_distance(const Vector3& from_point,
                                  const Vector3& normal, float& distance,
@@ -73,13 +57,20 @@ class Light_mesh : public Light, public Mesh {
   // Incoming radiance to the point from the light
   Vector3 incoming_radiance(const Vector3& from_point_to_light,
                             float probability) const override;
+  int generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                       std::mt19937& generator) const override;
 
  private:
   Vector3 radiance_;
-  // std::map<float, Shape*> triangles_;
-  std::vector<Shape*> triangles_;
   std::vector<float> cdf_;
   float total_area_;
-  const Scene* scene_;
+
+  Ray get_local_ray(const Ray& ray) const {
+    const Affine_transform& inverse_transformation_matrix =
+        base_transform.get_inverse_transformation();
+    return Ray(inverse_transformation_matrix.transform_point(ray.o),
+               inverse_transformation_matrix.transform_vector(ray.d),
+               ray.ray_type, ray.time);
+  }
 };
 #endif
@@ -13,14 +13,12 @@ class Light_sphere : public Light, public Sphere {
       : radiance_(radiance),
         Sphere(scene, center, radius, material_id, -1, transformation,
                Vector3(0.0f)) {}
-  bool intersect(const Ray& ray, Hit_data& hit_data,
-                 bool culling) const override {
-    if (Sphere::intersect(ray, hit_data, culling)) {
-      hit_data.is_light_object = true;
-      hit_data.radiance = radiance_;
-      return true;
-    }
-    return false;
+  void get_surface_interaction(
+      const Ray& ray, const Hit_record& hit_record,
+      Surface_interaction& interaction) const override {
+    Sphere::get_surface_interaction(ray, hit_record, interaction);
+    interaction.is_light_object = true;
+    interaction.radiance = radiance_;
   }
 
   Vector3 direction_and_distance(const Vector3& from_point,
@@ -30,6 +28,8 @@ class Light_sphere : public Light, public Sphere {
   // Incoming radiance to the point from the light
   Vector3 incoming_radiance(const Vector3& from_point_to_light,
                             float probability) const override;
+  int generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                       std::mt19937& generator) const override;
 
  private:
   Vector3 radiance_;
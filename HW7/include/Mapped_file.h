@@ -0,0 +1,35 @@
+#pragma once
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+#include <cstddef>
+#include <cstring>
+#include <string>
+// Read only memory mapping of a whole file. Throws std::runtime_error when
+// the file cannot be opened or mapped.
+class Mapped_file {
+ public:
+  Mapped_file(const std::string& filename);
+  ~Mapped_file();
+  Mapped_file(const Mapped_file&) = delete;
+  Mapped_file& operator=(const Mapped_file&) = delete;
+  const unsigned char* data() const { return data_; }
+  size_t size() const { return size_; }
+  // Copies the value at offset, does not require the offset to be aligned
+  template <typename T>
+  inline T read(size_t offset) const {
+    T value;
+    std::memcpy(&value, data_ + offset, sizeof(T));
+    return value;
+  }
+
+ private:
+  const unsigned char* data_;
+  size_t size_;
+#ifdef _WIN32
+  void* file_handle_;
+  void* mapping_handle_;
+#else
+  int file_descriptor_;
+#endif
+};
+#endif
@@ -7,53 +7,53 @@
 #include "Shape.h"
 #include "Transformation.h"
 #include "Triangle.h"
+#include "Triangle_mesh.h"
 
 class Mesh : public Shape {
  public:
   int material_id;
   int texture_id;
-  Shape* bvh;
+  Triangle_mesh* triangle_mesh;
 
   // Used for instances
   Vector3 velocity;
   Transformation base_transform;
 
-  bool intersect(const Ray& ray, Hit_data& hit_data,
+  bool intersect(const Ray& ray, Hit_record& hit_record,
                  bool culling) const override {
-    if (bvh->intersect(ray, hit_data, culling)) {
-      hit_data.is_light_object = false;
+    if (triangle_mesh->intersect(ray, hit_record, culling)) {
+      hit_record.shape = this;
       return true;
     }
     return false;
   }
+  void get_surface_interaction(
+      const Ray& ray, const Hit_record& hit_record,
+      Surface_interaction& interaction) const override {
+    triangle_mesh->get_surface_interaction(ray, hit_record, interaction);
+  }
 
   int get_material_id() const override { return material_id; }
   int get_texture_id() const override { return texture_id; }
   const Bounding_box& get_bounding_box() const override {
-    return bvh->get_bounding_box();
+    return triangle_mesh->get_bounding_box();
   }
 
-  Mesh(int material_id, int texture_id, std::vector<Shape*>& triangles,
+  // triangle_mesh belongs to the arena of the scene like the mesh itself
+  Mesh(int material_id, int texture_id, Triangle_mesh* triangle_mesh,
        const Transformation& b_transform, const Vector3& velocity)
       : material_id(material_id),
         texture_id(texture_id),
-        bvh(NULL),
+        triangle_mesh(triangle_mesh),
         velocity(velocity),
-        base_transform(b_transform) {
-    bvh = BVH::create_bvh(triangles);
-  }
+        base_transform(b_transform) {}
 
-  ~Mesh() {
-    if (bvh) {
-      delete bvh;
-    }
-  }
   void print_debug(int indentation) const override {
     for (int index = 0; index < indentation; index++) {
       std::cout << "\t";
     }
     std::cout << "Mesh->" << std::endl;
-    bvh->print_debug(indentation);
+    triangle_mesh->print_debug(indentation);
   }
 };
 
@@ -62,9 +62,8 @@ class Mesh_instance : public Shape {
   int material_id;
   int texture_id;
   Vector3 velocity;
-  bool intersect(const Ray& ray, Hit_data& hit_data,
+  bool intersect(const Ray& ray, Hit_record& hit_record,
                  bool culling) const override {
-    static const Vector3 zero_vector(0.0f);
     // Checking if ray hits the world space bounding box
     float bbox_t = bounding_box_.intersect(ray);
     if (bbox_t < 0.0f || bbox_t == kInf) {
@@ -73,45 +72,24 @@ class Mesh_instance : public Shape {
     if (is_refractive_) {
       culling = false;
     }
-    if (velocity == zero_vector) {
-      const Matrix4x4& inverse_transformation =
-          transformation_.get_inverse_transformation_matrix();
-      Ray ray_local(inverse_transformation.multiply(ray.o),
-                    inverse_transformation.multiply(ray.d, true), ray.ray_type,
-                    ray.time);
-      if (mesh_->intersect(ray_local, hit_data, culling)) {
-        hit_data.normal = transformation_.get_normal_transformation_matrix()
-                              .multiply(hit_data.normal, true)
-                              .normalize();
-        hit_data.is_light_object = false;
-        hit_data.shape = this;
-        return true;
-      }
-      return false;
-    } else {
-      // Motion blur
-      Vector3 delta_position = ray.time * velocity;
-      Translation translation(delta_position.x, delta_position.y,
-                              delta_position.z);
-      Matrix4x4 translated_transformation_matrix =
-          translation.get_transformation_matrix() *
-          transformation_.get_transformation_matrix();
-      Arbitrary_transformation transformation(translated_transformation_matrix);
-      const Matrix4x4& inverse_transformation =
-          transformation.get_inverse_transformation_matrix();
-      Ray ray_local(inverse_transformation.multiply(ray.o),
-                    inverse_transformation.multiply(ray.d, true), ray.ray_type,
-                    ray.time);
-      if (mesh_->intersect(ray_local, hit_data, culling)) {
-        hit_data.normal = transformation.get_normal_transformation_matrix()
-                              .multiply(hit_data.normal, true)
-                              .normalize();
-        hit_data.shape = this;
-        hit_data.is_light_object = false;
-        return true;
-      }
-      return false;
+    // Hits in the mesh have the same t as in world space, the transform
+    // keeps the ray parametrization
+    if (mesh_->intersect(get_local_ray(ray, false), hit_record, culling)) {
+      hit_record.shape = this;
+      return true;
     }
+    return false;
+  }
+  void get_surface_interaction(
+      const Ray& ray, const Hit_record& hit_record,
+      Surface_interaction& interaction) const override {
+    mesh_->get_surface_interaction(get_local_ray(ray, true), hit_record,
+                                   interaction);
+    interaction.normal = transformation_.get_normal_transformation()
+                             .transform_vector(interaction.normal)
+                             .normalize();
+    interaction.is_light_object = false;
+    interaction.shape = this;
   }
 
   int get_material_id() const override { return material_id; }
@@ -146,5 +124,31 @@ class Mesh_instance : public Shape {
   const Transformation transformation_;
   Bounding_box bounding_box_;
   bool is_refractive_;
+
+  // Ray in the space of the mesh at the time of the ray
+  Ray get_local_ray(const Ray& ray, bool with_differentials) const {
+    static const Vector3 zero_vector(0.0f);
+    const Affine_transform* inverse_transformation =
+        &transformation_.get_inverse_transformation();
+    Affine_transform moved_inverse_transformation;
+    if (velocity != zero_vector) {
+      // Motion blur translates the instance, so only the translation of the
+      // inverse changes
+      moved_inverse_transformation =
+          inverse_transformation->translated_before(-(ray.time * velocity));
+      inverse_transformation = &moved_inverse_transformation;
+    }
+    Ray ray_local(inverse_transformation->transform_point(ray.o),
+                  inverse_transformation->transform_vector(ray.d),
+                  ray.ray_type, ray.time);
+    if (with_differentials && ray.has_differentials) {
+      ray_local.set_differentials(
+          inverse_transformation->transform_point(ray.rx_o),
+          inverse_transformation->transform_vector(ray.rx_d),
+          inverse_transformation->transform_point(ray.ry_o),
+          inverse_transformation->transform_vector(ray.ry_d));
+    }
+    return ray_local;
+  }
 };
 #endif
@@ -0,0 +1,14 @@
+#pragma once
+#ifndef NUMBER_PARSER_H_
+#define NUMBER_PARSER_H_
+#include <vector>
+// Locale independent parser for whitespace separated numbers in element
+// texts. Large texts are split into chunks on whitespace and the chunks are
+// parsed in parallel directly into the output array. Returns false if the
+// text contains something other than numbers, values are cleared then.
+class Number_parser {
+ public:
+  static bool parse_floats(const char* text, std::vector<float>& values);
+  static bool parse_ints(const char* text, std::vector<int>& values);
+};
+#endif
@@ -2,19 +2,26 @@
 #define PERLIN_NOISE_H_
 #include <vector>
 #include "Vector3.h"
+// Lattice cells per period of the noise, the permutation table is stored
+// twice so that hashing needs no modulo
+#define PERLIN_NOISE_TABLE_SIZE 256
 
 class Perlin_noise {
  public:
   enum Perlin_noise_appearance { pn_vein, pn_patch };
   Perlin_noise(const std::string& pn_appearance, float scaling_factor = 1.0f);
   float get_value_at(const Vector3& position) const;
+  // Value and its derivatives with respect to position from one evaluation
+  float get_value_and_gradient_at(const Vector3& position,
+                                  Vector3& gradient) const;
 
  private:
   float scaling_factor_;
   Perlin_noise_appearance pn_appearance_;
   std::vector<int> p_;
   static const std::vector<Vector3> g_;
-  Vector3 edge_vector_at(int i, int j, int k) const;
-  inline float weight_function(float x) const;
+  // Noise before the appearance is applied, the gradient with respect to
+  // scaled_position is only computed when gradient is not null
+  inline float noise(const Vector3& scaled_position, Vector3* gradient) const;
 };
 #endif
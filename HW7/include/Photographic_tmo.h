@@ -8,11 +8,21 @@ class Photographic_tmo : public Tonemapping_operator {
                    float saturation = 1.0f);
   void apply_tmo(const std::vector<Vector3>& input,
                  std::vector<Vector3>& output) const override;
+  void apply_tmo_srgb(const std::vector<Vector3>& input,
+                      unsigned char* rgba_output) const override;
 
  private:
   float image_key_;
   float saturation_percentage_;
   float saturation_;
   float gamma_;
+  // Log average and white luminance of the whole image, white luminance is
+  // already scaled by the image key
+  void calculate_luminances(const std::vector<Vector3>& input,
+                            float& log_average_luminance,
+                            float& white_luminance) const;
+  inline Vector3 tonemap_color(const Vector3& color,
+                               float log_average_luminance,
+                               float white_luminance) const;
 };
 #endif
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef PHOTON_MAP_H_
+#define PHOTON_MAP_H_
+#include <utility>
+#include <vector>
+#include "Photon.h"
+#include "Vector3.h"
+// Balanced k-d tree stored implicitly in a single array. Node of the range
+// [start, end) is the median element (start + end) / 2, its children are the
+// ranges on both sides of it.
+class Photon_map {
+ public:
+  typedef std::pair<float, const Photon*> Nearest_photon;
+  Photon_map() : emitted_photon_count_(0) {}
+  // Takes the stored photons of every tracing thread and balances the tree.
+  void build(std::vector<std::vector<Photon>>& photon_lists,
+             long long emitted_photon_count);
+  // Fills nearest with (at most) k photons that are closest to position and
+  // inside max_radius_squared. Returns squared distance of the farthest
+  // photon found, which is the radius of the gather sphere.
+  float locate_nearest(const Vector3& position, int k,
+                       float max_radius_squared,
+                       std::vector<Nearest_photon>& nearest) const;
+  bool empty() const { return photons_.empty(); }
+  size_t size() const { return photons_.size(); }
+  long long get_emitted_photon_count() const { return emitted_photon_count_; }
+
+ private:
+  void balance(int start, int end);
+  void locate(int start, int end, const Vector3& position, int k,
+              float& max_radius_squared,
+              std::vector<Nearest_photon>& nearest) const;
+  std::vector<Photon> photons_;
+  long long emitted_photon_count_;
+};
+#endif
@@ -10,6 +10,8 @@ class Point_light : public Light {
                                  float& probability) const override;
   Vector3 incoming_radiance(const Vector3& from_point_to_light,
                             float probability) const override;
+  int generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                       std::mt19937& generator) const override;
 
  private:
   Vector3 position_;
@@ -0,0 +1,68 @@
+#pragma once
+#ifndef QUANTIZATION_H_
+#define QUANTIZATION_H_
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+// Conversions between floats and the compact formats of hdr textures,
+// normals and texture coordinates
+
+// Rounds to the nearest half, values out of its range become infinity
+inline uint16_t float_to_half(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const int float_exponent = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (float_exponent == 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  const int exponent = float_exponent - 127 + 15;
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // Subnormal half
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    uint16_t half_mantissa = mantissa >> shift;
+    if ((mantissa >> (shift - 1)) & 1) {
+      half_mantissa++;
+    }
+    return sign | half_mantissa;
+  }
+  uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+  // Carry into the exponent gives the next representable value
+  if (mantissa & 0x1000) {
+    half++;
+  }
+  return half;
+}
+
+inline float half_to_float(uint16_t half) {
+  const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+  const uint32_t exponent = (half >> 10) & 0x1f;
+  const uint32_t mantissa = half & 0x3ff;
+  if (exponent == 0) {
+    const float value = std::ldexp((float)mantissa, -24);
+    return sign ? -value : value;
+  }
+  uint32_t bits = sign | (mantissa << 13);
+  bits |= exponent == 31 ? 0x7f800000 : (exponent + 112) << 23;
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Signed normalized 16 bit value, value is clamped to [-1, 1]
+inline int16_t float_to_snorm16(float value) {
+  return (int16_t)std::lround(std::min(1.0f, std::max(-1.0f, value)) *
+                              32767.0f);
+}
+
+inline float snorm16_to_float(int16_t value) { return value / 32767.0f; }
+#endif
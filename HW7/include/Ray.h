@@ -2,27 +2,65 @@
 #ifndef RAY_H_
 #define RAY_H_
 #include "Vector3.h"
-enum Ray_type { r_primary, r_shadow, r_reflection, r_refraction, r_path };
+enum Ray_type {
+  r_primary,
+  r_shadow,
+  r_reflection,
+  r_refraction,
+  r_path,
+  r_photon
+};
 class Ray {
  public:
   Vector3 o;
   Vector3 d;
   bool in_medium;
   bool light_hit;
+  // Set on the hemisphere samples of diffuse surfaces and on specular rays
+  // that follow them, so that caustics found by the caustic photon map are
+  // not counted twice
+  bool diffuse_bounce;
+  bool caustic_path;
   Ray_type ray_type;
   // Between -1.0f and 1.0f
   float time;
   float bg_u, bg_v;
+  // Ray differentials, origins and directions of the rays through the
+  // neighbouring pixels. They give the footprint of the pixel on surfaces to
+  // filter the textures.
+  bool has_differentials;
+  Vector3 rx_o, rx_d;
+  Vector3 ry_o, ry_d;
   Ray(const Vector3& origin, const Vector3& direction, Ray_type ray_type,
       float time = 0.0f)
       : o(origin),
         d(direction),
         in_medium(false),
         light_hit(false),
+        diffuse_bounce(false),
+        caustic_path(false),
         ray_type(ray_type),
         time(time),
         bg_u(0.0f),
-        bg_v(0.0f) {}
+        bg_v(0.0f),
+        has_differentials(false) {}
   inline Vector3 point_at(float t) const { return o + (t * d); }
+  inline void set_differentials(const Vector3& x_origin,
+                                const Vector3& x_direction,
+                                const Vector3& y_origin,
+                                const Vector3& y_direction) {
+    has_differentials = true;
+    rx_o = x_origin;
+    rx_d = x_direction;
+    ry_o = y_origin;
+    ry_d = y_direction;
+  }
+  // Offset rays are moved towards the ray when a pixel has several samples
+  inline void scale_differentials(float scale) {
+    rx_o = o + (rx_o - o) * scale;
+    rx_d = d + (rx_d - d) * scale;
+    ry_o = o + (ry_o - o) * scale;
+    ry_d = d + (ry_d - d) * scale;
+  }
 };
 #endif
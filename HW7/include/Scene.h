@@ -4,33 +4,36 @@
 #include <string>
 #include <vector>
 #include "Area_light.h"
+#include "Arena.h"
 #include "BRDF.h"
-#include "Blinn_phong_BRDF.h"
 #include "Bounding_volume_hierarchy.h"
 #include "Camera.h"
+#include "Compressed_vertex.h"
 #include "Directional_light.h"
 #include "Material.h"
 #include "Mesh.h"
-#include "Mesh_triangle.h"
-#include "Modified_blinn_phong_BRDF.h"
-#include "Modified_phong_BRDF.h"
-#include "Phong_BRDF.h"
 #include "Photographic_tmo.h"
+#include "Photon.h"
+#include "Photon_map.h"
 #include "Point_light.h"
 #include "Shape.h"
 #include "Sphere.h"
 #include "Spherical_directional_light.h"
 #include "Spot_light.h"
 #include "Texture.h"
-#include "Torrance_sparrow_BRDF.h"
+#include "Texture_cache.h"
 #include "Transformation.h"
 #include "Triangle.h"
+#include "Triangle_mesh.h"
 #include "Vector3.h"
 #include "Vertex.h"
 class Pixel;
 enum Integrator_type { it_pathtracing, it_raytracing };
 class Scene {
  public:
+  // Owns the objects of the scene. It is declared first, so it is destroyed
+  // after everything that points into it.
+  Arena arena;
   Vector3 background_color;
   Texture* background_texture;
   float shadow_ray_epsilon;
@@ -46,51 +49,119 @@ class Scene {
   std::vector<Material> materials;
   std::vector<Vertex> vertex_data;
   std::vector<Vector3> texture_coord_data;
+  // With CompressedVertices, vertex_data and texture_coord_data are only
+  // used while loading. Rendering reads these copies with octahedral normals
+  // and half precision texture coordinates.
+  bool compressed_vertices;
+  std::vector<Compressed_vertex> compressed_vertex_data;
+  std::vector<Half_uv> compressed_texture_coord_data;
+  // Decodes the images of textures on first access, shared by all threads
+  Texture_cache texture_cache;
   std::vector<Texture> textures;
-  std::vector<BRDF*> brdfs;
+  std::vector<BRDF> brdfs;
   Integrator_type integrator_type;
   bool is_uniform_sampling;
   Spherical_directional_light* spherical_directional_light;
-  inline const Vertex& get_vertex_at(int index) const {
-    return vertex_data[index];
+  // Caustic photon map, photons are stored only after a specular bounce
+  bool use_caustic_photon_map;
+  int caustic_photon_count;
+  int caustic_nearest_photon_count;
+  float caustic_max_radius_squared;
+  Photon_map caustic_photon_map;
+  inline const Vector3& get_vertex_position(int index) const {
+    if (compressed_vertices) {
+      return compressed_vertex_data[index].position;
+    }
+    return vertex_data[index].get_vertex_position();
+  }
+  inline Vector3 get_vertex_normal(int index) const {
+    if (compressed_vertices) {
+      return compressed_vertex_data[index].normal.unpack();
+    }
+    return vertex_data[index].get_vertex_normal();
+  }
+  inline Vector3 get_texture_coord(int index) const {
+    if (compressed_vertices) {
+      return compressed_texture_coord_data[index].unpack();
+    }
+    return texture_coord_data[index];
   }
 
   Scene(const std::string& file_name);
   void render_image(int camera_index, Pixel* result, const int starting_row,
                     const int height_increase = 1) const;
+  // Emits photon_count photons from each light and keeps the caustic ones
+  void trace_caustic_photons(int photon_count,
+                             std::vector<Photon>* photons) const;
+  void build_caustic_photon_map(std::vector<std::vector<Photon>>& photon_lists);
   ~Scene();
 
  private:
   Vector3 send_ray(const Ray& ray, int recursion_level) const;
-  Vector3 trace_ray(const Ray& ray, const Hit_data& hit_data,
+  // Moves the finished vertices into the compressed arrays and frees the
+  // full precision ones
+  void compress_vertices();
+  // Gives new_ray the differentials of ray after a mirror reflection when
+  // refraction_index is 0, after a refraction otherwise. normal faces the
+  // incoming ray.
+  void bend_differentials(const Ray& ray,
+                          const Surface_interaction& interaction,
+                          const Vector3& normal, float refraction_index,
+                          Ray& new_ray) const;
+  Vector3 trace_ray(const Ray& ray, const Surface_interaction& interaction,
                     int recursion_level) const;
-  Vector3 trace_path(const Ray& ray, const Hit_data& hit_data,
+  Vector3 trace_path(const Ray& ray, const Surface_interaction& interaction,
                      int recursion_level) const;
-  Vector3 reflect_ray(const Ray& ray, const Hit_data& hit_data,
+  Vector3 reflect_ray(const Ray& ray, const Surface_interaction& interaction,
                       int recursion_level) const;
-  Vector3 refract_ray(const Ray& ray, const Hit_data& hit_data,
+  Vector3 refract_ray(const Ray& ray, const Surface_interaction& interaction,
                       int recursion_level) const;
+  void caustic_photon_trace(const Ray& ray, int recursion_level,
+                            const Vector3& flux, bool specular_path,
+                            std::vector<Photon>* photons) const;
+  Vector3 caustic_radiance(const Ray& ray,
+                           const Surface_interaction& interaction,
+                           const Vector3& diffuse_constant) const;
   Vector3 calculate_diffuse_and_specular_radiance(
-      const Ray& ray, const Hit_data& hit_data,
+      const Ray& ray, const Surface_interaction& interaction,
       const Vector3& diffuse_constant) const;
-  bool calculate_diffuse_constant(const Hit_data& hit_data,
+  bool calculate_diffuse_constant(const Surface_interaction& interaction,
                                   Vector3& diffuse_constant_out) const;
   bool calculate_transmission(const Vector3& direction_unit,
                               const Vector3& normal,
                               const float refraction_index,
                               Vector3& transmitted_d) const;
+  // Reads binary little endian ply files straight from a file mapping into
+  // the reserved vertex range. Returns false before changing the scene when
+  // the file needs the general tinyply parser.
+  bool parse_ply_native(const std::string& filename,
+                        std::vector<Vertex>& vertices,
+                        std::vector<Triangle_indices>& triangles,
+                        std::vector<Vector3>& face_normals, int vertex_offset,
+                        int texture_offset);
   void parse_ply_tinyply(std::string filename, std::vector<Vertex>& vertices,
-                         std::vector<Shape*>& mesh_triangles, int vertex_offset,
-                         int texture_offset, int material_id, int texture_id,
-                         Triangle_shading_mode tsm);
+                         std::vector<Triangle_indices>& triangles,
+                         std::vector<Vector3>& face_normals, int vertex_offset,
+                         int texture_offset);
   //
-  void parse_binary_vertexdata(std::string& filename);
-  void parse_binary_texturedata(std::string& filename);
-  void parse_binary_facedata(std::string& filename,
-                             std::vector<Shape*>& mesh_triangles,
-                             int vertex_offset, int texture_offset,
-                             int material_id, int texture_id,
-                             Triangle_shading_mode tsm,
-                             bool zero_based_indexing);
+  void parse_binary_vertexdata(const std::string& filename);
+  void parse_binary_texturedata(const std::string& filename);
+  void parse_binary_facedata(const std::string& filename,
+                             std::vector<Triangle_indices>& triangles,
+                             int vertex_offset, bool zero_based_indexing);
+  // Appends triangle_count triangles from the vertex index triples, indices
+  // start from index_base. source_name is used in the error messages. Vertex
+  // normals are not touched, see add_vertex_normals.
+  void create_mesh_triangles(const int* indices, int triangle_count,
+                             int index_base,
+                             std::vector<Triangle_indices>& triangles,
+                             int vertex_offset,
+                             const std::string& source_name);
+  // Adds area weighted surface normals of the triangles to their vertices,
+  // face_normals is either empty or has a normal for every triangle.
+  // Vertices are shared between meshes, so it is called serially.
+  void add_vertex_normals(const std::vector<Triangle_indices>& triangles,
+                          const std::vector<Vector3>& face_normals,
+                          int vertex_offset);
 };
 #endif
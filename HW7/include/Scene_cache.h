@@ -0,0 +1,95 @@
+#pragma once
+#ifndef SCENE_CACHE_H_
+#define SCENE_CACHE_H_
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "Mapped_file.h"
+#include "Triangle_mesh.h"
+#include "Vector3.h"
+#include "Vertex.h"
+namespace tinyxml2 {
+class XMLNode;
+}
+class Scene;
+// Binary cache of the parsed geometry of a scene: vertex and texture
+// coordinate arrays, triangles of every Mesh and LightMesh in BVH order and
+// their BVH nodes, binary or compressed. Materials, textures and the rest
+// of the xml are cheap to parse, they are always read from the xml.
+//
+// Cache is keyed by a hash of the xml and of the path, size and modification
+// time of every plyFile and binaryFile it references.
+class Scene_cache {
+ public:
+  static uint64_t compute_key(const std::string& xml_file_name,
+                              const tinyxml2::XMLNode* root);
+  Scene_cache() : loaded_(false) {}
+
+  // Returns false if the file does not exist, is corrupt or has another key.
+  // The file stays mapped until the cache is destroyed.
+  bool load(const std::string& file_name, uint64_t key);
+  bool is_loaded() const { return loaded_; }
+  // Copies the cached arrays into the given ones
+  void restore_vertices(std::vector<Vertex>& vertex_data,
+                        std::vector<Vector3>& texture_coord_data);
+  // Creates the mesh_index th mesh with its BVH in the arena
+  Triangle_mesh* restore_mesh(int mesh_index, const Scene* scene,
+                              int material_id, int texture_id,
+                              Triangle_shading_mode tsm, Arena& arena) const;
+
+  // Records a mesh after its BVH is built
+  void add_mesh(const Triangle_mesh& triangle_mesh);
+  bool save(const std::string& file_name, uint64_t key,
+            const std::vector<Vertex>& vertex_data,
+            const std::vector<Vector3>& texture_coord_data) const;
+
+ private:
+  // Nodes refer to nodes and triangles of their own mesh, so the arrays of
+  // a mesh are stored as they are
+  struct Cached_mesh {
+    int32_t first_triangle;
+    int32_t triangle_count;
+    int32_t first_node;
+    int32_t node_count;
+    int32_t first_wide_node;
+    int32_t wide_node_count;
+    // -1 when the face normals are computed from the vertices
+    int32_t first_face_normal;
+    int32_t vertex_offset;
+    int32_t texture_offset;
+  };
+
+  // Array in the mapping of a loaded cache
+  template <typename T>
+  struct Mapped_array {
+    const T* data;
+    size_t size;
+    Mapped_array() : data(nullptr), size(0) {}
+  };
+
+  // Ranges of the mesh are inside the arrays and its triangles and nodes
+  // only refer to its own triangles, nodes and vertices
+  bool is_valid(const Cached_mesh& mesh) const;
+
+  bool loaded_;
+  // Arrays of a loaded cache are read from the mapping. Each one is copied
+  // once, when the scene takes the vertices or a mesh takes its ranges.
+  std::unique_ptr<Mapped_file> file_;
+  Mapped_array<Vertex> mapped_vertex_data_;
+  Mapped_array<Vector3> mapped_texture_coord_data_;
+  Mapped_array<Cached_mesh> mapped_meshes_;
+  Mapped_array<Triangle_indices> mapped_triangles_;
+  Mapped_array<Triangle_mesh::Node> mapped_nodes_;
+  Mapped_array<Triangle_mesh::Wide_node> mapped_wide_nodes_;
+  Mapped_array<Octahedral_normal> mapped_face_normals_;
+  // Arrays of a cache that is being built, written by save
+  std::vector<Cached_mesh> meshes_;
+  std::vector<Triangle_indices> triangles_;
+  std::vector<Triangle_mesh::Node> nodes_;
+  std::vector<Triangle_mesh::Wide_node> wide_nodes_;
+  // Last array of the file, as its records are not made of 4 byte fields
+  std::vector<Octahedral_normal> face_normals_;
+};
+#endif
@@ -2,15 +2,23 @@
 #ifndef SHAPE_H_
 #define SHAPE_H_
 #include "Bounding_box.h"
-#include "Hit_data.h"
+#include "Hit_record.h"
+#include "Surface_interaction.h"
 //#define CULLING_ENABLED
 class Ray;
 class Shape {
  public:
   virtual ~Shape() = 0;
   virtual const Bounding_box& get_bounding_box() const = 0;
-  virtual bool intersect(const Ray& ray, Hit_data& hit_data,
+  // Returns true and fills hit_record when the ray hits the shape closer
+  // than hit_record.t, leaves it untouched otherwise
+  virtual bool intersect(const Ray& ray, Hit_record& hit_record,
                          bool culling) const = 0;
+  // Normal, texture coordinates and perlin value at a hit found by
+  // intersect with the same ray, called once for the closest hit
+  virtual void get_surface_interaction(
+      const Ray& ray, const Hit_record& hit_record,
+      Surface_interaction& interaction) const = 0;
   virtual int get_material_id() const = 0;
   virtual int get_texture_id() const = 0;
   virtual void print_debug(int indent) const = 0;
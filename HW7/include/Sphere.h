@@ -3,10 +3,10 @@
 #define SPHERE_H_
 #include <cmath>
 #include <limits>
+#include "Ray.h"
 #include "Shape.h"
 #include "Transformation.h"
 #include "Vector3.h"
-class Ray;
 class Scene;
 
 class Sphere : public Shape {
@@ -26,8 +26,10 @@ class Sphere : public Shape {
   const Bounding_box& get_bounding_box() const override {
     return bounding_box_;
   }
-  bool intersect(const Ray& ray, Hit_data& hit_data,
+  bool intersect(const Ray& ray, Hit_record& hit_record,
                  bool culling) const override;
+  void get_surface_interaction(const Ray& ray, const Hit_record& hit_record,
+                               Surface_interaction& interaction) const override;
   void print_debug(int indentation) const override {
     for (int index = 0; index < indentation; index++) {
       std::cout << "\t";
@@ -43,6 +45,12 @@ class Sphere : public Shape {
  private:
   bool is_identity_;
   Bounding_box bounding_box_;
+  // Ray in the space of the sphere at the time of the ray
+  Ray get_local_ray(const Ray& ray, bool with_differentials) const;
   void get_uv(const Vector3& local_coordinates, float& u, float& v) const;
+  void calculate_uv_differentials(const Ray& ray_local,
+                                  const Vector3& local_coordinates,
+                                  const Vector3& normal, float u, float v,
+                                  Surface_interaction& interaction) const;
 };
 #endif
@@ -1,24 +1,31 @@
 #pragma once
-#ifndef HIT_DATA_H_
-#define HIT_DATA_H_
+#ifndef SURFACE_INTERACTION_H_
+#define SURFACE_INTERACTION_H_
+#include <limits>
 #include "Vector3.h"
 class Shape;
-class Hit_data {
+// Shading data of the closest hit, normal after bump mapping, texture
+// coordinates and perlin value
+class Surface_interaction {
  public:
-  Hit_data()
+  Surface_interaction()
       : t(std::numeric_limits<float>::infinity()),
         shape(nullptr),
-        is_light_object(false),
         normal(0.0f),
         u(0.0f),
         v(0.0f),
         perlin_value(0.0f),
+        has_uv_differentials(false),
+        is_light_object(false),
         radiance(0.0f) {}
   float t;
   const Shape* shape;
   Vector3 normal;
   float u, v;          // for textures
   float perlin_value;  // for perlin noise
+  // Change of u and v to the neighbouring pixels, for texture filtering
+  bool has_uv_differentials;
+  float du_dx, dv_dx, du_dy, dv_dy;
   // Material_data material;
 
   bool is_light_object;
@@ -2,6 +2,7 @@
 #define TEXTURE_H
 #include <string>
 #include "Perlin_noise.h"
+#include "Texture_cache.h"
 #include "Vector3.h"
 class Texture {
  public:
@@ -9,18 +10,23 @@ class Texture {
           const std::string& decal_mode, const std::string& appearance,
           const float normalizer, const float scaling_factor,
           const bool is_bump, const float bumpmap_multiplier,
-          const bool is_degamma);
+          const bool is_degamma, Texture_cache* texture_cache);
   Texture(Texture&& rhs);
   ~Texture();
   Vector3 get_color_at(float u, float v) const;
+  // Filters with the mip pyramid, derivatives are the change of u and v to
+  // the neighbouring pixels
+  Vector3 get_color_at(float u, float v, float du_dx, float dv_dx,
+                       float du_dy, float dv_dy) const;
   inline float get_normalizer() const { return normalizer_; }
   Vector3 blend_color(const Vector3& texture_color,
                       const Vector3& diffuse_color) const;
   Vector3 bump_normal(const Vector3& dp_du, const Vector3& dp_dv,
                       const Vector3& normal, const float u,
                       const float v) const;
-  // For perlin
-  Vector3 bump_normal(const Vector3& normal, const Vector3& position) const;
+  // For perlin, also gives the noise value at position
+  Vector3 bump_normal(const Vector3& normal, const Vector3& position,
+                      float& perlin_value_out) const;
   enum Interpolation_type { it_nearest, it_bilinear };
   enum Decal_mode { dm_replace_kd, dm_blend_kd, dm_replace_all };
   enum Appearance { a_repeat, a_clamp };
@@ -38,13 +44,31 @@ class Texture {
   Interpolation_type interpolation_type_;
   Decal_mode decal_mode_;
   Appearance appearance_;
-  std::vector<float> texture_image_;
+  // Image is decoded by the cache on first access
+  Texture_cache* texture_cache_;
+  int image_id_;
   int width_;
   int height_;
+  int level_count_;
   float normalizer_;
   Perlin_noise* perlin_noise_;
   bool is_bump_;
   float bumpmap_multiplier_;
+  inline Vector3 get_texel(int level, int x, int y) const {
+    return texture_cache_->get_texel(image_id_, level, x, y);
+  }
+  // Clamps or wraps (u, v) into the image and scales it to texel units of a
+  // width x height level
+  void to_texel_coordinates(int width, int height, float& u, float& v) const;
+  Vector3 get_color_at_level(int level, float u, float v) const;
+  // Height of a bump map texel, the mean of its channels
+  inline float get_height(int x, int y) const {
+    const Vector3 color = get_texel(0, x, y);
+    return (color.x + color.y + color.z) / 3.0f;
+  }
+  // Change of the height when u or v moves by one texel, from the texels
+  // of the cell around (u, v)
+  void get_height_gradient(float u, float v, float& dd_du, float& dd_dv) const;
   Interpolation_type to_interpolation_type(const std::string& str) {
     return str == "nearest" ? it_nearest : it_bilinear;
   }
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef TEXTURE_CACHE_H_
+#define TEXTURE_CACHE_H_
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Vector3.h"
+// Tiles are TEXTURE_TILE_SIZE x TEXTURE_TILE_SIZE texels
+#define TEXTURE_TILE_SIZE 64
+// Default memory budget of the decoded tiles in megabytes
+#define TEXTURE_CACHE_DEFAULT_BUDGET_MB 512
+// Image textures are decoded when one of their texels is first needed and
+// kept as tiles under a memory budget shared by all threads. Ldr images are
+// kept as 8 bit RGBA and hdr images as half float RGBA texels. A mip
+// pyramid in the same format is built when an image is decoded, level 0 is
+// the image itself and every level is half the size of the one below. The
+// pyramid is cached like a tile while it fits in the budget and texels are
+// then read from it directly. Only pyramids larger than the budget are cut
+// into tiles. Least recently used tiles are dropped when the budget is
+// exceeded. Each thread also keeps a few tiles it used last, so the budget
+// may be exceeded by those.
+class Texture_cache {
+ public:
+  Texture_cache();
+  Texture_cache(const Texture_cache&) = delete;
+  Texture_cache& operator=(const Texture_cache&) = delete;
+  void set_budget(size_t budget_bytes);
+  // Reads only the image header. Throws std::runtime_error if the image
+  // cannot be read. Ldr images are converted to linear at lookup when
+  // is_degamma is set, hdr images are already linear.
+  int add_image(const std::string& image_name, bool is_degamma, int& width,
+                int& height);
+  // x and y must be inside the level
+  Vector3 get_texel(int image_id, int level, int x, int y);
+  // Levels down to a single texel
+  static inline int get_level_count(int width, int height) {
+    int level_count = 1;
+    while ((std::max(width, height) >> level_count) > 0) level_count++;
+    return level_count;
+  }
+
+ private:
+  struct Tile {
+    // Only one of them is filled depending on the image
+    std::vector<unsigned char> ldr_texels;
+    std::vector<uint16_t> hdr_texels;
+    // Whole pyramid of the image instead of a single tile
+    bool is_pyramid = false;
+  };
+  struct Cached_tile {
+    std::shared_ptr<const Tile> tile;
+    size_t bytes;
+    std::list<uint64_t>::iterator lru_position;
+  };
+  struct Image {
+    std::string image_name;
+    bool is_hdr;
+    int width;
+    int height;
+    int level_count;
+    // First channel of every level in the pyramid, the last entry is the
+    // channel count of the pyramid
+    std::vector<size_t> level_offsets;
+    // Only one thread decodes an image at a time
+    std::unique_ptr<std::mutex> decode_mutex;
+    // Value of each 8 bit channel, in [0, 255] like the channels themselves
+    float ldr_lut[256];
+  };
+  std::vector<Image> images_;
+  std::unordered_map<uint64_t, Cached_tile> tiles_;
+  // Most recently used tile keys are at the front
+  std::list<uint64_t> lru_;
+  std::mutex mutex_;
+  size_t budget_bytes_;
+  size_t used_bytes_;
+  // Distinguishes caches in the per thread tile slots
+  const int cache_id_;
+  std::shared_ptr<const Tile> find_tile(uint64_t key);
+  // Builds the pyramid of the image and returns it if it fits in the budget,
+  // otherwise cuts the tile from it
+  std::shared_ptr<const Tile> load_tile(int image_id, int level, int tile_x,
+                                        int tile_y);
+  // Decodes the image and filters its levels, the levels are stored one
+  // after another in a single tile at image.level_offsets
+  static std::shared_ptr<Tile> build_pyramid(const Image& image);
+  static std::shared_ptr<const Tile> cut_tile(const Image& image,
+                                              const Tile& pyramid, int level,
+                                              int tile_x, int tile_y);
+  // Expects mutex_ to be locked
+  void insert_tile(uint64_t key, const std::shared_ptr<const Tile>& tile,
+                   size_t bytes);
+  static inline uint64_t tile_key(int image_id, int level, int tile_x,
+                                  int tile_y) {
+    return ((uint64_t)image_id << 45) | ((uint64_t)level << 40) |
+           ((uint64_t)tile_y << 20) | (uint64_t)tile_x;
+  }
+  static inline size_t texel_bytes(bool is_hdr) {
+    return 4 * (is_hdr ? sizeof(uint16_t) : sizeof(unsigned char));
+  }
+  static inline size_t tile_bytes(bool is_hdr) {
+    return TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * texel_bytes(is_hdr);
+  }
+};
+#endif
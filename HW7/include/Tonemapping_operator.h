@@ -7,5 +7,9 @@ class Tonemapping_operator {
  public:
   virtual void apply_tmo(const std::vector<Vector3>& input,
                          std::vector<Vector3>& output) const = 0;
+  // Tonemaps and gamma corrects into 8 bit RGBA, rgba_output must hold four
+  // channels for every input color
+  virtual void apply_tmo_srgb(const std::vector<Vector3>& input,
+                              unsigned char* rgba_output) const = 0;
 };
 #endif
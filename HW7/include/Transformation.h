@@ -2,23 +2,30 @@
 
 #ifndef TRANSFORMATION_H_
 #define TRANSFORMATION_H_
+#include "Affine_transform.h"
 #include "Matrix4x4.h"
 
 class Transformation {
 public:
-	const Matrix4x4& get_transformation_matrix() const { 
-		return transformation_; 
+	Matrix4x4 get_transformation_matrix() const {
+		return transformation_.to_matrix();
 	}
-	const Matrix4x4& get_normal_transformation_matrix() const {
+	const Affine_transform& get_transformation() const {
+		return transformation_;
+	}
+	// Inverse transpose of the linear part
+	const Affine_transform& get_normal_transformation() const {
 		return normal_transformation_;
 	}
-	const Matrix4x4& get_inverse_transformation_matrix() const {
+	const Affine_transform& get_inverse_transformation() const {
 		return inverse_transformation_;
 	}
 protected:
-	Matrix4x4 transformation_;
-	Matrix4x4 normal_transformation_;
-	Matrix4x4 inverse_transformation_;
+	void set_transformation(const Matrix4x4& transformation,
+	                        const Matrix4x4& inverse_transformation);
+	Affine_transform transformation_;
+	Affine_transform normal_transformation_;
+	Affine_transform inverse_transformation_;
 };
 
 class Scaling : public Transformation {
@@ -17,8 +17,10 @@ class Triangle : public Shape {
   Triangle(const Scene* scene, int index_0, int index_1, int index_2,
            int offset, int material_id, int texture_id,
            const Transformation& transformation);
-  bool intersect(const Ray& ray, Hit_data& hit_data,
+  bool intersect(const Ray& ray, Hit_record& hit_record,
                  bool culling) const override;
+  void get_surface_interaction(const Ray& ray, const Hit_record& hit_record,
+                               Surface_interaction& interaction) const override;
   const Bounding_box& get_bounding_box() const override {
     return bounding_box_;
   }
@@ -0,0 +1,200 @@
+#pragma once
+#ifndef TRIANGLE_MESH_H_
+#define TRIANGLE_MESH_H_
+#include <cstdint>
+#include <vector>
+#include "Bounding_box.h"
+#include "Compressed_vertex.h"
+#include "Ray.h"
+#include "Shape.h"
+#include "Vector3.h"
+
+class Scene;
+enum Triangle_shading_mode { tsm_flat, tsm_smooth };
+
+// Vertex indices of a triangle, relative to the vertex offset of its mesh
+struct Triangle_indices {
+  int32_t vertex_index[3];
+};
+
+// Triangles of a mesh stored as a flat array of index triples. Scene,
+// offsets, material, texture and shading mode are shared by the whole mesh.
+// Face normals are computed from the vertices when they are needed, unless
+// the file gives them, then they are kept octahedral encoded like vertex
+// normals. Triangles are reordered into the leaves of a flat BVH, so bounding
+// boxes exist only in its nodes.
+// Meshes with a compressed BVH keep only eight wide nodes with quantized
+// child boxes instead of the binary nodes.
+class Triangle_mesh : public Shape {
+ public:
+  // Internal nodes have triangle_count 0, their children are the next node
+  // and the node at offset. Leaves hold triangle_count triangles starting
+  // at offset.
+  struct Node {
+    Vector3 min_corner;
+    Vector3 max_corner;
+    int32_t offset;
+    int32_t triangle_count;
+  };
+  // Node of the compressed BVH with up to eight children. Child boxes are
+  // offsets on a grid of 255 cells per axis that starts at origin, they are
+  // rounded outwards, so the decoded boxes contain the exact ones. Internal
+  // children are stored one after another from child_offset, the triangles
+  // of the leaf children one after another from triangle_offset.
+  struct Wide_node {
+    Vector3 origin;
+    // Biased float exponents of the cell sizes, 127 is a cell of size 1
+    uint8_t exponent[3];
+    // Bit i is set when child i is an internal node
+    uint8_t internal_mask;
+    int32_t child_offset;
+    int32_t triangle_offset;
+    // First triangle of a leaf child relative to triangle_offset shifted by
+    // 3, or'ed with its triangle count. 0 for internal children and unused
+    // slots.
+    uint8_t leaf[8];
+    uint8_t quantized_min[3][8];
+    uint8_t quantized_max[3][8];
+  };
+  // Derivatives of the position with respect to the texture coordinates,
+  // quantized to 16 bits per component relative to the largest component
+  // of the two. 16 bytes instead of two Vector3.
+  struct Tangent_frame {
+    float scale;
+    int16_t dp_du[3];
+    int16_t dp_dv[3];
+    static Tangent_frame pack(const Vector3& dp_du, const Vector3& dp_dv);
+    void unpack(Vector3& dp_du_out, Vector3& dp_dv_out) const {
+      dp_du_out = Vector3(dp_du[0], dp_du[1], dp_du[2]) * scale;
+      dp_dv_out = Vector3(dp_dv[0], dp_dv[1], dp_dv[2]) * scale;
+    }
+  };
+
+  // Builds the BVH. face_normals is either empty or has a normal for every
+  // triangle. compressed_bvh trades some traversal time for less memory.
+  Triangle_mesh(const Scene* scene, std::vector<Triangle_indices> triangles,
+                const std::vector<Vector3>& face_normals, int vertex_offset,
+                int texture_offset, int material_id, int texture_id,
+                Triangle_shading_mode tsm, bool compressed_bvh = false);
+  // Mesh with an already built BVH, e.g. from the scene cache. One of nodes
+  // and wide_nodes is empty.
+  Triangle_mesh(const Scene* scene, std::vector<Triangle_indices> triangles,
+                std::vector<Octahedral_normal> face_normals,
+                std::vector<Node> nodes, std::vector<Wide_node> wide_nodes,
+                int vertex_offset, int texture_offset, int material_id,
+                int texture_id, Triangle_shading_mode tsm);
+
+  // Checks nodes read from a file. Children come after their parents, leaves
+  // stay inside triangle_count and the depth fits the traversal stacks.
+  static bool is_valid_bvh(const Node* nodes, int node_count,
+                           const Wide_node* wide_nodes, int wide_node_count,
+                           int triangle_count);
+
+  bool intersect(const Ray& ray, Hit_record& hit_record,
+                 bool culling) const override;
+  // Interpolated normal, texture coordinates and perlin value of the
+  // triangle in hit_record.primitive
+  void get_surface_interaction(const Ray& ray, const Hit_record& hit_record,
+                               Surface_interaction& interaction) const override;
+  const Bounding_box& get_bounding_box() const override {
+    return bounding_box_;
+  }
+  int get_material_id() const override { return material_id_; }
+  int get_texture_id() const override { return texture_id_; }
+  void print_debug(int indentation) const override;
+
+  int get_triangle_count() const { return (int)triangles_.size(); }
+  const Vector3& get_vertex_position(int triangle, int corner) const;
+  // Unit face normal, from the file when it has them
+  Vector3 get_face_normal(int triangle) const;
+
+  const std::vector<Triangle_indices>& get_triangles() const {
+    return triangles_;
+  }
+  const std::vector<Octahedral_normal>& get_face_normals() const {
+    return face_normals_;
+  }
+  const std::vector<Node>& get_nodes() const { return nodes_; }
+  const std::vector<Wide_node>& get_wide_nodes() const { return wide_nodes_; }
+  // Memory of the nodes, binary or compressed
+  size_t get_bvh_bytes() const {
+    return nodes_.size() * sizeof(Node) +
+           wide_nodes_.size() * sizeof(Wide_node);
+  }
+  int get_vertex_offset() const { return vertex_offset_; }
+  int get_texture_offset() const { return texture_offset_; }
+
+ private:
+  std::vector<Triangle_indices> triangles_;
+  // Empty when the face normals are computed from the vertices
+  std::vector<Octahedral_normal> face_normals_;
+  std::vector<Node> nodes_;
+  // Empty unless the BVH is compressed, nodes_ is empty then
+  std::vector<Wide_node> wide_nodes_;
+  // A frame for every triangle when the texture is an image bump map, empty
+  // otherwise
+  std::vector<Tangent_frame> tangent_frames_;
+  Bounding_box bounding_box_;
+  const Scene* scene_;
+  int vertex_offset_;
+  int texture_offset_;
+  int material_id_;
+  int texture_id_;
+  Triangle_shading_mode triangle_shading_mode_;
+
+  void build_bvh(const std::vector<Vector3>& face_normals,
+                 bool compressed_bvh);
+  // Needs the texture of the mesh to be parsed
+  void build_tangent_frames();
+  int build_node(std::vector<int>& order,
+                 const std::vector<Vector3>& min_corners,
+                 const std::vector<Vector3>& max_corners,
+                 const std::vector<Vector3>& centers, int start, int end,
+                 int dimension, int depth);
+  // Fills wide_nodes_[index] with the children of the binary node, up to
+  // eight of them after the largest internal children are opened. Appends
+  // the triangles of its leaf children to wide_order.
+  void build_wide_node(int index, int binary_node,
+                       const std::vector<int>& order,
+                       std::vector<int>& wide_order);
+  // Union of the decoded child boxes of the root
+  Bounding_box get_wide_bounding_box() const;
+  bool intersect_wide(const Ray& ray, Hit_record& hit_record,
+                      bool culling) const;
+  // Tests count triangles from first, closest_* are updated on closer hits
+  inline void intersect_leaf(const Ray& ray, int first, int count,
+                             bool culling, float& closest_t,
+                             int& closest_triangle, float& closest_beta,
+                             float& closest_gamma) const {
+    const int end = first + count;
+    for (int i = first; i < end; i++) {
+      float t, beta, gamma;
+      if (intersect_triangle(ray, i, culling, t, beta, gamma) && t > 0.0f &&
+          t < closest_t) {
+        closest_t = t;
+        closest_triangle = i;
+        closest_beta = beta;
+        closest_gamma = gamma;
+      }
+    }
+  }
+  // Ray parameters of the intersection of the ray with the triangle and the
+  // barycentric coordinates of the point
+  bool intersect_triangle(const Ray& ray, int triangle, bool culling,
+                          float& t, float& beta, float& gamma) const;
+  // Fills the texture coordinate differentials of interaction from the ray
+  // differentials, u and v are the coordinates at the hit point
+  void calculate_uv_differentials(const Ray& ray, const Vector3& normal,
+                                  const Vector3& p_0, const Vector3& p_1,
+                                  const Vector3& p_2, const Vector3& uva,
+                                  const Vector3& uvb, const Vector3& uvc,
+                                  float u, float v,
+                                  Surface_interaction& interaction) const;
+  inline float determinant(const Vector3& col1, const Vector3& col2,
+                           const Vector3& col3) const {
+    return col1.x * (col2.y * col3.z - col3.y * col2.z) +
+           col2.x * (col3.y * col1.z - col1.y * col3.z) +
+           col3.x * (col1.y * col2.z - col2.y * col1.z);
+  }
+};
+#endif
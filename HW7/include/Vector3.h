@@ -97,11 +97,26 @@ class Vector3 {
   }
   inline bool operator!=(const Vector3& rhs) const { return !(*this == rhs); }
   inline Vector3 operator-() const { return Vector3(-x, -y, -z); }
+  // Offsets from &x would be undefined, constant indices fold the switch
   inline const float& operator[](const int i) const {
-    return i == 0 ? this->x : (i == 1 ? this->y : this->z);
+    switch (i) {
+      case 0:
+        return x;
+      case 1:
+        return y;
+      default:
+        return z;
+    }
   }
   inline float& operator[](const int i) {
-    return i == 0 ? this->x : (i == 1 ? this->y : this->z);
+    switch (i) {
+      case 0:
+        return x;
+      case 1:
+        return y;
+      default:
+        return z;
+    }
   }
 
   inline float dot(const Vector3& rhs) const {
@@ -115,6 +130,10 @@ class Vector3 {
   inline Vector3 normalize() const { return (*this) / this->length(); }
   friend std::ostream& operator<<(std::ostream& os, const Vector3& t);
 };
+// Arrays of Vector3 are read and written as packed floats, e.g. the scene
+// cache and the vertex arrays
+static_assert(sizeof(Vector3) == 3 * sizeof(float),
+              "Vector3 must not be padded");
 inline Vector3 operator+(float a, const Vector3& b) { return b + a; }
 inline Vector3 operator-(float a, const Vector3& b) { return Vector3(a) - b; }
 inline Vector3 operator*(float a, const Vector3& b) { return b * a; }
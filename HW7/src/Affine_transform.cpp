@@ -0,0 +1,111 @@
+#include "Affine_transform.h"
+#include <cmath>
+
+Affine_transform::Affine_transform() : kind_(k_identity) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      rows_[i][j] = ((i == j) ? 1.0f : 0.0f);
+    }
+  }
+}
+
+Affine_transform::Affine_transform(const Matrix4x4& matrix) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      rows_[i][j] = matrix[i][j];
+    }
+  }
+  update_kind();
+}
+
+Matrix4x4 Affine_transform::to_matrix() const {
+  Matrix4x4 matrix;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++) {
+      matrix[i][j] = rows_[i][j];
+    }
+  }
+  matrix[3][3] = 1.0f;
+  return matrix;
+}
+
+bool Affine_transform::invert(Affine_transform& inverse_out) const {
+  const float(*m)[4] = rows_;
+  // Cofactors of the linear part
+  const float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+  const float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+  const float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+  const float determinant = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+  if (determinant == 0.0f || !std::isfinite(determinant)) {
+    return false;
+  }
+  const float inverse_determinant = 1.0f / determinant;
+  float(*r)[4] = inverse_out.rows_;
+  r[0][0] = c00 * inverse_determinant;
+  r[1][0] = c01 * inverse_determinant;
+  r[2][0] = c02 * inverse_determinant;
+  r[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inverse_determinant;
+  r[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inverse_determinant;
+  r[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inverse_determinant;
+  r[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inverse_determinant;
+  r[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inverse_determinant;
+  r[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inverse_determinant;
+  // Inverse translation is the inverse linear part applied to -translation
+  for (int i = 0; i < 3; i++) {
+    r[i][3] = -(r[i][0] * m[0][3] + r[i][1] * m[1][3] + r[i][2] * m[2][3]);
+  }
+  inverse_out.update_kind();
+  return true;
+}
+
+Affine_transform Affine_transform::transpose_linear() const {
+  Affine_transform result;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      result.rows_[i][j] = rows_[j][i];
+    }
+    result.rows_[i][3] = 0.0f;
+  }
+  result.update_kind();
+  return result;
+}
+
+Affine_transform Affine_transform::translated_after(
+    const Vector3& delta) const {
+  Affine_transform result = *this;
+  result.rows_[0][3] += delta.x;
+  result.rows_[1][3] += delta.y;
+  result.rows_[2][3] += delta.z;
+  result.update_kind();
+  return result;
+}
+
+Affine_transform Affine_transform::translated_before(
+    const Vector3& delta) const {
+  Affine_transform result = *this;
+  const Vector3 translation = transform_vector(delta);
+  result.rows_[0][3] += translation.x;
+  result.rows_[1][3] += translation.y;
+  result.rows_[2][3] += translation.z;
+  result.update_kind();
+  return result;
+}
+
+void Affine_transform::update_kind() {
+  bool is_linear_identity = true;
+  bool is_translation_zero = true;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      is_linear_identity =
+          is_linear_identity && rows_[i][j] == ((i == j) ? 1.0f : 0.0f);
+    }
+    is_translation_zero = is_translation_zero && rows_[i][3] == 0.0f;
+  }
+  if (!is_linear_identity) {
+    kind_ = k_general;
+  } else if (!is_translation_zero) {
+    kind_ = k_translation;
+  } else {
+    kind_ = k_identity;
+  }
+}
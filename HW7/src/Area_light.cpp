@@ -35,3 +35,23 @@ Vector3 Area_light::incoming_radiance(const Vector3& from_point_to_light,
   float z = from_point_to_light.z;
   return intensity_ * (reverse_w_i.dot(normal_)) / (x * x + y * y + z * z);
 }
+
+int Area_light::generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                                 std::mt19937& generator) const {
+  std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
+  // Intensity falls with the cosine, so the emitted power is pi * intensity
+  const Vector3 flux = intensity_ * M_PI;
+  for (int i = 0; i < count; i++) {
+    float epsilon_1 = uniform_dist(generator);
+    float epsilon_2 = uniform_dist(generator);
+    const Vector3 position =
+        position_ + edge_vector_1_ * epsilon_1 + edge_vector_2_ * epsilon_2;
+    epsilon_1 = uniform_dist(generator);
+    epsilon_2 = uniform_dist(generator);
+    photon_rays[i] = Ray(
+        position, sample_cosine_direction(normal_, epsilon_1, epsilon_2),
+        r_photon);
+    fluxes[i] = flux;
+  }
+  return count;
+}
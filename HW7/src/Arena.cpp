@@ -0,0 +1,50 @@
+#include "Arena.h"
+#include <algorithm>
+#include <cstdint>
+
+Arena::Arena()
+    : current_(nullptr),
+      remaining_(0),
+      allocation_count_(0),
+      allocated_bytes_(0) {}
+
+Arena::~Arena() {
+  for (auto it = destructors_.rbegin(); it != destructors_.rend(); ++it) {
+    it->destroy(it->object);
+  }
+  for (char* block : blocks_) {
+    ::operator delete(block);
+  }
+}
+
+void* Arena::allocate(size_t size, size_t alignment) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  allocation_count_++;
+  allocated_bytes_ += size;
+  size_t padding = (alignment - (uintptr_t)current_ % alignment) % alignment;
+  if (!current_ || padding + size > remaining_) {
+    const size_t block_size =
+        std::max<size_t>(size + alignment, ARENA_BLOCK_SIZE);
+    char* block = (char*)::operator new(block_size);
+    blocks_.push_back(block);
+    padding = (alignment - (uintptr_t)block % alignment) % alignment;
+    if (block_size > ARENA_BLOCK_SIZE) {
+      // Current block keeps its space for the next small objects
+      return block + padding;
+    }
+    current_ = block;
+    remaining_ = block_size;
+  }
+  void* result = current_ + padding;
+  current_ += padding + size;
+  remaining_ -= padding + size;
+  return result;
+}
+
+void Arena::add_destructor(void* object, void (*destroy)(void*)) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Destructor destructor;
+  destructor.object = object;
+  destructor.destroy = destroy;
+  destructors_.push_back(destructor);
+}
@@ -0,0 +1,48 @@
+#include "BRDF.h"
+
+BRDF::BRDF() : BRDF(bt_none, 1.0f, 1.0f, 1.0f, 0.0f) {}
+
+BRDF::BRDF(BRDF_type type, float exponent, float diffuse_scale,
+           float specular_scale, float r_0)
+    : type_(type),
+      exponent_(exponent),
+      integer_exponent_(-1),
+      diffuse_scale_(diffuse_scale),
+      specular_scale_(specular_scale),
+      r_0_(r_0) {
+  if (exponent >= 0.0f && exponent <= BRDF_MAX_INTEGER_EXPONENT &&
+      exponent == std::floor(exponent)) {
+    integer_exponent_ = (int)exponent;
+  }
+}
+
+BRDF BRDF::create_phong(float exponent) {
+  return BRDF(bt_phong, exponent, 1.0f, 1.0f, 0.0f);
+}
+
+BRDF BRDF::create_modified_phong(float exponent, bool normalized) {
+  if (normalized) {
+    return BRDF(bt_modified_phong, exponent, 1.0f / M_PI,
+                (exponent + 2.0f) / (2.0f * M_PI), 0.0f);
+  }
+  return BRDF(bt_modified_phong, exponent, 1.0f, 1.0f, 0.0f);
+}
+
+BRDF BRDF::create_blinn_phong(float exponent) {
+  return BRDF(bt_blinn_phong, exponent, 1.0f, 1.0f, 0.0f);
+}
+
+BRDF BRDF::create_modified_blinn_phong(float exponent, bool normalized) {
+  if (normalized) {
+    return BRDF(bt_modified_blinn_phong, exponent, 1.0f / M_PI,
+                (exponent + 8.0f) / (8.0f * M_PI), 0.0f);
+  }
+  return BRDF(bt_modified_blinn_phong, exponent, 1.0f, 1.0f, 0.0f);
+}
+
+BRDF BRDF::create_torrance_sparrow(float exponent, float refractive_index) {
+  const float r_0 = ((refractive_index - 1.0f) * (refractive_index - 1.0f)) /
+                    ((refractive_index + 1.0f) * (refractive_index + 1.0f));
+  return BRDF(bt_torrance_sparrow, exponent, 1.0f / M_PI,
+              (exponent + 2.0f) / (2.0f * M_PI), r_0);
+}
@@ -1,6 +1,7 @@
 #include "Bounding_volume_hierarchy.h"
 #include <iostream>
-BVH::BVH(std::vector<Shape*>& objects, int start, int end, int dimension)
+BVH::BVH(std::vector<Shape*>& objects, int start, int end, int dimension,
+         Arena& arena)
     : left(NULL), right(NULL) {
   for (int index = start; index < end; index++) {
     bounding_box.expand(objects[index]->get_bounding_box());
@@ -19,39 +20,36 @@ BVH::BVH(std::vector<Shape*>& objects, int start, int end, int dimension)
   if (start + 1 == mid_index) {
     left = objects[start];
   } else {
-    left = new BVH(objects, start, mid_index, (dimension + 1) % 3);
+    left = arena.create_without_destructor<BVH>(objects, start, mid_index,
+                                                (dimension + 1) % 3, arena);
   }
   if (mid_index + 1 == end) {
     right = objects[mid_index];
   } else {
-    right = new BVH(objects, mid_index, end, (dimension + 1) % 3);
+    right = arena.create_without_destructor<BVH>(objects, mid_index, end,
+                                                 (dimension + 1) % 3, arena);
   }
 }
 
-bool BVH::intersect(const Ray& ray, Hit_data& hit_data, bool culling) const {
-  float bbox_t = bounding_box.intersect(ray);
-  if (bbox_t < 0.0f || bbox_t == kInf) {
+bool BVH::intersect(const Ray& ray, Hit_record& hit_record,
+                    bool culling) const {
+  float t_entry, t_exit;
+  if (!bounding_box.intersect(ray, t_entry, t_exit) || t_exit < 0.0f ||
+      t_exit == kInf) {
     return false;
   }
-  bool intersect = false;
-  Hit_data left_hit_data;
-  left_hit_data.t = std::numeric_limits<float>::infinity();
-  left_hit_data.shape = NULL;
-  left_hit_data.is_light_object = false;
-  if (left->intersect(ray, left_hit_data, culling) && left_hit_data.t > 0.0f &&
-      left_hit_data.t < hit_data.t) {
-    hit_data = left_hit_data;
-    intersect = true;
-  }
-  Hit_data right_hit_data;
-  right_hit_data.t = std::numeric_limits<float>::infinity();
-  right_hit_data.shape = NULL;
-  right_hit_data.is_light_object = false;
-  if (right->intersect(ray, right_hit_data, culling) &&
-      right_hit_data.t > 0.0f && right_hit_data.t < hit_data.t) {
-    intersect = true;
-    hit_data = right_hit_data;
+  // A box the ray enters behind the closest hit so far cannot hold a closer
+  // one, e.g. for shadow rays that start with t at the light
+  if (t_entry > hit_record.t) {
+    return false;
   }
+  // Children only write the record for closer hits, so it is shared
+  const bool left_hit = left->intersect(ray, hit_record, culling);
+  const bool right_hit = right->intersect(ray, hit_record, culling);
+  return left_hit || right_hit;
+}
 
-  return intersect;
+void BVH::get_surface_interaction(const Ray&, const Hit_record&,
+                                  Surface_interaction&) const {
+  // Hit records point to the objects in the leaves, never to a node
 }
@@ -0,0 +1,28 @@
+#include "Compressed_vertex.h"
+
+Octahedral_normal Octahedral_normal::pack(const Vector3& normal) {
+  const float length =
+      std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z);
+  float x = 0.0f;
+  float y = 0.0f;
+  if (length > 0.0f) {
+    x = normal.x / length;
+    y = normal.y / length;
+    if (normal.z < 0.0f) {
+      const float folded_x = (1.0f - std::fabs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+      y = (1.0f - std::fabs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+      x = folded_x;
+    }
+  }
+  Octahedral_normal packed;
+  packed.bits = (uint16_t)float_to_snorm16(x) |
+                ((uint32_t)(uint16_t)float_to_snorm16(y) << 16);
+  return packed;
+}
+
+Half_uv Half_uv::pack(const Vector3& uv) {
+  Half_uv packed;
+  packed.u = float_to_half(uv.x);
+  packed.v = float_to_half(uv.y);
+  return packed;
+}
@@ -0,0 +1,204 @@
+#include "Image_writer.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "lodepng.h"
+#include "tinyexr.h"
+
+Image_writer::Image_writer()
+    : is_writing_(false),
+      is_stopped_(false),
+      thread_(&Image_writer::run, this) {}
+
+Image_writer::~Image_writer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopped_ = true;
+  }
+  job_added_.notify_all();
+  thread_.join();
+}
+
+void Image_writer::write(Pixel* pixels, int width, int height,
+                         const std::string& file_name,
+                         const Tonemapping_operator* tmo,
+                         const Image_output_settings& settings) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Rendering waits only when it is far ahead of writing
+  job_done_.wait(lock, [this] {
+    return jobs_.size() < IMAGE_WRITER_MAX_QUEUED_IMAGES;
+  });
+  jobs_.push_back(Job{pixels, width, height, file_name, tmo, settings});
+  job_added_.notify_one();
+}
+
+void Image_writer::finish() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_done_.wait(lock, [this] { return jobs_.empty() && !is_writing_; });
+}
+
+void Image_writer::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    job_added_.wait(lock, [this] { return !jobs_.empty() || is_stopped_; });
+    if (jobs_.empty()) {
+      return;
+    }
+    Job job = jobs_.front();
+    jobs_.pop_front();
+    is_writing_ = true;
+    job_done_.notify_all();
+    lock.unlock();
+    write_job(job);
+    delete[] job.pixels;
+    lock.lock();
+    is_writing_ = false;
+    job_done_.notify_all();
+  }
+}
+
+void Image_writer::write_job(const Job& job) {
+  std::vector<std::thread> threads;
+  if (job.settings.write_exr) {
+    threads.push_back(std::thread(&Image_writer::write_exr, std::cref(job)));
+  }
+  if (job.settings.write_pfm) {
+    threads.push_back(std::thread(&Image_writer::write_pfm, std::cref(job)));
+  }
+  if (job.settings.write_png) {
+    write_png(job);
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+void Image_writer::write_png(const Job& job) {
+  const int pixel_count = job.width * job.height;
+  std::vector<unsigned char> image(4 * (size_t)pixel_count);
+  if (job.tmo) {
+    std::vector<Vector3> pixel_colors(pixel_count);
+    for (int i = 0; i < pixel_count; i++) {
+      pixel_colors[i] = job.pixels[i].get_color();
+    }
+    job.tmo->apply_tmo_srgb(pixel_colors, image.data());
+  } else {
+    for (int i = 0; i < pixel_count; i++) {
+      const Vector3 pixel = job.pixels[i].get_color();
+      image[4 * i] = clamp(0.0f, 255.0f, pixel.x);
+      image[4 * i + 1] = clamp(0.0f, 255.0f, pixel.y);
+      image[4 * i + 2] = clamp(0.0f, 255.0f, pixel.z);
+      image[4 * i + 3] = 255;
+    }
+  }
+  std::string png_image_name = job.file_name + ".png";
+  unsigned error = lodepng::encode(png_image_name.c_str(), image.data(),
+                                   job.width, job.height);
+  // if there's an error, display it
+  if (error) {
+    printf("encoder error %u: %s\n", error, lodepng_error_text(error));
+  } else {
+    printf("Saved png file. [ %s ] \n", png_image_name.c_str());
+  }
+}
+
+void Image_writer::write_exr(const Job& job) {
+  EXRHeader header;
+  InitEXRHeader(&header);
+
+  EXRImage exr_image;
+  InitEXRImage(&exr_image);
+
+  exr_image.num_channels = 3;
+
+  const int pixel_count = job.width * job.height;
+  std::vector<float> images[3];
+  images[0].resize(pixel_count);
+  images[1].resize(pixel_count);
+  images[2].resize(pixel_count);
+
+  for (int i = 0; i < pixel_count; i++) {
+    const Vector3 color = job.pixels[i].get_color();
+    images[0][i] = color.x;
+    images[1][i] = color.y;
+    images[2][i] = color.z;
+  }
+
+  float* image_ptr[3];
+  image_ptr[0] = &(images[2].at(0));  // B
+  image_ptr[1] = &(images[1].at(0));  // G
+  image_ptr[2] = &(images[0].at(0));  // R
+
+  exr_image.images = (unsigned char**)image_ptr;
+  exr_image.width = job.width;
+  exr_image.height = job.height;
+
+  header.num_channels = 3;
+  header.compression_type = job.settings.exr_compression_type;
+  header.channels =
+      (EXRChannelInfo*)malloc(sizeof(EXRChannelInfo) * header.num_channels);
+  // Must be (A)BGR order, since most of EXR viewers expect this
+  // channel order.
+  strncpy(header.channels[0].name, "B", 255);
+  header.channels[0].name[strlen("B")] = '\0';
+  strncpy(header.channels[1].name, "G", 255);
+  header.channels[1].name[strlen("G")] = '\0';
+  strncpy(header.channels[2].name, "R", 255);
+  header.channels[2].name[strlen("R")] = '\0';
+
+  header.pixel_types = (int*)malloc(sizeof(int) * header.num_channels);
+  header.requested_pixel_types =
+      (int*)malloc(sizeof(int) * header.num_channels);
+  for (int i = 0; i < header.num_channels; i++) {
+    // pixel type of input image
+    header.pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+    // pixel type of output image to be stored in .EXR
+    header.requested_pixel_types[i] = job.settings.is_exr_half
+                                          ? TINYEXR_PIXELTYPE_HALF
+                                          : TINYEXR_PIXELTYPE_FLOAT;
+  }
+
+  std::string exr_image_name = job.file_name + ".exr";
+
+  const char* err;
+  int ret =
+      SaveEXRImageToFile(&exr_image, &header, exr_image_name.c_str(), &err);
+  if (ret != TINYEXR_SUCCESS) {
+    fprintf(stderr, "Save EXR err: %s\n", err);
+  } else {
+    printf("Saved exr file. [ %s ] \n", exr_image_name.c_str());
+  }
+
+  free(header.channels);
+  free(header.pixel_types);
+  free(header.requested_pixel_types);
+}
+
+void Image_writer::write_pfm(const Job& job) {
+  std::string pfm_image_name = job.file_name + ".pfm";
+  FILE* file = fopen(pfm_image_name.c_str(), "wb");
+  if (!file) {
+    fprintf(stderr, "Save PFM err: %s cannot be opened\n",
+            pfm_image_name.c_str());
+    return;
+  }
+  // Negative scale marks little endian floats, rows are stored bottom up
+  fprintf(file, "PF\n%d %d\n-1.0\n", job.width, job.height);
+  std::vector<float> row(3 * (size_t)job.width);
+  bool is_written = true;
+  for (int j = job.height - 1; j >= 0 && is_written; j--) {
+    for (int i = 0; i < job.width; i++) {
+      const Vector3 color = job.pixels[j * job.width + i].get_color();
+      row[3 * i] = color.x;
+      row[3 * i + 1] = color.y;
+      row[3 * i + 2] = color.z;
+    }
+    is_written = fwrite(row.data(), sizeof(float), row.size(), file) ==
+                 row.size();
+  }
+  if (fclose(file) != 0 || !is_written) {
+    fprintf(stderr, "Save PFM err: %s cannot be written\n",
+            pfm_image_name.c_str());
+  } else {
+    printf("Saved pfm file. [ %s ] \n", pfm_image_name.c_str());
+  }
+}
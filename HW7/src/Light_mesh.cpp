@@ -16,33 +16,28 @@ Vector3 Light_mesh::direction_and_distance(const Vector3& from_point,
   // auto x = std::lower_bound(triangles_.begin(), triangles_.end(),
   //                          std::pair<const float, Shape*>(epsilon_0,
   //                          nullptr));
-  Mesh_triangle* triangle = nullptr;
+  int triangle = (int)cdf_.size() - 1;
   for (int i = 0; i < cdf_.size(); i++) {
     if (epsilon_0 <= cdf_[i]) {
-      triangle = (Mesh_triangle*)triangles_[i];
+      triangle = i;
       break;
     }
   }
 
-  const Vertex& vertex_0 =
-      scene_->get_vertex_at(triangle->vertex_index_0 + triangle->vertex_offset);
-  const Vertex& vertex_1 =
-      scene_->get_vertex_at(triangle->vertex_index_1 + triangle->vertex_offset);
-  const Vertex& vertex_2 =
-      scene_->get_vertex_at(triangle->vertex_index_2 + triangle->vertex_offset);
-  const Vector3& p_0 = vertex_0.get_vertex_position();
-  const Vector3& p_1 = vertex_1.get_vertex_position();
-  const Vector3& p_2 = vertex_2.get_vertex_position();
+  const Vector3& p_0 = triangle_mesh->get_vertex_position(triangle, 0);
+  const Vector3& p_1 = triangle_mesh->get_vertex_position(triangle, 1);
+  const Vector3& p_2 = triangle_mesh->get_vertex_position(triangle, 2);
   // std::cout << triangle->normal << std::endl;
   Vector3 q_in_object_space = (1.0f - epsilon_2) * p_1 + epsilon_2 * p_2;
   Vector3 p_in_object_space =
       (1.0f - epsilon_1) * p_0 + epsilon_1 * q_in_object_space;
   Vector3 p_in_world_space =
-      base_transform.get_transformation_matrix().multiply(p_in_object_space);
+      base_transform.get_transformation().transform_point(p_in_object_space);
   const Vector3 direction = p_in_world_space - from_point;
   distance = direction.length();
-  float cos_theta_i =
-      std::max(0.001f, -direction.normalize().dot(triangle->normal));
+  float cos_theta_i = std::max(
+      0.001f,
+      -direction.normalize().dot(triangle_mesh->get_face_normal(triangle)));
   probability = distance * distance / (total_area_ * cos_theta_i);
   // std::cout << cos_theta_i << p << probability << std::endl;
   return direction;
@@ -54,3 +49,39 @@ Vector3 Light_mesh::incoming_radiance(const Vector3& from_point_to_light,
                                       float probability) const {
   return radiance_ / probability;
 }
+
+int Light_mesh::generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                                 std::mt19937& generator) const {
+  std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
+  const Affine_transform& transformation_matrix =
+      base_transform.get_transformation();
+  const Affine_transform& normal_transformation_matrix =
+      base_transform.get_normal_transformation();
+  // Uniform over the area and cosine weighted over the hemisphere
+  const Vector3 flux = radiance_ * (M_PI * total_area_);
+  for (int i = 0; i < count; i++) {
+    float epsilon_0 = uniform_dist(generator);
+    float epsilon_1 = std::sqrt(uniform_dist(generator));
+    float epsilon_2 = uniform_dist(generator);
+    int triangle_index =
+        std::lower_bound(cdf_.begin(), cdf_.end(), epsilon_0) - cdf_.begin();
+    triangle_index = std::min(triangle_index, (int)cdf_.size() - 1);
+    const Vector3& p_0 = triangle_mesh->get_vertex_position(triangle_index, 0);
+    const Vector3& p_1 = triangle_mesh->get_vertex_position(triangle_index, 1);
+    const Vector3& p_2 = triangle_mesh->get_vertex_position(triangle_index, 2);
+    Vector3 q_in_object_space = (1.0f - epsilon_2) * p_1 + epsilon_2 * p_2;
+    Vector3 p_in_object_space =
+        (1.0f - epsilon_1) * p_0 + epsilon_1 * q_in_object_space;
+    const Vector3 normal =
+        normal_transformation_matrix
+            .transform_vector(triangle_mesh->get_face_normal(triangle_index))
+            .normalize();
+    epsilon_1 = uniform_dist(generator);
+    epsilon_2 = uniform_dist(generator);
+    photon_rays[i] =
+        Ray(transformation_matrix.transform_point(p_in_object_space),
+            sample_cosine_direction(normal, epsilon_1, epsilon_2), r_photon);
+    fluxes[i] = flux;
+  }
+  return count;
+}
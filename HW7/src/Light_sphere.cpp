@@ -11,7 +11,7 @@ Vector3 Light_sphere::direction_and_distance(const Vector3& from_point,
   float epsilon_2 = uniform_dist(generator);
 
   Vector3 point_in_sphere_space =
-      transformation_.get_inverse_transformation_matrix().multiply(from_point);
+      transformation_.get_inverse_transformation().transform_point(from_point);
   Vector3 w = center - point_in_sphere_space;
   float d = w.length();
   w = w.normalize();
@@ -31,21 +31,19 @@ Vector3 Light_sphere::direction_and_distance(const Vector3& from_point,
        u * std::sin(theta) * std::sin(phi))
           .normalize();
 
-  Vector3 l_in_world_space = transformation_.get_transformation_matrix()
-                                 .multiply(l_in_object_space, true)
+  Vector3 l_in_world_space = transformation_.get_transformation()
+                                 .transform_vector(l_in_object_space)
                                  .normalize();
 
   Ray ray_in_world_space(
       from_point + scene_->shadow_ray_epsilon * l_in_world_space,
       l_in_world_space, r_primary);
-  Hit_data light_hit_data;
-  light_hit_data.t = std::numeric_limits<float>::infinity();
-  light_hit_data.shape = NULL;
-  Sphere::intersect(ray_in_world_space, light_hit_data, true);
-  // if (!light_hit_data.shape) {
+  Hit_record light_hit_record;
+  Sphere::intersect(ray_in_world_space, light_hit_record, true);
+  // if (!light_hit_record.shape) {
   //  std::cout << "wtf" << std::endl;
   //}
-  distance = light_hit_data.t;
+  distance = light_hit_record.t;
   probability = 1 / (2 * M_PI * (1 - cos_theta_max));
   if (isnan(probability)) {
     std::cout << "wtf nan" << std::endl;
@@ -58,3 +56,36 @@ Vector3 Light_sphere::incoming_radiance(const Vector3& from_point_to_light,
                                         float probability) const {
   return radiance_ / probability;
 }
+
+int Light_sphere::generate_photons(Ray* photon_rays, Vector3* fluxes,
+                                   int count, std::mt19937& generator) const {
+  std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
+  const Affine_transform& transformation_matrix =
+      transformation_.get_transformation();
+  // Assumes a uniform scale when computing the surface area in world space
+  const float world_radius =
+      transformation_matrix.transform_vector(Vector3(radius, 0.0f, 0.0f))
+          .length();
+  const Vector3 flux =
+      radiance_ * (M_PI * 4 * M_PI * world_radius * world_radius);
+  for (int i = 0; i < count; i++) {
+    const float cos_theta = 1.0f - 2.0f * uniform_dist(generator);
+    const float sin_theta =
+        std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    const float phi = 2 * M_PI * uniform_dist(generator);
+    const Vector3 normal_in_object_space(sin_theta * std::cos(phi), cos_theta,
+                                         sin_theta * std::sin(phi));
+    const Vector3 position = transformation_matrix.transform_point(
+        center + normal_in_object_space * radius);
+    const Vector3 normal = transformation_.get_normal_transformation()
+                               .transform_vector(normal_in_object_space)
+                               .normalize();
+    const float epsilon_1 = uniform_dist(generator);
+    const float epsilon_2 = uniform_dist(generator);
+    photon_rays[i] = Ray(position + normal * scene_->shadow_ray_epsilon,
+                         sample_cosine_direction(normal, epsilon_1, epsilon_2),
+                         r_photon);
+    fluxes[i] = flux;
+  }
+  return count;
+}
@@ -0,0 +1,88 @@
+#include "Mapped_file.h"
+#include <stdexcept>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+Mapped_file::Mapped_file(const std::string& filename)
+    : data_(nullptr),
+      size_(0),
+      file_handle_(INVALID_HANDLE_VALUE),
+      mapping_handle_(nullptr) {
+  file_handle_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                             NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_handle_ == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Error: " + filename + " cannot be opened.");
+  }
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(file_handle_, &file_size);
+  size_ = (size_t)file_size.QuadPart;
+  if (size_ == 0) {
+    return;
+  }
+  mapping_handle_ =
+      CreateFileMappingA(file_handle_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping_handle_) {
+    data_ = (const unsigned char*)MapViewOfFile(mapping_handle_, FILE_MAP_READ,
+                                                0, 0, 0);
+  }
+  if (!data_) {
+    if (mapping_handle_) {
+      CloseHandle(mapping_handle_);
+    }
+    CloseHandle(file_handle_);
+    throw std::runtime_error("Error: " + filename + " cannot be mapped.");
+  }
+}
+
+Mapped_file::~Mapped_file() {
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  if (mapping_handle_) {
+    CloseHandle(mapping_handle_);
+  }
+  CloseHandle(file_handle_);
+}
+#else
+Mapped_file::Mapped_file(const std::string& filename)
+    : data_(nullptr), size_(0), file_descriptor_(-1) {
+  file_descriptor_ = open(filename.c_str(), O_RDONLY);
+  if (file_descriptor_ == -1) {
+    throw std::runtime_error("Error: " + filename + " cannot be opened.");
+  }
+  struct stat file_stat;
+  if (fstat(file_descriptor_, &file_stat) == -1) {
+    close(file_descriptor_);
+    throw std::runtime_error("Error: " + filename + " cannot be read.");
+  }
+  size_ = (size_t)file_stat.st_size;
+  if (size_ == 0) {
+    return;
+  }
+  void* mapping =
+      mmap(NULL, size_, PROT_READ, MAP_PRIVATE, file_descriptor_, 0);
+  if (mapping == MAP_FAILED) {
+    close(file_descriptor_);
+    throw std::runtime_error("Error: " + filename + " cannot be mapped.");
+  }
+  // Whole file is read front to back once
+  madvise(mapping, size_, MADV_SEQUENTIAL);
+  data_ = (const unsigned char*)mapping;
+}
+
+Mapped_file::~Mapped_file() {
+  if (data_) {
+    munmap((void*)data_, size_);
+  }
+  close(file_descriptor_);
+}
+#endif
@@ -26,24 +26,20 @@ Matrix4x4::Matrix4x4(float element) {
 }
 
 Vector3 Matrix4x4::multiply(const Vector3& rhs, bool is_vector) const {
-  Vector3 result;
+  // Unrolled, the terms are added in the same order as the row loop
+  const float* row_0 = elements_[0];
+  const float* row_1 = elements_[1];
+  const float* row_2 = elements_[2];
   if (is_vector) {
-    for (int i = 0; i < 3; i++) {
-      result[i] = 0;
-      for (int j = 0; j < 3; j++) {
-        result[i] += elements_[i][j] * rhs[j];
-      }
-    }
-  } else {
-    // point
-    for (int i = 0; i < 3; i++) {
-      result[i] = elements_[i][3];
-      for (int j = 0; j < 3; j++) {
-        result[i] += elements_[i][j] * rhs[j];
-      }
-    }
+    return Vector3(row_0[0] * rhs.x + row_0[1] * rhs.y + row_0[2] * rhs.z,
+                   row_1[0] * rhs.x + row_1[1] * rhs.y + row_1[2] * rhs.z,
+                   row_2[0] * rhs.x + row_2[1] * rhs.y + row_2[2] * rhs.z);
   }
-  return result;
+  // point
+  return Vector3(
+      row_0[3] + row_0[0] * rhs.x + row_0[1] * rhs.y + row_0[2] * rhs.z,
+      row_1[3] + row_1[0] * rhs.x + row_1[1] * rhs.y + row_1[2] * rhs.z,
+      row_2[3] + row_2[0] * rhs.x + row_2[1] * rhs.y + row_2[2] * rhs.z);
 }
 
 Matrix4x4 Matrix4x4::operator*(const Matrix4x4& rhs) const {
@@ -0,0 +1,196 @@
+#include "Number_parser.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+// Texts shorter than this are parsed on the calling thread only
+#define NUMBER_PARSER_CHUNK_SIZE (1 << 20)
+
+namespace {
+inline bool is_space(char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+inline const char* skip_spaces(const char* p, const char* end) {
+  while (p < end && is_space(*p)) p++;
+  return p;
+}
+
+// Returns the position after the number, or nullptr if it is not a number
+const char* parse_number(const char* p, const char* end, int& value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  if (p == end || !is_digit(*p)) {
+    return nullptr;
+  }
+  long long result = 0;
+  while (p < end && is_digit(*p)) {
+    result = result * 10 + (*p - '0');
+    p++;
+  }
+  value = (int)(negative ? -result : result);
+  return p;
+}
+
+const char* parse_number(const char* p, const char* end, float& value) {
+  static const double powers_of_ten[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  // At most 19 significant digits fit in the mantissa, rest only moves the
+  // exponent. This is more than enough for a float.
+  uint64_t mantissa = 0;
+  int significant_digits = 0;
+  int exponent = 0;
+  bool has_digits = false;
+  while (p < end && is_digit(*p)) {
+    if (significant_digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa != 0) significant_digits++;
+    } else {
+      exponent++;
+    }
+    has_digits = true;
+    p++;
+  }
+  if (p < end && *p == '.') {
+    p++;
+    while (p < end && is_digit(*p)) {
+      if (significant_digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa != 0) significant_digits++;
+        exponent--;
+      }
+      has_digits = true;
+      p++;
+    }
+  }
+  if (!has_digits) {
+    return nullptr;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    int exponent_part;
+    p = parse_number(p + 1, end, exponent_part);
+    if (!p) {
+      return nullptr;
+    }
+    exponent += exponent_part;
+  }
+  double result = (double)mantissa;
+  if (mantissa != 0 && exponent != 0) {
+    if (exponent > 0) {
+      result *= exponent <= 22 ? powers_of_ten[exponent]
+                               : std::pow(10.0, exponent);
+    } else {
+      result /= exponent >= -22 ? powers_of_ten[-exponent]
+                                : std::pow(10.0, -exponent);
+    }
+  }
+  value = (float)(negative ? -result : result);
+  return p;
+}
+
+int count_numbers(const char* p, const char* end) {
+  int count = 0;
+  while (true) {
+    p = skip_spaces(p, end);
+    if (p == end) {
+      return count;
+    }
+    count++;
+    while (p < end && !is_space(*p)) p++;
+  }
+}
+
+template <typename T>
+bool parse_numbers(const char* p, const char* end, T* values) {
+  while (true) {
+    p = skip_spaces(p, end);
+    if (p == end) {
+      return true;
+    }
+    p = parse_number(p, end, *values);
+    if (!p || (p < end && !is_space(*p))) {
+      return false;
+    }
+    values++;
+  }
+}
+
+template <typename T>
+bool parse_all(const char* text, std::vector<T>& values) {
+  values.clear();
+  if (!text) {
+    return true;
+  }
+  const char* end = text + std::strlen(text);
+  int chunk_count = std::thread::hardware_concurrency();
+  if (chunk_count == 0 || end - text < NUMBER_PARSER_CHUNK_SIZE) {
+    chunk_count = 1;
+  }
+  // Chunk boundaries are moved forward to a whitespace so that no number is
+  // split between two chunks
+  std::vector<const char*> boundaries(chunk_count + 1, end);
+  boundaries[0] = text;
+  for (int i = 1; i < chunk_count; i++) {
+    const char* p = std::max(boundaries[i - 1],
+                             text + (end - text) / chunk_count * i);
+    while (p < end && !is_space(*p)) p++;
+    boundaries[i] = p;
+  }
+
+  std::vector<int> offsets(chunk_count + 1, 0);
+  std::vector<char> succeeded(chunk_count, true);
+  auto count_chunk = [&](int i) {
+    offsets[i + 1] = count_numbers(boundaries[i], boundaries[i + 1]);
+  };
+  auto parse_chunk = [&](int i) {
+    succeeded[i] = parse_numbers(boundaries[i], boundaries[i + 1],
+                                 values.data() + offsets[i]);
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < chunk_count; i++) {
+    threads.push_back(std::thread(count_chunk, i));
+  }
+  count_chunk(0);
+  for (std::thread& thread : threads) thread.join();
+  threads.clear();
+  for (int i = 0; i < chunk_count; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  values.resize(offsets[chunk_count]);
+  for (int i = 1; i < chunk_count; i++) {
+    threads.push_back(std::thread(parse_chunk, i));
+  }
+  parse_chunk(0);
+  for (std::thread& thread : threads) thread.join();
+  for (char chunk_succeeded : succeeded) {
+    if (!chunk_succeeded) {
+      values.clear();
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+bool Number_parser::parse_floats(const char* text,
+                                 std::vector<float>& values) {
+  return parse_all(text, values);
+}
+
+bool Number_parser::parse_ints(const char* text, std::vector<int>& values) {
+  return parse_all(text, values);
+}
@@ -1,8 +1,18 @@
 #include "Perlin_noise.h"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <random>
 
+namespace {
+// 6t^5 - 15t^4 + 10t^3, the weight of the upper corner of a cell
+inline float fade(float t) { return t * t * t * (10 + t * (-15 + t * 6)); }
+// Derivative of fade, 30t^2(t - 1)^2
+inline float fade_derivative(float t) {
+  return t * t * (30 + t * (-60 + t * 30));
+}
+}  // namespace
+
 const std::vector<Vector3> Perlin_noise::g_ = {
     Vector3(1, 1, 0), Vector3(-1, 1, 0), Vector3(1, -1, 0), Vector3(-1, -1, 0),
     Vector3(1, 0, 1), Vector3(-1, 0, 1), Vector3(1, 0, -1), Vector3(-1, 0, -1),
@@ -13,32 +23,21 @@ Perlin_noise::Perlin_noise(const std::string& pn_appearance,
                            float scaling_factor)
     : scaling_factor_(scaling_factor) {
   pn_appearance_ = (pn_appearance == "vein") ? pn_vein : pn_patch;
-  p_ = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+  p_.resize(2 * PERLIN_NOISE_TABLE_SIZE);
+  for (int i = 0; i < PERLIN_NOISE_TABLE_SIZE; i++) {
+    p_[i] = i;
+  }
   std::mt19937 random_engine;
   random_engine.seed(
       std::chrono::system_clock::now().time_since_epoch().count());
-  std::shuffle(p_.begin(), p_.end(), random_engine);
+  std::shuffle(p_.begin(), p_.begin() + PERLIN_NOISE_TABLE_SIZE,
+               random_engine);
+  std::copy(p_.begin(), p_.begin() + PERLIN_NOISE_TABLE_SIZE,
+            p_.begin() + PERLIN_NOISE_TABLE_SIZE);
 }
 
 float Perlin_noise::get_value_at(const Vector3& position) const {
-  Vector3 scaled_position = position * scaling_factor_;
-  float value = 0.0f;
-  int x = floor(scaled_position.x);
-  int y = floor(scaled_position.y);
-  int z = floor(scaled_position.z);
-  for (int i = x; i <= x + 1; i++) {
-    for (int j = y; j <= y + 1; j++) {
-      for (int k = z; k <= z + 1; k++) {
-        const Vector3 v(scaled_position.x - i, scaled_position.y - j,
-                        scaled_position.z - k);
-        const Vector3 e = edge_vector_at(i, j, k);
-        const float w_x = weight_function(v.x);
-        const float w_y = weight_function(v.y);
-        const float w_z = weight_function(v.z);
-        value += e.dot(v) * w_x * w_y * w_z;
-      }
-    }
-  }
+  const float value = noise(position * scaling_factor_, nullptr);
   switch (pn_appearance_) {
     case pn_vein:
       return fabs(value);
@@ -47,16 +46,66 @@ float Perlin_noise::get_value_at(const Vector3& position) const {
   }
   return 0.0f;
 }
-inline float Perlin_noise::weight_function(float x) const {
-  return -6 * pow(fabs(x), 5) + 15 * pow(fabs(x), 4) + -10 * pow(fabs(x), 3) +
-         1;
+
+float Perlin_noise::get_value_and_gradient_at(const Vector3& position,
+                                              Vector3& gradient) const {
+  Vector3 noise_gradient;
+  const float value = noise(position * scaling_factor_, &noise_gradient);
+  switch (pn_appearance_) {
+    case pn_vein:
+      gradient =
+          noise_gradient * (value < 0.0f ? -scaling_factor_ : scaling_factor_);
+      return fabs(value);
+    case pn_patch:
+      gradient = noise_gradient * (scaling_factor_ / 2.0f);
+      return (value + 1.0f) / 2.0f;
+  }
+  gradient = Vector3(0.0f);
+  return 0.0f;
 }
-Vector3 Perlin_noise::edge_vector_at(int i, int j, int k) const {
-  i = i % 16;
-  j = j % 16;
-  k = k % 16;
-  if (i < 0) i += 16;
-  if (j < 0) j += 16;
-  if (k < 0) k += 16;
-  return g_[p_[(i + p_[(j + p_[k % 16]) % 16]) % 16]];
+
+inline float Perlin_noise::noise(const Vector3& scaled_position,
+                                 Vector3* gradient) const {
+  const float floor_x = std::floor(scaled_position.x);
+  const float floor_y = std::floor(scaled_position.y);
+  const float floor_z = std::floor(scaled_position.z);
+  const int i = (int)floor_x & (PERLIN_NOISE_TABLE_SIZE - 1);
+  const int j = (int)floor_y & (PERLIN_NOISE_TABLE_SIZE - 1);
+  const int k = (int)floor_z & (PERLIN_NOISE_TABLE_SIZE - 1);
+  // Position in the cell
+  const Vector3 f(scaled_position.x - floor_x, scaled_position.y - floor_y,
+                  scaled_position.z - floor_z);
+  // Weights of the lower and upper corners along each axis
+  const Vector3 upper(fade(f.x), fade(f.y), fade(f.z));
+  const Vector3 lower = Vector3(1.0f) - upper;
+  const Vector3 upper_derivative(fade_derivative(f.x), fade_derivative(f.y),
+                                 fade_derivative(f.z));
+  float value = 0.0f;
+  Vector3 value_gradient(0.0f);
+  for (int corner = 0; corner < 8; corner++) {
+    const int d_x = corner >> 2;
+    const int d_y = (corner >> 1) & 1;
+    const int d_z = corner & 1;
+    const Vector3& e = g_[p_[i + d_x + p_[j + d_y + p_[k + d_z]]] & 15];
+    const Vector3 v(f.x - d_x, f.y - d_y, f.z - d_z);
+    const float w_x = d_x ? upper.x : lower.x;
+    const float w_y = d_y ? upper.y : lower.y;
+    const float w_z = d_z ? upper.z : lower.z;
+    const float e_dot_v = e.dot(v);
+    const float weight = w_x * w_y * w_z;
+    value += e_dot_v * weight;
+    if (gradient) {
+      // Lower corner weights have the negated derivative
+      const float dw_x = d_x ? upper_derivative.x : -upper_derivative.x;
+      const float dw_y = d_y ? upper_derivative.y : -upper_derivative.y;
+      const float dw_z = d_z ? upper_derivative.z : -upper_derivative.z;
+      const Vector3 weight_gradient(dw_x * w_y * w_z, w_x * dw_y * w_z,
+                                    w_x * w_y * dw_z);
+      value_gradient += e * weight + weight_gradient * e_dot_v;
+    }
+  }
+  if (gradient) {
+    *gradient = value_gradient;
+  }
+  return value;
 }
@@ -1,5 +1,73 @@
 #include "Photographic_tmo.h"
 #include <algorithm>
+#include <cmath>
+#include <thread>
+// Images smaller than this many pixels per thread use fewer threads
+#define TMO_MIN_PIXELS_PER_THREAD 16384
+
+namespace {
+int get_chunk_count(size_t size) {
+  const int thread_count = std::max(1u, std::thread::hardware_concurrency());
+  return (int)std::max<size_t>(
+      1, std::min<size_t>(thread_count, size / TMO_MIN_PIXELS_PER_THREAD));
+}
+
+// Calls function(begin, end, chunk_index) on chunk_count contiguous chunks
+// of [0, size), the last chunk runs on the calling thread
+template <typename Function>
+void for_each_chunk(size_t size, int chunk_count, Function function) {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < chunk_count; i++) {
+    const size_t begin = size * i / chunk_count;
+    const size_t end = size * (i + 1) / chunk_count;
+    if (i == chunk_count - 1) {
+      function(begin, end, i);
+    } else {
+      threads.push_back(std::thread(function, begin, end, i));
+    }
+  }
+  for (auto& thread : threads) thread.join();
+}
+
+inline float get_luminance(const Vector3& color) {
+  return 0.21f * color.x + 0.72f * color.y + 0.07f * color.z;
+}
+
+unsigned char gamma_correct(float value) {
+  constexpr float inverse = 1.0f / 2.4f;
+  value = 1.055f * std::pow(clamp(0.0f, 1.0f, value), inverse) - 0.055f;
+  return clamp(0.0f, 1.0f, value) * 255.0f;
+}
+
+// Smallest values that are gamma corrected to 1, 2, ..., 255
+struct Srgb_thresholds {
+  float values[255];
+  Srgb_thresholds() {
+    for (int k = 1; k < 256; k++) {
+      float value = std::pow((k / 255.0f + 0.055f) / 1.055f, 2.4f);
+      // Rounding of the inverse is fixed so that the table agrees with
+      // gamma_correct exactly
+      while (value < 1.0f && gamma_correct(value) < k) {
+        value = std::nextafter(value, 2.0f);
+      }
+      float lower_value = std::nextafter(value, -1.0f);
+      while (value > 0.0f && gamma_correct(lower_value) >= k) {
+        value = lower_value;
+        lower_value = std::nextafter(value, -1.0f);
+      }
+      // Channels that are never reached get a threshold above the range
+      values[k - 1] = gamma_correct(value) >= k ? value : 2.0f;
+    }
+  }
+};
+
+inline unsigned char encode_srgb(float value, const float* thresholds) {
+  value = clamp(0.0f, 1.0f, value);
+  return (unsigned char)(std::upper_bound(thresholds, thresholds + 255,
+                                          value) -
+                         thresholds);
+}
+}  // namespace
 
 Photographic_tmo::Photographic_tmo(float image_key, float saturation_percentage,
                                    float saturation)
@@ -7,43 +75,95 @@ Photographic_tmo::Photographic_tmo(float image_key, float saturation_percentage,
       saturation_percentage_(saturation_percentage),
       saturation_(saturation) {}
 
-void Photographic_tmo::apply_tmo(const std::vector<Vector3>& input,
-                                 std::vector<Vector3>& output) const {
-  float log_average_luminance = 0;
-  size_t size = input.size();
-  std::vector<float> luminances;
+void Photographic_tmo::calculate_luminances(const std::vector<Vector3>& input,
+                                            float& log_average_luminance,
+                                            float& white_luminance) const {
+  const size_t size = input.size();
+  const int chunk_count = get_chunk_count(size);
+  std::vector<float> luminances(size);
+  std::vector<double> log_sums(chunk_count, 0.0);
   const float epsilon = 0.001;
-  for (size_t i = 0; i < size; i++) {
-    const Vector3& color = input[i];
-    float lum = (0.21f * color.x + 0.72f * color.y + 0.07f * color.z);
-    luminances.push_back(lum);
-    log_average_luminance += std::log(lum + epsilon);
-  }
-  log_average_luminance = std::exp(log_average_luminance / (float)size);
-  for (size_t i = 0; i < size; i++) {
-    luminances[i] = image_key_ * luminances[i] / log_average_luminance;
-  }
+  for_each_chunk(size, chunk_count, [&](size_t begin, size_t end, int chunk) {
+    double log_sum = 0.0;
+    for (size_t i = begin; i < end; i++) {
+      luminances[i] = get_luminance(input[i]);
+      log_sum += std::log(luminances[i] + epsilon);
+    }
+    log_sums[chunk] = log_sum;
+  });
+  double log_sum = 0.0;
+  for (double chunk_log_sum : log_sums) log_sum += chunk_log_sum;
+  log_average_luminance = (float)std::exp(log_sum / size);
 
-  std::vector<float> sorted_luminances = luminances;
-  std::sort(sorted_luminances.begin(), sorted_luminances.end());
+  // Scaling keeps the order of the luminances, so the white point can be
+  // selected before scaling
   float white_count = (float)size * saturation_percentage_ / 100.0f;
   white_count = std::max(0, std::min((int)size, (int)white_count));
-  float white_lum;
-  if (white_count == 0) {
-    white_lum = sorted_luminances[size - 1];
-  } else {
-    white_lum = sorted_luminances[size - (size_t)white_count];
+  const size_t white_index =
+      white_count == 0 ? size - 1 : size - (size_t)white_count;
+  std::nth_element(luminances.begin(), luminances.begin() + white_index,
+                   luminances.end());
+  white_luminance =
+      image_key_ * luminances[white_index] / log_average_luminance;
+}
+
+Vector3 Photographic_tmo::tonemap_color(const Vector3& color,
+                                        float log_average_luminance,
+                                        float white_luminance) const {
+  const float color_luminance = get_luminance(color);
+  const float luminance = image_key_ * color_luminance / log_average_luminance;
+  const float display_luminance =
+      (luminance * (1 + luminance / (white_luminance * white_luminance))) /
+      (luminance + 1);
+  if (saturation_ == 1.0f) {
+    return Vector3(color.x / color_luminance * display_luminance,
+                   color.y / color_luminance * display_luminance,
+                   color.z / color_luminance * display_luminance);
   }
+  return Vector3(
+      std::pow((color.x / color_luminance), saturation_) * display_luminance,
+      std::pow((color.y / color_luminance), saturation_) * display_luminance,
+      std::pow((color.z / color_luminance), saturation_) * display_luminance);
+}
+
+void Photographic_tmo::apply_tmo(const std::vector<Vector3>& input,
+                                 std::vector<Vector3>& output) const {
+  const size_t size = input.size();
+  output.resize(size);
+  if (size == 0) {
+    return;
+  }
+  float log_average_luminance, white_luminance;
+  calculate_luminances(input, log_average_luminance, white_luminance);
+  for_each_chunk(size, get_chunk_count(size),
+                 [&](size_t begin, size_t end, int) {
+                   for (size_t i = begin; i < end; i++) {
+                     output[i] = tonemap_color(input[i], log_average_luminance,
+                                               white_luminance);
+                   }
+                 });
+}
 
-  for (size_t i = 0; i < size; i++) {
-    luminances[i] =
-        (luminances[i] * (1 + luminances[i] / (white_lum * white_lum))) /
-        (luminances[i] + 1);
-    const Vector3& color = input[i];
-    float lum_i = (0.21f * color.x + 0.72f * color.y + 0.07f * color.z);
-    float r = std::pow((color.x / lum_i), saturation_) * luminances[i];
-    float g = std::pow((color.y / lum_i), saturation_) * luminances[i];
-    float b = std::pow((color.z / lum_i), saturation_) * luminances[i];
-    output.push_back(Vector3(r, g, b));
+void Photographic_tmo::apply_tmo_srgb(const std::vector<Vector3>& input,
+                                      unsigned char* rgba_output) const {
+  const size_t size = input.size();
+  if (size == 0) {
+    return;
   }
+  static const Srgb_thresholds srgb_thresholds;
+  const float* thresholds = srgb_thresholds.values;
+  float log_average_luminance, white_luminance;
+  calculate_luminances(input, log_average_luminance, white_luminance);
+  for_each_chunk(size, get_chunk_count(size),
+                 [&](size_t begin, size_t end, int) {
+                   for (size_t i = begin; i < end; i++) {
+                     const Vector3 color = tonemap_color(
+                         input[i], log_average_luminance, white_luminance);
+                     unsigned char* texel = rgba_output + 4 * i;
+                     texel[0] = encode_srgb(color.x, thresholds);
+                     texel[1] = encode_srgb(color.y, thresholds);
+                     texel[2] = encode_srgb(color.z, thresholds);
+                     texel[3] = 255;
+                   }
+                 });
 }
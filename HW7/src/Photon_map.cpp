@@ -0,0 +1,93 @@
+#include "Photon_map.h"
+#include <algorithm>
+#include "Bounding_box.h"
+
+void Photon_map::build(std::vector<std::vector<Photon>>& photon_lists,
+                       long long emitted_photon_count) {
+  size_t total_size = 0;
+  for (const std::vector<Photon>& photons : photon_lists) {
+    total_size += photons.size();
+  }
+  photons_.clear();
+  photons_.reserve(total_size);
+  for (std::vector<Photon>& photons : photon_lists) {
+    photons_.insert(photons_.end(), photons.begin(), photons.end());
+    std::vector<Photon>().swap(photons);
+  }
+  emitted_photon_count_ = emitted_photon_count;
+  balance(0, (int)photons_.size());
+}
+
+void Photon_map::balance(int start, int end) {
+  if (end - start < 1) {
+    return;
+  }
+  const int mid_index = (start + end) / 2;
+  if (end - start == 1) {
+    photons_[mid_index].axis = 0;
+    return;
+  }
+  Bounding_box bounding_box;
+  for (int index = start; index < end; index++) {
+    bounding_box.expand(
+        Bounding_box(photons_[index].position, photons_[index].position));
+  }
+  const int axis = bounding_box.max_dimension();
+  std::nth_element(photons_.begin() + start, photons_.begin() + mid_index,
+                   photons_.begin() + end,
+                   [axis](const Photon& lhs, const Photon& rhs) {
+                     return lhs.position[axis] < rhs.position[axis];
+                   });
+  photons_[mid_index].axis = axis;
+  balance(start, mid_index);
+  balance(mid_index + 1, end);
+}
+
+float Photon_map::locate_nearest(const Vector3& position, int k,
+                                 float max_radius_squared,
+                                 std::vector<Nearest_photon>& nearest) const {
+  nearest.clear();
+  if (k <= 0) {
+    return 0.0f;
+  }
+  locate(0, (int)photons_.size(), position, k, max_radius_squared, nearest);
+  return nearest.empty() ? 0.0f : nearest.front().first;
+}
+
+void Photon_map::locate(int start, int end, const Vector3& position, int k,
+                        float& max_radius_squared,
+                        std::vector<Nearest_photon>& nearest) const {
+  if (end - start < 1) {
+    return;
+  }
+  const int mid_index = (start + end) / 2;
+  const Photon& photon = photons_[mid_index];
+  const float delta = position[photon.axis] - photon.position[photon.axis];
+  if (delta < 0.0f) {
+    locate(start, mid_index, position, k, max_radius_squared, nearest);
+    if (delta * delta < max_radius_squared) {
+      locate(mid_index + 1, end, position, k, max_radius_squared, nearest);
+    }
+  } else {
+    locate(mid_index + 1, end, position, k, max_radius_squared, nearest);
+    if (delta * delta < max_radius_squared) {
+      locate(start, mid_index, position, k, max_radius_squared, nearest);
+    }
+  }
+
+  const Vector3 v = photon.position - position;
+  const float distance_squared = v.dot(v);
+  if (distance_squared >= max_radius_squared) {
+    return;
+  }
+  // nearest is kept as a max heap, the farthest photon is at the front
+  if ((int)nearest.size() == k) {
+    std::pop_heap(nearest.begin(), nearest.end());
+    nearest.pop_back();
+  }
+  nearest.push_back(Nearest_photon(distance_squared, &photon));
+  std::push_heap(nearest.begin(), nearest.end());
+  if ((int)nearest.size() == k) {
+    max_radius_squared = nearest.front().first;
+  }
+}
@@ -19,3 +19,22 @@ Vector3 Point_light::incoming_radiance(const Vector3& from_point_to_light,
   float z = from_point_to_light.z;
   return intensity_ / (x * x + y * y + z * z);
 }
+
+int Point_light::generate_photons(Ray* photon_rays, Vector3* fluxes,
+                                  int count, std::mt19937& generator) const {
+  std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
+  // Uniform over the sphere, probability is 1 / (4 * pi)
+  const Vector3 flux = intensity_ * (4 * M_PI);
+  for (int i = 0; i < count; i++) {
+    const float cos_theta = 1.0f - 2.0f * uniform_dist(generator);
+    const float sin_theta =
+        std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    const float phi = 2 * M_PI * uniform_dist(generator);
+    photon_rays[i] = Ray(position_,
+                         Vector3(sin_theta * std::cos(phi), cos_theta,
+                                 sin_theta * std::sin(phi)),
+                         r_photon);
+    fluxes[i] = flux;
+  }
+  return count;
+}
@@ -1,15 +1,180 @@
 #include "Scene.h"
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <exception>
 #include <fstream>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 #include "Light_mesh.h"
 #include "Light_sphere.h"
+#include "Mapped_file.h"
+#include "Number_parser.h"
 #include "Pixel.h"
+#include "Scene_cache.h"
+#include "tinyexr.h"
 #include "tinyply.h"
 #include "tinyxml2.h"
 //#define GAUSSIAN_FILTER
+#define PHOTON_BATCH_SIZE 1024
+// Caustic gather radius without MaxGatherRadius, as a fraction of the
+// diagonal of the scene bounds
+#define CAUSTIC_DEFAULT_GATHER_RADIUS_FRACTION 0.01f
+// Meshes with less than this many triangles per thread are created on the
+// calling thread only
+#define MESH_TRIANGLE_CHUNK_SIZE 65536
+// Ply files with a longer header are left to tinyply
+#define PLY_MAX_HEADER_SIZE 65536
+
+namespace {
+// Settings of a Mesh element that are needed to load it on a worker thread
+struct Mesh_load_job {
+  const tinyxml2::XMLElement* faces;
+  int material_id;
+  int texture_id;
+  Triangle_shading_mode tsm;
+  bool compressed_bvh;
+  Matrix4x4 transformation;
+  Vector3 velocity;
+  int vertex_offset;
+  int texture_offset;
+  // -1 when the mesh is not restored from the scene cache
+  int cached_mesh_index;
+};
+
+// Header of a ply file as needed by the native binary reader
+struct Ply_property {
+  std::string name;
+  std::string type;
+  bool is_list;
+  std::string count_type;
+};
+struct Ply_element {
+  std::string name;
+  size_t count;
+  std::vector<Ply_property> properties;
+};
+
+// Size of a ply scalar type in bytes, 0 when the type is unknown
+size_t ply_type_size(const std::string& type) {
+  if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") {
+    return 1;
+  }
+  if (type == "short" || type == "ushort" || type == "int16" ||
+      type == "uint16") {
+    return 2;
+  }
+  if (type == "int" || type == "uint" || type == "int32" || type == "uint32" ||
+      type == "float" || type == "float32") {
+    return 4;
+  }
+  if (type == "double" || type == "float64") {
+    return 8;
+  }
+  return 0;
+}
+
+bool is_ply_float(const std::string& type) {
+  return type == "float" || type == "float32";
+}
+
+// Parses the ascii header of a binary little endian ply file. Returns false
+// for any other format, header_size is the offset of the first element.
+bool parse_ply_header(const Mapped_file& file,
+                      std::vector<Ply_element>& elements,
+                      size_t& header_size) {
+  const std::string end_line = "end_header\n";
+  const size_t search_size = std::min(file.size(), (size_t)PLY_MAX_HEADER_SIZE);
+  const std::string text((const char*)file.data(), search_size);
+  const size_t header_end = text.find(end_line);
+  if (header_end == std::string::npos) {
+    return false;
+  }
+  header_size = header_end + end_line.size();
+  std::istringstream lines(text.substr(0, header_end));
+  std::string line;
+  if (!std::getline(lines, line) || line != "ply" ||
+      !std::getline(lines, line) ||
+      line != "format binary_little_endian 1.0") {
+    return false;
+  }
+  while (std::getline(lines, line)) {
+    std::istringstream words(line);
+    std::string keyword;
+    words >> keyword;
+    if (keyword == "element") {
+      Ply_element element;
+      if (!(words >> element.name >> element.count)) {
+        return false;
+      }
+      elements.push_back(element);
+    } else if (keyword == "property") {
+      Ply_property property;
+      if (elements.empty() || !(words >> property.type)) {
+        return false;
+      }
+      property.is_list = property.type == "list";
+      if (property.is_list) {
+        words >> property.count_type >> property.type;
+      }
+      if (!(words >> property.name) || ply_type_size(property.type) == 0 ||
+          (property.is_list && ply_type_size(property.count_type) == 0)) {
+        return false;
+      }
+      elements.back().properties.push_back(property);
+    } else if (keyword != "comment" && keyword != "obj_info" &&
+               !keyword.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads only the header of a ply file, so that its vertices and uvs can be
+// given a fixed range in the scene before the file itself is parsed. Binary
+// little endian headers are parsed natively, other formats by tinyply.
+void read_ply_vertex_layout(const std::string& filename, int& vertex_count,
+                            bool& has_uvs) {
+  std::vector<Ply_element> elements;
+  size_t header_size;
+  if (!parse_ply_header(Mapped_file(filename), elements, header_size)) {
+    elements.clear();
+    std::ifstream ss(filename, std::ios::binary);
+    tinyply::PlyFile file;
+    if (ss.fail() || !file.parse_header(ss)) {
+      throw std::runtime_error("Error: " + filename + " cannot be read.");
+    }
+    // Only the names and counts are needed
+    for (const tinyply::PlyElement& ply_element : file.get_elements()) {
+      Ply_element element;
+      element.name = ply_element.name;
+      element.count = ply_element.size;
+      for (const tinyply::PlyProperty& ply_property : ply_element.properties) {
+        Ply_property property;
+        property.name = ply_property.name;
+        element.properties.push_back(property);
+      }
+      elements.push_back(element);
+    }
+  }
+  vertex_count = 0;
+  has_uvs = false;
+  for (const Ply_element& element : elements) {
+    if (element.name == "vertex") {
+      vertex_count = (int)element.count;
+      bool has_u = false, has_v = false;
+      for (const Ply_property& property : element.properties) {
+        has_u = has_u || property.name == "u";
+        has_v = has_v || property.name == "v";
+      }
+      has_uvs = has_u && has_v;
+    }
+  }
+}
+}  // namespace
+
 inline float gaussian_filter(float x, float y, float sigma) {
   return exp(-(x * x + y * y) / (2 * sigma * sigma)) /
          (float)(2 * M_PI * sigma);
@@ -38,6 +203,9 @@ void Scene::render_image(int camera_index, Pixel* result,
     std::uniform_real_distribution<float> ms_distribution(0.0f, 1.0f);
     std::uniform_real_distribution<float> dof_distribution(-1.0f, 1.0f);
     std::uniform_real_distribution<float> time_distribution(0.0f, 1.0f);
+    // Samples of a pixel share its footprint
+    const float differential_scale =
+        std::max(0.125f, 1.0f / number_of_samples);
     for (int j = starting_row; j < height; j += height_increase) {
       for (int i = 0; i < width; i++) {
         float aperture_size = camera.get_aperture_size();
@@ -48,19 +216,21 @@ void Scene::render_image(int camera_index, Pixel* result,
             float epsilon_y = ms_distribution(generator);
             float sample_x = (x + epsilon_x) / number_of_samples;
             float sample_y = (y + epsilon_y) / number_of_samples;
-            if (aperture_size == 0.0f) {
-              color = send_ray(
-                  camera.calculate_ray_at(i + sample_x, j + sample_y,
-                                          time_distribution(generator)),
-                  0);
-            } else {
-              float dof_epsilon_x = dof_distribution(generator);
-              float dof_epsilon_y = dof_distribution(generator);
-              color = send_ray(camera.calculate_ray_at(
-                                   i + sample_x, j + sample_y, dof_epsilon_x,
-                                   dof_epsilon_y, time_distribution(generator)),
-                               0);
+            float dof_epsilon_x = 0.0f;
+            float dof_epsilon_y = 0.0f;
+            if (aperture_size != 0.0f) {
+              dof_epsilon_x = dof_distribution(generator);
+              dof_epsilon_y = dof_distribution(generator);
             }
+            const float time = time_distribution(generator);
+            Ray ray = aperture_size == 0.0f
+                          ? camera.calculate_ray_at(i + sample_x,
+                                                    j + sample_y, time)
+                          : camera.calculate_ray_at(
+                                i + sample_x, j + sample_y, dof_epsilon_x,
+                                dof_epsilon_y, time);
+            ray.scale_differentials(differential_scale);
+            color = send_ray(ray, 0);
 #ifdef GAUSSIAN_FILTER
             for (int affected_j = j - 1; affected_j < j + 2; affected_j++) {
               if (affected_j < 0 || affected_j >= height) {
@@ -105,11 +275,12 @@ bool Scene::calculate_transmission(const Vector3& direction_unit,
   return true;
 }
 
-Vector3 Scene::refract_ray(const Ray& ray, const Hit_data& hit_data,
+Vector3 Scene::refract_ray(const Ray& ray,
+                           const Surface_interaction& interaction,
                            int recursion_level) const {
-  const Material& material = materials[hit_data.shape->get_material_id()];
-  const Vector3& normal = hit_data.normal;
-  const Vector3 intersection_point = ray.point_at(hit_data.t);
+  const Material& material = materials[interaction.shape->get_material_id()];
+  const Vector3& normal = interaction.normal;
+  const Vector3 intersection_point = ray.point_at(interaction.t);
   const Vector3 w_o = (ray.o - intersection_point).normalize();
   const Vector3 w_r = ((2 * normal.dot(w_o) * normal) - w_o).normalize();
   Vector3 transmission_direction = zero_vector;
@@ -126,7 +297,7 @@ Vector3 Scene::refract_ray(const Ray& ray, const Hit_data& hit_data,
     entering_ray = true;
   } else {
     const Vector3& transparency = material.transparency;
-    const float hit_data_t = hit_data.t;
+    const float hit_data_t = interaction.t;
     k.x = exp(log(transparency.x) * hit_data_t);
     k.y = exp(log(transparency.y) * hit_data_t);
     k.z = exp(log(transparency.z) * hit_data_t);
@@ -147,6 +318,8 @@ Vector3 Scene::refract_ray(const Ray& ray, const Hit_data& hit_data,
                        r_reflection, ray.time);
     reflection_ray.in_medium = true;
     reflection_ray.light_hit = ray.light_hit;
+    reflection_ray.caustic_path = ray.diffuse_bounce || ray.caustic_path;
+    bend_differentials(ray, interaction, normal, 0.0f, reflection_ray);
     return k * send_ray(reflection_ray, recursion_level + 1);
   } else {
     float r_0 = ((n - 1) * (n - 1)) / ((n + 1) * (n + 1));
@@ -155,19 +328,62 @@ Vector3 Scene::refract_ray(const Ray& ray, const Hit_data& hit_data,
                        r_reflection, ray.time);
     reflection_ray.in_medium = !entering_ray;
     reflection_ray.light_hit = ray.light_hit;
+    reflection_ray.caustic_path = ray.diffuse_bounce || ray.caustic_path;
+    bend_differentials(ray, interaction, normal, 0.0f, reflection_ray);
     Ray transmission_ray(
         intersection_point + (transmission_direction * shadow_ray_epsilon),
         transmission_direction, r_refraction, ray.time);
     transmission_ray.in_medium = entering_ray;
     transmission_ray.light_hit = ray.light_hit;
+    transmission_ray.caustic_path = ray.diffuse_bounce || ray.caustic_path;
+    if (entering_ray) {
+      bend_differentials(ray, interaction, normal, n, transmission_ray);
+    } else {
+      bend_differentials(ray, interaction, -normal, 1.0f / n, transmission_ray);
+    }
     return k * (r * send_ray(reflection_ray, recursion_level + 1) +
                 (1 - r) * send_ray(transmission_ray, recursion_level + 1));
   }
 }
 
+void Scene::bend_differentials(const Ray& ray,
+                               const Surface_interaction& interaction,
+                               const Vector3& normal, float refraction_index,
+                               Ray& new_ray) const {
+  if (!ray.has_differentials) {
+    return;
+  }
+  // Offset rays hit the tangent plane of the hit point and are reflected or
+  // refracted there as if the surface was flat
+  const Vector3 intersection_point = ray.point_at(interaction.t);
+  const float dx_dot_n = ray.rx_d.dot(normal);
+  const float dy_dot_n = ray.ry_d.dot(normal);
+  if (dx_dot_n == 0.0f || dy_dot_n == 0.0f) {
+    return;
+  }
+  const Vector3 p_x =
+      ray.rx_o +
+      ray.rx_d * ((intersection_point - ray.rx_o).dot(normal) / dx_dot_n);
+  const Vector3 p_y =
+      ray.ry_o +
+      ray.ry_d * ((intersection_point - ray.ry_o).dot(normal) / dy_dot_n);
+  const Vector3 d_x = ray.rx_d.normalize();
+  const Vector3 d_y = ray.ry_d.normalize();
+  Vector3 new_d_x, new_d_y;
+  if (refraction_index == 0.0f) {
+    new_d_x = d_x - 2 * d_x.dot(normal) * normal;
+    new_d_y = d_y - 2 * d_y.dot(normal) * normal;
+  } else if (!calculate_transmission(d_x, normal, refraction_index, new_d_x) ||
+             !calculate_transmission(d_y, normal, refraction_index,
+                                     new_d_y)) {
+    return;
+  }
+  new_ray.set_differentials(p_x, new_d_x, p_y, new_d_y);
+}
+
 Vector3 Scene::send_ray(const Ray& ray, int recursion_level) const {
-  Hit_data hit_data;
-  if (!bvh->intersect(ray, hit_data, true)) {
+  Hit_record hit_record;
+  if (!bvh->intersect(ray, hit_record, true)) {
     if (ray.ray_type == r_primary) {
       if (background_texture) {
         return background_texture->get_color_at(ray.bg_u, ray.bg_v);
@@ -182,23 +398,28 @@ Vector3 Scene::send_ray(const Ray& ray, int recursion_level) const {
 
     return 0.0f;
   }
+  Surface_interaction interaction;
+  hit_record.shape->get_surface_interaction(ray, hit_record, interaction);
   if (integrator_type == it_raytracing)
-    return trace_ray(ray, hit_data, recursion_level);
+    return trace_ray(ray, interaction, recursion_level);
   else
-    return trace_path(ray, hit_data, recursion_level);
+    return trace_path(ray, interaction, recursion_level);
 }
 
-Vector3 Scene::reflect_ray(const Ray& ray, const Hit_data& hit_data,
+Vector3 Scene::reflect_ray(const Ray& ray,
+                           const Surface_interaction& interaction,
                            int recursion_level) const {
-  const Material& material = materials[hit_data.shape->get_material_id()];
-  const Vector3& normal = hit_data.normal;
-  const Vector3 intersection_point = ray.point_at(hit_data.t);
+  const Material& material = materials[interaction.shape->get_material_id()];
+  const Vector3& normal = interaction.normal;
+  const Vector3 intersection_point = ray.point_at(interaction.t);
   const Vector3 w_o = (ray.o - intersection_point).normalize();
   if (material.roughness == 0.0f) {
     const Vector3 w_r = ((2 * normal.dot(w_o) * normal) - w_o).normalize();
 
     Ray mirror_ray(intersection_point + (w_r * shadow_ray_epsilon), w_r,
                    r_reflection, ray.time);
+    mirror_ray.caustic_path = ray.diffuse_bounce || ray.caustic_path;
+    bend_differentials(ray, interaction, normal, 0.0f, mirror_ray);
     return send_ray(mirror_ray, recursion_level + 1);
   } else {
     const Vector3 w_r = ((2 * normal.dot(w_o) * normal) - w_o).normalize();
@@ -224,13 +445,14 @@ Vector3 Scene::reflect_ray(const Ray& ray, const Hit_data& hit_data,
     Ray mirror_ray(intersection_point + (w_r_prime * shadow_ray_epsilon),
                    w_r_prime, r_reflection, ray.time);
     mirror_ray.light_hit = ray.light_hit;
+    mirror_ray.caustic_path = ray.diffuse_bounce || ray.caustic_path;
     return send_ray(mirror_ray, recursion_level + 1);
   }
 }
 
-bool Scene::calculate_diffuse_constant(const Hit_data& hit_data,
+bool Scene::calculate_diffuse_constant(const Surface_interaction& interaction,
                                        Vector3& diffuse_constant_out) const {
-  const Shape* shape = hit_data.shape;
+  const Shape* shape = interaction.shape;
   const Material& material = materials[shape->get_material_id()];
   const int texture_id = shape->get_texture_id();
   const Texture* texture = (texture_id == -1) ? NULL : &(textures[texture_id]);
@@ -238,17 +460,25 @@ bool Scene::calculate_diffuse_constant(const Hit_data& hit_data,
   bool is_replace_all = false;
   if (texture) {
     is_replace_all = texture->get_decal_mode() == Texture::dm_replace_all;
+    auto texture_color_at_hit = [&]() {
+      if (interaction.has_uv_differentials) {
+        return texture->get_color_at(interaction.u, interaction.v,
+                                     interaction.du_dx, interaction.dv_dx,
+                                     interaction.du_dy, interaction.dv_dy);
+      }
+      return texture->get_color_at(interaction.u, interaction.v);
+    };
     if (is_replace_all) {
-      diffuse_constant_out = texture->get_color_at(hit_data.u, hit_data.v);
+      diffuse_constant_out = texture_color_at_hit();
     } else {
       if (texture->is_perlin_noise()) {
-        float perlin_value = hit_data.perlin_value;
+        float perlin_value = interaction.perlin_value;
         diffuse_constant_out = texture->blend_color(
             Vector3(perlin_value, perlin_value, perlin_value),
             diffuse_constant_out);
       } else {
-        Vector3 texture_color = texture->get_color_at(hit_data.u, hit_data.v) /
-                                texture->get_normalizer();
+        Vector3 texture_color =
+            texture_color_at_hit() / texture->get_normalizer();
         diffuse_constant_out =
             texture->blend_color(texture_color, diffuse_constant_out);
       }
@@ -258,18 +488,18 @@ bool Scene::calculate_diffuse_constant(const Hit_data& hit_data,
 }
 
 Vector3 Scene::calculate_diffuse_and_specular_radiance(
-    const Ray& ray, const Hit_data& hit_data,
+    const Ray& ray, const Surface_interaction& interaction,
     const Vector3& diffuse_constant) const {
   //
   Vector3 radiance;
-  const Shape* shape = hit_data.shape;
-  const Vector3 intersection_point = ray.point_at(hit_data.t);
+  const Shape* shape = interaction.shape;
+  const Vector3 intersection_point = ray.point_at(interaction.t);
   const Material& material = materials[shape->get_material_id()];
   const Vector3 w_o = (ray.o - intersection_point).normalize();
-  const Vector3& normal = hit_data.normal;
-  BRDF* brdf = nullptr;
-  if (material.brdf_id != -1) {
-    brdf = brdfs[material.brdf_id];
+  const Vector3& normal = interaction.normal;
+  const BRDF* brdf = nullptr;
+  if (material.brdf_id != -1 && brdfs[material.brdf_id].get_type() != bt_none) {
+    brdf = &brdfs[material.brdf_id];
   }
   // lights
   for (const Light* light : lights) {
@@ -282,10 +512,10 @@ Vector3 Scene::calculate_diffuse_and_specular_radiance(
       // Shadow check
       Ray shadow_ray(intersection_point + (shadow_ray_epsilon * w_i), w_i,
                      r_shadow, ray.time);
-      Hit_data shadow_hit_data;
-      bvh->intersect(shadow_ray, shadow_hit_data, true);
-      if (shadow_hit_data.t < (light_distance - shadow_ray_epsilon) &&
-          shadow_hit_data.t > 0.0f) {
+      // Only hits in front of the light count, the BVH skips the rest
+      Hit_record shadow_hit_record;
+      shadow_hit_record.t = light_distance - shadow_ray_epsilon;
+      if (bvh->intersect(shadow_ray, shadow_hit_record, true)) {
         continue;
       }
 
@@ -295,7 +525,7 @@ Vector3 Scene::calculate_diffuse_and_specular_radiance(
       float cos_theta_i = std::max(0.0f, normal.dot(w_i));
       if (brdf) {
         radiance += incoming_radiance * cos_theta_i *
-                    brdf->get_reflectance(hit_data, diffuse_constant,
+                    brdf->get_reflectance(interaction, diffuse_constant,
                                           material.specular, w_i, w_o);
       } else {
         radiance += diffuse_constant * incoming_radiance * cos_theta_i;
@@ -309,39 +539,40 @@ Vector3 Scene::calculate_diffuse_and_specular_radiance(
   }
   return radiance;
 }
-Vector3 Scene::trace_path(const Ray& ray, const Hit_data& hit_data,
+Vector3 Scene::trace_path(const Ray& ray,
+                          const Surface_interaction& interaction,
                           int recursion_level) const {
   Vector3 radiance;
-  if (hit_data.is_light_object) {
-    if (ray.light_hit) {
+  if (interaction.is_light_object) {
+    if (ray.light_hit || ray.caustic_path) {
       return radiance;
     } else {
-      return hit_data.radiance;
+      return interaction.radiance;
     }
   }
   Ray ray_copy = ray;
   Vector3 diffuse_constant;
   Vector3 direct_cont(0.0f);
-  if (calculate_diffuse_constant(hit_data, diffuse_constant)) {
-    std::cerr << "Path tracing with replace all decal mode is kinda weird"
-              << std::endl;
-  }
+  calculate_diffuse_constant(interaction, diffuse_constant);
 
   if (!ray.in_medium) {
-    direct_cont = calculate_diffuse_and_specular_radiance(ray, hit_data,
+    direct_cont = calculate_diffuse_and_specular_radiance(ray, interaction,
                                                           diffuse_constant);
   }
   if (direct_cont != Vector3(0.0f)) {
     ray_copy.light_hit = true;
     radiance += direct_cont;
   }
-  const Material& material = materials[hit_data.shape->get_material_id()];
-  BRDF* brdf = nullptr;
-  if (material.brdf_id != -1) {
-    brdf = brdfs[material.brdf_id];
+  if (!ray.in_medium && use_caustic_photon_map) {
+    radiance += caustic_radiance(ray, interaction, diffuse_constant);
+  }
+  const Material& material = materials[interaction.shape->get_material_id()];
+  const BRDF* brdf = nullptr;
+  if (material.brdf_id != -1 && brdfs[material.brdf_id].get_type() != bt_none) {
+    brdf = &brdfs[material.brdf_id];
   }
   if (!ray.in_medium && recursion_level < max_recursion_depth) {
-    Vector3 intersection_point = ray.point_at(hit_data.t);
+    Vector3 intersection_point = ray.point_at(interaction.t);
 
     // Sample hemisphere
     thread_local static std::random_device rd;
@@ -352,7 +583,7 @@ Vector3 Scene::trace_path(const Ray& ray, const Hit_data& hit_data,
 
     float phi;
     float theta;
-    Vector3 w = hit_data.normal;
+    Vector3 w = interaction.normal;
     const Vector3 u = ((w.x != 0.0f || w.y != 0.0f) ? Vector3(-w.y, w.x, 0.0f)
                                                     : Vector3(0.0f, 1.0f, 0.0f))
                           .normalize();
@@ -368,13 +599,14 @@ Vector3 Scene::trace_path(const Ray& ray, const Hit_data& hit_data,
                    u * std::sin(theta) * std::sin(phi))
                       .normalize();
     //
-    const Vector3& normal = hit_data.normal;
+    const Vector3& normal = interaction.normal;
     float cos_theta_i = std::max(0.0f, normal.dot(w_i));
     const Vector3 w_o = (ray.o - intersection_point).normalize();
     Ray sample_ray(intersection_point + (w_i * shadow_ray_epsilon), w_i, r_path,
                    ray.time);
     sample_ray.in_medium = ray.in_medium;
     sample_ray.light_hit = ray.light_hit;
+    sample_ray.diffuse_bounce = use_caustic_photon_map;
     Vector3 incoming_radiance = send_ray(sample_ray, recursion_level + 1);
     float probability;
     if (is_uniform_sampling) {
@@ -385,7 +617,7 @@ Vector3 Scene::trace_path(const Ray& ray, const Hit_data& hit_data,
     if (probability != 0.0f) {
       if (brdf) {
         radiance += incoming_radiance * cos_theta_i *
-                    brdf->get_reflectance(hit_data, diffuse_constant,
+                    brdf->get_reflectance(interaction, diffuse_constant,
                                           material.specular, w_i, w_o) /
                     probability;
       } else {
@@ -402,46 +634,235 @@ Vector3 Scene::trace_path(const Ray& ray, const Hit_data& hit_data,
   }
   if (material.mirror != zero_vector && recursion_level < max_recursion_depth) {
     radiance +=
-        material.mirror * reflect_ray(ray_copy, hit_data, recursion_level);
+        material.mirror * reflect_ray(ray_copy, interaction, recursion_level);
   }
 
   // Refraction
   if (material.transparency != zero_vector &&
       recursion_level < max_recursion_depth) {
-    radiance += refract_ray(ray_copy, hit_data, recursion_level);
+    radiance += refract_ray(ray_copy, interaction, recursion_level);
   }
   return radiance;
 }
-Vector3 Scene::trace_ray(const Ray& ray, const Hit_data& hit_data,
+void Scene::trace_caustic_photons(int photon_count,
+                                  std::vector<Photon>* photons) const {
+  thread_local static std::random_device rd;
+  thread_local static std::mt19937 generator(rd());
+  std::vector<Ray> photon_rays(PHOTON_BATCH_SIZE,
+                               Ray(zero_vector, zero_vector, r_photon));
+  std::vector<Vector3> fluxes(PHOTON_BATCH_SIZE);
+  for (const Light* light : lights) {
+    for (int i = 0; i < photon_count; i += PHOTON_BATCH_SIZE) {
+      int count = light->generate_photons(
+          photon_rays.data(), fluxes.data(),
+          std::min(PHOTON_BATCH_SIZE, photon_count - i), generator);
+      if (count == 0) {
+        // Light cannot emit photons
+        break;
+      }
+      for (int j = 0; j < count; j++) {
+        caustic_photon_trace(photon_rays[j], 0, fluxes[j], false, photons);
+      }
+    }
+  }
+}
+
+void Scene::compress_vertices() {
+  const size_t full_bytes = vertex_data.size() * sizeof(Vertex) +
+                            texture_coord_data.size() * sizeof(Vector3);
+  compressed_vertex_data.resize(vertex_data.size());
+  for (size_t i = 0; i < vertex_data.size(); i++) {
+    compressed_vertex_data[i].position = vertex_data[i].get_vertex_position();
+    compressed_vertex_data[i].normal =
+        Octahedral_normal::pack(vertex_data[i].get_vertex_normal());
+  }
+  compressed_texture_coord_data.resize(texture_coord_data.size());
+  for (size_t i = 0; i < texture_coord_data.size(); i++) {
+    compressed_texture_coord_data[i] = Half_uv::pack(texture_coord_data[i]);
+  }
+  // Swapped with empty vectors, clear would keep the capacity
+  std::vector<Vertex>().swap(vertex_data);
+  std::vector<Vector3>().swap(texture_coord_data);
+  compressed_vertices = true;
+  const size_t compressed_bytes =
+      compressed_vertex_data.size() * sizeof(Compressed_vertex) +
+      compressed_texture_coord_data.size() * sizeof(Half_uv);
+  std::cout << "Compressed vertices: " << full_bytes / 1024 << " KB to "
+            << compressed_bytes / 1024 << " KB" << std::endl;
+}
+
+void Scene::build_caustic_photon_map(
+    std::vector<std::vector<Photon>>& photon_lists) {
+  // Every light emits caustic_photon_count photons in total
+  caustic_photon_map.build(photon_lists, caustic_photon_count);
+}
+
+void Scene::caustic_photon_trace(const Ray& ray, int recursion_level,
+                                 const Vector3& flux, bool specular_path,
+                                 std::vector<Photon>* photons) const {
+  Hit_record hit_record;
+  if (!bvh->intersect(ray, hit_record, true)) {
+    return;
+  }
+  Surface_interaction interaction;
+  hit_record.shape->get_surface_interaction(ray, hit_record, interaction);
+  if (interaction.is_light_object) {
+    return;
+  }
+  const Material& material = materials[interaction.shape->get_material_id()];
+  const Vector3& normal = interaction.normal;
+  const Vector3 intersection_point = ray.point_at(interaction.t);
+  const Vector3 d_n = ray.d.normalize();
+  if (specular_path && !ray.in_medium) {
+    Vector3 diffuse_constant;
+    calculate_diffuse_constant(interaction, diffuse_constant);
+    if (diffuse_constant != zero_vector || material.specular != zero_vector) {
+      Photon photon;
+      photon.position = intersection_point;
+      photon.w_i = -d_n;
+      photon.normal = normal;
+      photon.flux = flux;
+      photons->push_back(photon);
+    }
+  }
+  if (recursion_level >= max_recursion_depth) {
+    return;
+  }
+  const Vector3 w_r = (d_n - 2 * normal.dot(d_n) * normal).normalize();
+  if (material.mirror != zero_vector) {
+    Ray mirror_ray(intersection_point + (w_r * shadow_ray_epsilon), w_r,
+                   r_photon);
+    caustic_photon_trace(mirror_ray, recursion_level + 1,
+                         flux * material.mirror, true, photons);
+  }
+  if (material.transparency != zero_vector) {
+    // Same as refract_ray, but one of the rays is chosen by russian roulette
+    Vector3 transmission_direction = zero_vector;
+    float cos_theta = 0.0f;
+    Vector3 k(1.0f);
+    float n = material.refraction_index;
+    bool total_internal_reflection = false;
+    bool entering_ray = d_n.dot(normal) < 0.0f;
+    if (entering_ray) {
+      calculate_transmission(d_n, normal, n, transmission_direction);
+      cos_theta = (-d_n).dot(normal);
+    } else {
+      const Vector3& transparency = material.transparency;
+      k.x = exp(log(transparency.x) * interaction.t);
+      k.y = exp(log(transparency.y) * interaction.t);
+      k.z = exp(log(transparency.z) * interaction.t);
+      if (calculate_transmission(d_n, -normal, 1.0f / n,
+                                 transmission_direction)) {
+        cos_theta = transmission_direction.dot(normal);
+      } else {
+        total_internal_reflection = true;
+      }
+    }
+    float r = 1.0f;
+    if (!total_internal_reflection) {
+      float r_0 = ((n - 1) * (n - 1)) / ((n + 1) * (n + 1));
+      r = r_0 + (1 - r_0) * pow(1.0f - cos_theta, 5);
+    }
+    thread_local static std::random_device rd;
+    thread_local static std::mt19937 generator(rd());
+    std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
+    if (uniform_dist(generator) < r) {
+      Ray reflection_ray(intersection_point + (w_r * shadow_ray_epsilon), w_r,
+                         r_photon);
+      reflection_ray.in_medium = !entering_ray;
+      caustic_photon_trace(reflection_ray, recursion_level + 1, flux * k, true,
+                           photons);
+    } else {
+      Ray transmission_ray(
+          intersection_point + (transmission_direction * shadow_ray_epsilon),
+          transmission_direction, r_photon);
+      transmission_ray.in_medium = entering_ray;
+      caustic_photon_trace(transmission_ray, recursion_level + 1, flux * k,
+                           true, photons);
+    }
+  }
+}
+
+Vector3 Scene::caustic_radiance(const Ray& ray,
+                                const Surface_interaction& interaction,
+                                const Vector3& diffuse_constant) const {
+  thread_local static std::vector<Photon_map::Nearest_photon> nearest;
+  const Vector3 intersection_point = ray.point_at(interaction.t);
+  const float radius_squared = caustic_photon_map.locate_nearest(
+      intersection_point, caustic_nearest_photon_count,
+      caustic_max_radius_squared, nearest);
+  if (radius_squared <= 0.0f) {
+    return zero_vector;
+  }
+  const Material& material = materials[interaction.shape->get_material_id()];
+  const Vector3& normal = interaction.normal;
+  const Vector3 w_o = (ray.o - intersection_point).normalize();
+  const BRDF* brdf = nullptr;
+  if (material.brdf_id != -1 && brdfs[material.brdf_id].get_type() != bt_none) {
+    brdf = &brdfs[material.brdf_id];
+  }
+  Vector3 radiance;
+  for (const Photon_map::Nearest_photon& nearest_photon : nearest) {
+    const Photon* photon = nearest_photon.second;
+    if (normal.dot(photon->normal) <= 1e-3f) {
+      continue;
+    }
+    const Vector3& w_i = photon->w_i;
+    // Photon density is already the irradiance, cos_theta_i is not applied
+    float cos_theta_i = normal.dot(w_i);
+    if (cos_theta_i <= 0.0f) {
+      continue;
+    }
+    if (brdf) {
+      radiance += photon->flux * brdf->get_reflectance(interaction,
+                                                       diffuse_constant,
+                                                       material.specular, w_i,
+                                                       w_o);
+    } else {
+      radiance += diffuse_constant * photon->flux;
+      float specular_cos_theta =
+          std::max(0.0f, normal.dot((w_o + w_i).normalize()));
+      radiance += material.specular * photon->flux *
+                  pow(specular_cos_theta, material.phong_exponent) /
+                  cos_theta_i;
+    }
+  }
+  const float emitted_photon_count =
+      (float)caustic_photon_map.get_emitted_photon_count();
+  return radiance / (M_PI * radius_squared * emitted_photon_count);
+}
+
+Vector3 Scene::trace_ray(const Ray& ray, const Surface_interaction& interaction,
                          int recursion_level) const {
   Vector3 radiance;
-  if (hit_data.is_light_object) {
-    return hit_data.radiance;
+  if (interaction.is_light_object) {
+    return interaction.radiance;
   }
 
-  const Material& material = materials[hit_data.shape->get_material_id()];
+  const Material& material = materials[interaction.shape->get_material_id()];
   Vector3 diffuse_constant;
 
-  if (calculate_diffuse_constant(hit_data, diffuse_constant)) {
+  if (calculate_diffuse_constant(interaction, diffuse_constant)) {
     // Returns texture color if texture is replace all
     return diffuse_constant;
   }
 
   if (!ray.in_medium) {
     radiance += material.ambient * ambient_light;
-    radiance += calculate_diffuse_and_specular_radiance(ray, hit_data,
+    radiance += calculate_diffuse_and_specular_radiance(ray, interaction,
                                                         diffuse_constant);
   }
 
   // Reflection
   if (material.mirror != zero_vector && recursion_level < max_recursion_depth) {
-    radiance += material.mirror * reflect_ray(ray, hit_data, recursion_level);
+    radiance +=
+        material.mirror * reflect_ray(ray, interaction, recursion_level);
   }
 
   // Refraction
   if (material.transparency != zero_vector &&
       recursion_level < max_recursion_depth) {
-    radiance += refract_ray(ray, hit_data, recursion_level);
+    radiance += refract_ray(ray, interaction, recursion_level);
   }
   return radiance;
 }
@@ -449,6 +870,9 @@ Vector3 Scene::trace_ray(const Ray& ray, const Hit_data& hit_data,
 Scene::Scene(const std::string& file_name) {
   const float degrees_to_radians = M_PI / 180.0f;
   spherical_directional_light = nullptr;
+  // Turned on by compress_vertices after loading, the vertex accessors read
+  // the full precision arrays until then
+  compressed_vertices = false;
   tinyxml2::XMLDocument file;
   std::stringstream stream;
 
@@ -472,12 +896,26 @@ Scene::Scene(const std::string& file_name) {
   debug("BackgroundColor is parsed");
   //
 
+  // Get TextureCacheSize
+  // Budget of the decoded texture tiles in megabytes
+  element = root->FirstChildElement("TextureCacheSize");
+  if (element) {
+    int texture_cache_size;
+    stream << element->GetText() << std::endl;
+    stream >> texture_cache_size;
+    texture_cache.set_budget((size_t)texture_cache_size << 20);
+    debug("TextureCacheSize is parsed");
+  }
+  stream.clear();
+  //
+
   // Get BackgroundTexture
   element = root->FirstChildElement("BackgroundTexture");
   if (element) {
     const std::string& bg_tex_name = element->GetText();
-    background_texture = new Texture(bg_tex_name, "bilinear", "replace_all",
-                                     "clamp", 255, 1.0f, false, 1.0f, false);
+    background_texture = arena.create<Texture>(
+        bg_tex_name, "bilinear", "replace_all", "clamp", 255, 1.0f, false,
+        1.0f, false, &texture_cache);
   } else {
     background_texture = nullptr;
   }
@@ -512,6 +950,38 @@ Scene::Scene(const std::string& file_name) {
   stream >> max_recursion_depth;
   debug("MaxRecursionDepth is parsed");
   //
+  // Get CausticPhotonMap
+  element = root->FirstChildElement("CausticPhotonMap");
+  use_caustic_photon_map = element != nullptr;
+  caustic_photon_count = 100000;
+  caustic_nearest_photon_count = 50;
+  // Negative until MaxGatherRadius is read or the scene bounds are known
+  caustic_max_radius_squared = -1.0f;
+  if (element) {
+    auto child = element->FirstChildElement("PhotonCount");
+    if (child) {
+      stream << child->GetText() << std::endl;
+      stream >> caustic_photon_count;
+    }
+    child = element->FirstChildElement("NearestPhotons");
+    if (child) {
+      stream << child->GetText() << std::endl;
+      stream >> caustic_nearest_photon_count;
+    }
+    child = element->FirstChildElement("MaxGatherRadius");
+    if (child) {
+      float max_gather_radius;
+      stream << child->GetText() << std::endl;
+      stream >> max_gather_radius;
+      caustic_max_radius_squared = max_gather_radius * max_gather_radius;
+    }
+    debug("CausticPhotonMap is parsed");
+  }
+  //
+  // Get CompressedVertices
+  const bool use_compressed_vertices =
+      root->FirstChildElement("CompressedVertices") != nullptr;
+  //
   // Get ZeroBasedIndexing
   element = root->FirstChildElement("ZeroBasedIndexing");
   bool zero_based_indexing = false;
@@ -630,10 +1100,55 @@ Scene::Scene(const std::string& file_name) {
     if (handedness && std::string(handedness) == std::string("left")) {
       left_handed = true;
     }
-    cameras.push_back(std::move(
-        Camera(up, gaze, position, number_of_samples, image_name, near_l,
-               near_r, near_b, near_t, near_distance, image_width, image_height,
-               focus_distance, aperture_size, tmo, left_handed)));
+    // Hdr image is written next to the tonemapped one unless the formats
+    // are given explicitly
+    Image_output_settings output_settings;
+    output_settings.write_exr = tmo != nullptr;
+    child = element->FirstChildElement("ImageFormats");
+    if (child) {
+      output_settings.write_png = false;
+      output_settings.write_exr = false;
+      std::stringstream format_stream(child->GetText());
+      std::string format;
+      while (format_stream >> format) {
+        if (format == "png") {
+          output_settings.write_png = true;
+        } else if (format == "exr") {
+          output_settings.write_exr = true;
+        } else if (format == "pfm") {
+          output_settings.write_pfm = true;
+        } else {
+          throw std::runtime_error("Error: Unknown image format " + format +
+                                   ".");
+        }
+      }
+    }
+    child = element->FirstChildElement("ExrCompression");
+    if (child) {
+      const std::string compression(child->GetText());
+      if (compression == "none") {
+        output_settings.exr_compression_type = TINYEXR_COMPRESSIONTYPE_NONE;
+      } else if (compression == "rle") {
+        output_settings.exr_compression_type = TINYEXR_COMPRESSIONTYPE_RLE;
+      } else if (compression == "zips") {
+        output_settings.exr_compression_type = TINYEXR_COMPRESSIONTYPE_ZIPS;
+      } else if (compression == "zip") {
+        output_settings.exr_compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+      } else if (compression == "piz") {
+        output_settings.exr_compression_type = TINYEXR_COMPRESSIONTYPE_PIZ;
+      } else {
+        throw std::runtime_error("Error: Unknown exr compression " +
+                                 compression + ".");
+      }
+    }
+    child = element->FirstChildElement("ExrPixelType");
+    if (child) {
+      output_settings.is_exr_half = std::string(child->GetText()) != "float";
+    }
+    cameras.push_back(std::move(Camera(
+        up, gaze, position, number_of_samples, image_name, near_l, near_r,
+        near_b, near_t, near_distance, image_width, image_height,
+        focus_distance, aperture_size, tmo, left_handed, output_settings)));
     element = element->NextSiblingElement("Camera");
   }
   stream.clear();
@@ -660,7 +1175,7 @@ Scene::Scene(const std::string& file_name) {
       }
       float exponent;
       stream >> exponent;
-      brdfs[id] = new Phong_BRDF(exponent);
+      brdfs[id] = BRDF::create_phong(exponent);
       original_phong_element =
           original_phong_element->NextSiblingElement("OriginalPhong");
     }
@@ -678,7 +1193,7 @@ Scene::Scene(const std::string& file_name) {
       }
       float exponent;
       stream >> exponent;
-      brdfs[id] = new Modified_phong_BRDF(exponent, normalized);
+      brdfs[id] = BRDF::create_modified_phong(exponent, normalized);
       modified_phong_element =
           modified_phong_element->NextSiblingElement("ModifiedPhong");
     }
@@ -695,7 +1210,7 @@ Scene::Scene(const std::string& file_name) {
       }
       float exponent;
       stream >> exponent;
-      brdfs[id] = new Blinn_phong_BRDF(exponent);
+      brdfs[id] = BRDF::create_blinn_phong(exponent);
       original_blinn_phong_element =
           original_blinn_phong_element->NextSiblingElement(
               "OriginalBlinnPhong");
@@ -715,7 +1230,7 @@ Scene::Scene(const std::string& file_name) {
       }
       float exponent;
       stream >> exponent;
-      brdfs[id] = new Modified_blinn_phong_BRDF(exponent, normalized);
+      brdfs[id] = BRDF::create_modified_blinn_phong(exponent, normalized);
       modified_blinn_phong_element =
           modified_blinn_phong_element->NextSiblingElement(
               "ModifiedBlinnPhong");
@@ -739,7 +1254,7 @@ Scene::Scene(const std::string& file_name) {
       }
       float exponent, refractive_index;
       stream >> exponent >> refractive_index;
-      brdfs[id] = new Torrance_sparrow_BRDF(exponent, refractive_index);
+      brdfs[id] = BRDF::create_torrance_sparrow(exponent, refractive_index);
       torrance_sparrow_element =
           torrance_sparrow_element->NextSiblingElement("TorranceSparrow");
     }
@@ -770,7 +1285,7 @@ Scene::Scene(const std::string& file_name) {
       stream >> position.x >> position.y >> position.z;
       stream >> intensity.x >> intensity.y >> intensity.z;
 
-      lights.push_back(new Point_light(position, intensity));
+      lights.push_back(arena.create<Point_light>(position, intensity));
       element = element->NextSiblingElement("PointLight");
     }
     stream.clear();
@@ -796,8 +1311,8 @@ Scene::Scene(const std::string& file_name) {
       stream >> intensity.x >> intensity.y >> intensity.z;
       stream >> edge_vector_1.x >> edge_vector_1.y >> edge_vector_1.z;
       stream >> edge_vector_2.x >> edge_vector_2.y >> edge_vector_2.z;
-      lights.push_back(
-          new Area_light(position, intensity, edge_vector_1, edge_vector_2));
+      lights.push_back(arena.create<Area_light>(position, intensity,
+                                                edge_vector_1, edge_vector_2));
       element = element->NextSiblingElement("AreaLight");
     }
     stream.clear();
@@ -827,9 +1342,9 @@ Scene::Scene(const std::string& file_name) {
       stream >> coverage_angle_in_radians >> falloff_angle_in_radians;
       coverage_angle_in_radians *= degrees_to_radians;
       falloff_angle_in_radians *= degrees_to_radians;
-      lights.push_back(new Spot_light(position, intensity, direction,
-                                      coverage_angle_in_radians,
-                                      falloff_angle_in_radians));
+      lights.push_back(arena.create<Spot_light>(position, intensity, direction,
+                                                coverage_angle_in_radians,
+                                                falloff_angle_in_radians));
       element = element->NextSiblingElement("SpotLight");
     }
     stream.clear();
@@ -848,7 +1363,7 @@ Scene::Scene(const std::string& file_name) {
       stream << child->GetText() << std::endl;
       stream >> direction.x >> direction.y >> direction.z;
       stream >> radiance.x >> radiance.y >> radiance.z;
-      lights.push_back(new Directional_light(direction, radiance));
+      lights.push_back(arena.create<Directional_light>(direction, radiance));
       element = element->NextSiblingElement("DirectionalLight");
     }
     stream.clear();
@@ -862,7 +1377,7 @@ Scene::Scene(const std::string& file_name) {
       auto child = element->FirstChildElement("EnvMapName");
       envmap_name = child->GetText();
       spherical_directional_light =
-          new Spherical_directional_light(envmap_name);
+          arena.create<Spherical_directional_light>(envmap_name);
       lights.push_back(spherical_directional_light);
     }
     stream.clear();
@@ -994,18 +1509,101 @@ Scene::Scene(const std::string& file_name) {
   debug("Transformations are parsed");
   // Transformations End
 
+  // Get Textures, before the meshes which precompute their bump mapping
+  // frames
+  element = root->FirstChildElement("Textures");
+  if (element) {
+    element = element->FirstChildElement("Texture");
+    while (element) {
+      std::string image_name, interpolation_type, decal_mode, appearance;
+      auto child = element->FirstChildElement("ImageName");
+      image_name = child->GetText();
+      child = element->FirstChildElement("Interpolation");
+      if (child) {
+        interpolation_type = child->GetText();
+      } else {
+        interpolation_type = "bilinear";
+      }
+      child = element->FirstChildElement("DecalMode");
+      if (child) {
+        decal_mode = child->GetText();
+      } else {
+        decal_mode = "blend_kd";
+      }
+      child = element->FirstChildElement("Appearance");
+      if (child) {
+        appearance = child->GetText();
+      } else {
+        appearance = "repeat";
+      }
+      child = element->FirstChildElement("Normalizer");
+      if (child) {
+        stream << child->GetText() << std::endl;
+      } else {
+        stream << "255.0" << std::endl;
+      }
+      child = element->FirstChildElement("ScalingFactor");
+      if (child) {
+        stream << child->GetText() << std::endl;
+      } else {
+        stream << "1.0" << std::endl;
+      }
+      float bumpmap_multiplier =
+          element->FloatAttribute("bumpmapMultiplier", 1.0f);
+      bool is_bump = element->BoolAttribute("bumpmap", false);
+      float normalizer, scaling_factor;
+      stream >> normalizer >> scaling_factor;
+      textures.push_back(std::move(
+          Texture(image_name, interpolation_type, decal_mode, appearance,
+                  normalizer, scaling_factor, is_bump, bumpmap_multiplier,
+                  element->BoolAttribute("degamma", false), &texture_cache)));
+
+      element = element->NextSiblingElement("Texture");
+    }
+  }
+  stream.clear();
+  debug("Textures are parsed");
+  // Textures end
+
+  // Get SceneCache
+  element = root->FirstChildElement("SceneCache");
+  const bool use_scene_cache = element != nullptr;
+  std::string scene_cache_name = file_name + ".cache";
+  if (element && element->GetText()) {
+    scene_cache_name = element->GetText();
+  }
+  Scene_cache scene_cache;
+  uint64_t scene_cache_key = 0;
+  int cached_mesh_index = 0;
+  if (use_scene_cache) {
+    scene_cache_key = Scene_cache::compute_key(file_name, root);
+    if (scene_cache.load(scene_cache_name, scene_cache_key)) {
+      debug("SceneCache is loaded");
+    } else {
+      debug("SceneCache is missing or outdated, it will be rebuilt");
+    }
+  }
+  //
+
   // Get VertexData
   element = root->FirstChildElement("VertexData");
-  if (element) {
+  if (scene_cache.is_loaded()) {
+    // Also restores TexCoordData and vertices of ply files
+    scene_cache.restore_vertices(vertex_data, texture_coord_data);
+  } else if (element) {
     const char* binary_file = element->Attribute("binaryFile");
     if (binary_file) {
       parse_binary_vertexdata(std::string(binary_file));
     } else {
-      stream << element->GetText() << std::endl;
-      Vector3 vertex;
-      while (!(stream >> vertex.x).eof()) {
-        stream >> vertex.y >> vertex.z;
-        vertex_data.push_back(Vertex(vertex));
+      std::vector<float> values;
+      if (!Number_parser::parse_floats(element->GetText(), values) ||
+          values.size() % 3 != 0) {
+        throw std::runtime_error("Error: VertexData cannot be parsed.");
+      }
+      vertex_data.reserve(vertex_data.size() + values.size() / 3);
+      for (size_t i = 0; i < values.size(); i += 3) {
+        vertex_data.push_back(
+            Vertex(Vector3(values[i], values[i + 1], values[i + 2])));
       }
     }
   }
@@ -1015,18 +1613,21 @@ Scene::Scene(const std::string& file_name) {
 
   // Get TexCoordData
   element = root->FirstChildElement("TexCoordData");
-  if (element) {
+  if (element && !scene_cache.is_loaded()) {
     const char* binary_file = element->Attribute("binaryFile");
     if (binary_file) {
       parse_binary_texturedata(std::string(binary_file));
     } else {
-      stream << element->GetText() << std::endl;
-      Vector3 uv;
-      while (!(stream >> uv.x).eof()) {
-        stream >> uv.y;
-        texture_coord_data.push_back(uv);
+      std::vector<float> values;
+      if (!Number_parser::parse_floats(element->GetText(), values) ||
+          values.size() % 2 != 0) {
+        throw std::runtime_error("Error: TexCoordData cannot be parsed.");
+      }
+      texture_coord_data.reserve(texture_coord_data.size() +
+                                 values.size() / 2);
+      for (size_t i = 0; i < values.size(); i += 2) {
+        texture_coord_data.push_back(Vector3(values[i], values[i + 1], 0.0f));
       }
-      stream.clear();
     }
     debug("TexCoordData is parsed");
   }
@@ -1035,20 +1636,25 @@ Scene::Scene(const std::string& file_name) {
   std::vector<Shape*> objects;
 
   // Get Meshes
+  // Settings of the meshes are read first and the vertex ranges of ply files
+  // are reserved, then meshes are loaded and their BVHs are built in parallel
   element = root->FirstChildElement("Objects");
   element = element->FirstChildElement("Mesh");
 
+  std::vector<Mesh_load_job> mesh_jobs;
   while (element) {
+    Mesh_load_job job;
     auto child = element->FirstChildElement("Material");
-    int material_id;
     stream << child->GetText() << std::endl;
-    stream >> material_id;
-    material_id--;
+    stream >> job.material_id;
+    job.material_id--;
     const char* shading_mode = element->Attribute("shadingMode");
-    Triangle_shading_mode triangle_shading_mode = tsm_flat;
+    job.tsm = tsm_flat;
     if (shading_mode && std::string(shading_mode) == std::string("smooth")) {
-      triangle_shading_mode = tsm_smooth;
+      job.tsm = tsm_smooth;
     }
+    // Quantized BVH nodes for meshes whose BVH takes too much memory
+    job.compressed_bvh = element->BoolAttribute("compressedBVH", false);
 
     Matrix4x4 arbitrary_transformation(true);
     child = element->FirstChildElement("Transformations");
@@ -1080,79 +1686,143 @@ Scene::Scene(const std::string& file_name) {
       }
       stream.clear();
     }
+    job.transformation = arbitrary_transformation;
     stream.clear();
-    Vector3 velocity(0.0f);
+    job.velocity = Vector3(0.0f);
     child = element->FirstChildElement("MotionBlur");
     if (child) {
       stream << child->GetText() << std::endl;
-      stream >> velocity.x >> velocity.y >> velocity.z;
+      stream >> job.velocity.x >> job.velocity.y >> job.velocity.z;
     }
     stream.clear();
 
-    int texture_id = -1;
+    job.texture_id = -1;
     child = element->FirstChildElement("Texture");
     if (child) {
       stream << child->GetText() << std::endl;
-      stream >> texture_id;
-      texture_id--;
+      stream >> job.texture_id;
+      job.texture_id--;
     }
     stream.clear();
-    std::vector<Shape*> triangles;
 
     child = element->FirstChildElement("Faces");
-    int vertex_offset = vertex_data.size();
-    int texture_offset = child->IntAttribute("textureOffset", 0);
-    const char* ply_file = child->Attribute("plyFile");
-    const char* binary_file = child->Attribute("binaryFile");
-    if (ply_file) {
-      parse_ply_tinyply(std::string(ply_file), vertex_data, triangles,
-                        vertex_offset, texture_offset, material_id, texture_id,
-                        triangle_shading_mode);
-    } else if (binary_file) {
-      vertex_offset = child->IntAttribute("vertexOffset", 0);
-      parse_binary_facedata(std::string(binary_file), triangles, vertex_offset,
-                            texture_offset, material_id, texture_id,
-                            triangle_shading_mode, zero_based_indexing);
-    } else {
-      vertex_offset = child->IntAttribute("vertexOffset", 0);
-      stream << child->GetText() << std::endl;
-      int v0_id, v1_id, v2_id;
-
-      while (!(stream >> v0_id).eof()) {
-        stream >> v1_id >> v2_id;
-        v0_id--;
-        v1_id--;
-        v2_id--;
-        Mesh_triangle* triangle = new Mesh_triangle(
-            this, v0_id, v1_id, v2_id, vertex_offset, texture_offset,
-            material_id, texture_id, triangle_shading_mode);
-        float area = triangle->get_surface_area();
-        const Vector3& surface_normal = triangle->normal;
-        vertex_data[triangle->vertex_index_0 + triangle->vertex_offset]
-            .add_vertex_normal(surface_normal, area);
-        vertex_data[triangle->vertex_index_1 + triangle->vertex_offset]
-            .add_vertex_normal(surface_normal, area);
-        vertex_data[triangle->vertex_index_2 + triangle->vertex_offset]
-            .add_vertex_normal(surface_normal, area);
-        triangles.push_back(triangle);
+    job.faces = child;
+    job.vertex_offset = child->IntAttribute("vertexOffset", 0);
+    job.texture_offset = child->IntAttribute("textureOffset", 0);
+    job.cached_mesh_index = -1;
+    if (scene_cache.is_loaded()) {
+      job.cached_mesh_index = cached_mesh_index++;
+    } else if (child->Attribute("plyFile")) {
+      int vertex_count;
+      bool has_uvs;
+      read_ply_vertex_layout(child->Attribute("plyFile"), vertex_count,
+                             has_uvs);
+      job.vertex_offset = vertex_data.size();
+      vertex_data.resize(vertex_data.size() + vertex_count,
+                         Vertex(Vector3(0.0f)));
+      if (has_uvs) {
+        job.texture_offset = texture_coord_data.size();
+        texture_coord_data.resize(texture_coord_data.size() + vertex_count,
+                                  Vector3(0.0f));
       }
     }
-    stream.clear();
-    meshes.push_back(
-        new Mesh(material_id, texture_id, triangles,
-                 Arbitrary_transformation(arbitrary_transformation), velocity));
+    mesh_jobs.push_back(job);
     element = element->NextSiblingElement("Mesh");
   }
   stream.clear();
+
+  std::vector<Mesh*> loaded_meshes(mesh_jobs.size(), nullptr);
+  std::vector<std::exception_ptr> mesh_errors(mesh_jobs.size());
+  std::atomic<int> next_mesh_job(0);
+  // Each mesh only writes its own triangles and its reserved vertex range
+  auto load_meshes = [&]() {
+    for (int i = next_mesh_job++; i < (int)mesh_jobs.size();
+         i = next_mesh_job++) {
+      const Mesh_load_job& job = mesh_jobs[i];
+      try {
+        const char* ply_file = job.faces->Attribute("plyFile");
+        const char* binary_file = job.faces->Attribute("binaryFile");
+        std::vector<Triangle_indices> triangles;
+        std::vector<Vector3> face_normals;
+        Triangle_mesh* triangle_mesh = nullptr;
+        if (job.cached_mesh_index >= 0) {
+          triangle_mesh = scene_cache.restore_mesh(
+              job.cached_mesh_index, this, job.material_id, job.texture_id,
+              job.tsm, arena);
+        } else if (ply_file) {
+          if (!parse_ply_native(std::string(ply_file), vertex_data, triangles,
+                                face_normals, job.vertex_offset,
+                                job.texture_offset)) {
+            parse_ply_tinyply(std::string(ply_file), vertex_data, triangles,
+                              face_normals, job.vertex_offset,
+                              job.texture_offset);
+          }
+        } else if (binary_file) {
+          parse_binary_facedata(std::string(binary_file), triangles,
+                                job.vertex_offset, zero_based_indexing);
+        } else {
+          std::vector<int> indices;
+          if (!Number_parser::parse_ints(job.faces->GetText(), indices) ||
+              indices.size() % 3 != 0) {
+            throw std::runtime_error(
+                "Error: Faces of a Mesh cannot be parsed.");
+          }
+          create_mesh_triangles(indices.data(), (int)indices.size() / 3, 1,
+                                triangles, job.vertex_offset, "Mesh");
+        }
+        if (!triangle_mesh) {
+          triangle_mesh = arena.create<Triangle_mesh>(
+              this, std::move(triangles), face_normals, job.vertex_offset,
+              job.texture_offset, job.material_id, job.texture_id, job.tsm,
+              job.compressed_bvh);
+        }
+        loaded_meshes[i] = arena.create<Mesh>(
+            job.material_id, job.texture_id, triangle_mesh,
+            Arbitrary_transformation(job.transformation), job.velocity);
+      } catch (...) {
+        mesh_errors[i] = std::current_exception();
+      }
+    }
+  };
+  int mesh_thread_count = std::thread::hardware_concurrency();
+  if (mesh_thread_count == 0) {
+    mesh_thread_count = 1;
+  }
+  mesh_thread_count = std::min(mesh_thread_count, (int)mesh_jobs.size());
+  std::vector<std::thread> mesh_threads;
+  for (int i = 1; i < mesh_thread_count; i++) {
+    mesh_threads.push_back(std::thread(load_meshes));
+  }
+  load_meshes();
+  for (std::thread& thread : mesh_threads) thread.join();
+  for (const std::exception_ptr& error : mesh_errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Meshes are added in xml order so that mesh ids and the cache stay stable
+  for (size_t i = 0; i < mesh_jobs.size(); i++) {
+    // Ply files sum the normals of their own vertices while they are parsed
+    if (mesh_jobs[i].cached_mesh_index < 0 &&
+        !mesh_jobs[i].faces->Attribute("plyFile")) {
+      add_vertex_normals(loaded_meshes[i]->triangle_mesh->get_triangles(),
+                         std::vector<Vector3>(), mesh_jobs[i].vertex_offset);
+    }
+    meshes.push_back(loaded_meshes[i]);
+    if (use_scene_cache && !scene_cache.is_loaded()) {
+      scene_cache.add_mesh(*meshes.back()->triangle_mesh);
+    }
+  }
   debug("Meshes are parsed");
 
   // Create base mesh instances
   for (Mesh* mesh : meshes) {
     const Material& material = materials[mesh->get_material_id()];
     bool is_refractive = material.transparency != Vector3(0.0f);
-    objects.push_back(
-        new Mesh_instance(mesh->get_material_id(), mesh->texture_id, mesh,
-                          mesh->base_transform, mesh->velocity, is_refractive));
+    objects.push_back(arena.create<Mesh_instance>(
+        mesh->get_material_id(), mesh->texture_id, mesh, mesh->base_transform,
+        mesh->velocity, is_refractive));
   }
   debug("Created base_mesh_instances");
 
@@ -1177,7 +1847,7 @@ Scene::Scene(const std::string& file_name) {
 
     // TODO: Until finding an elegant way, different textures for different
     // mesh instances are not supported. Since bump_map and perlin_noise
-    // calculations are done in mesh_triangle of base_mesh Normal textures may
+    // calculations are done in triangle_mesh of base_mesh Normal textures may
     // work
     int texture_id = base_mesh->texture_id;
     /*child = element->FirstChildElement("Texture");
@@ -1227,10 +1897,10 @@ Scene::Scene(const std::string& file_name) {
     stream.clear();
     const Material& material = materials[material_id];
     bool is_refractive = material.transparency != Vector3(0.0f);
-    objects.push_back(
-        new Mesh_instance(material_id, texture_id, base_mesh,
-                          Arbitrary_transformation(arbitrary_transformation),
-                          velocity, is_refractive));
+    objects.push_back(arena.create<Mesh_instance>(
+        material_id, texture_id, base_mesh,
+        Arbitrary_transformation(arbitrary_transformation), velocity,
+        is_refractive));
     element = element->NextSiblingElement("MeshInstance");
   }
   stream.clear();
@@ -1280,32 +1950,34 @@ Scene::Scene(const std::string& file_name) {
       }
       stream.clear();
     }
-    std::vector<Shape*> triangles;
     child = element->FirstChildElement("Faces");
     int vertex_offset = child->IntAttribute("vertexOffset", 0);
-    stream << child->GetText() << std::endl;
-    int v0_id, v1_id, v2_id;
-    while (!(stream >> v0_id).eof()) {
-      stream >> v1_id >> v2_id;
-      v0_id--;
-      v1_id--;
-      v2_id--;
-      Mesh_triangle* triangle =
-          new Mesh_triangle(this, v0_id, v1_id, v2_id, vertex_offset, 0,
-                            material_id, -1, Triangle_shading_mode::tsm_flat);
-      float area = triangle->get_surface_area();
-      const Vector3& surface_normal = triangle->normal;
-      vertex_data[triangle->vertex_index_0 + triangle->vertex_offset]
-          .add_vertex_normal(surface_normal, area);
-      vertex_data[triangle->vertex_index_1 + triangle->vertex_offset]
-          .add_vertex_normal(surface_normal, area);
-      vertex_data[triangle->vertex_index_2 + triangle->vertex_offset]
-          .add_vertex_normal(surface_normal, area);
-      triangles.push_back(triangle);
-    }
-    Light_mesh* light_mesh = new Light_mesh(
-        this, material_id, Arbitrary_transformation(arbitrary_transformation),
-        triangles, radiance);
+    Triangle_mesh* triangle_mesh;
+    if (scene_cache.is_loaded()) {
+      triangle_mesh = scene_cache.restore_mesh(
+          cached_mesh_index++, this, material_id, -1,
+          Triangle_shading_mode::tsm_flat, arena);
+    } else {
+      std::vector<int> indices;
+      if (!Number_parser::parse_ints(child->GetText(), indices) ||
+          indices.size() % 3 != 0) {
+        throw std::runtime_error(
+            "Error: Faces of a LightMesh cannot be parsed.");
+      }
+      std::vector<Triangle_indices> triangles;
+      create_mesh_triangles(indices.data(), (int)indices.size() / 3, 1,
+                            triangles, vertex_offset, "LightMesh");
+      add_vertex_normals(triangles, std::vector<Vector3>(), vertex_offset);
+      triangle_mesh = arena.create<Triangle_mesh>(
+          this, std::move(triangles), std::vector<Vector3>(), vertex_offset,
+          0, material_id, -1, Triangle_shading_mode::tsm_flat);
+    }
+    Light_mesh* light_mesh = arena.create<Light_mesh>(
+        material_id, Arbitrary_transformation(arbitrary_transformation),
+        triangle_mesh, radiance);
+    if (use_scene_cache && !scene_cache.is_loaded()) {
+      scene_cache.add_mesh(*light_mesh->triangle_mesh);
+    }
     lights.push_back(light_mesh);
     objects.push_back(light_mesh);
     element = element->NextSiblingElement("LightMesh");
@@ -1365,7 +2037,7 @@ Scene::Scene(const std::string& file_name) {
       stream.clear();
     }
     // No motion blur support for primitive triangles, yet
-    objects.push_back(new Triangle(
+    objects.push_back(arena.create<Triangle>(
         this, v0_id - 1, v1_id - 1, v2_id - 1, 0, material_id, texture_id,
         Arbitrary_transformation(arbitrary_transformation)));
     element = element->NextSiblingElement("Triangle");
@@ -1431,7 +2103,7 @@ Scene::Scene(const std::string& file_name) {
     stream << child->GetText() << std::endl;
     stream >> radiance.x >> radiance.y >> radiance.z;
 
-    Light_sphere* light_sphere = new Light_sphere(
+    Light_sphere* light_sphere = arena.create<Light_sphere>(
         this, center_of_sphere, radius, material_id,
         Arbitrary_transformation(arbitrary_transformation), radiance);
     objects.push_back(light_sphere);
@@ -1508,66 +2180,13 @@ Scene::Scene(const std::string& file_name) {
       stream >> velocity.x >> velocity.y >> velocity.z;
     }
     stream.clear();
-    objects.push_back(new Sphere(
+    objects.push_back(arena.create<Sphere>(
         this, center_of_sphere, radius, material_id, texture_id,
         Arbitrary_transformation(arbitrary_transformation), velocity));
     element = element->NextSiblingElement("Sphere");
   }
   stream.clear();
   debug("Spheres are parsed");
-  // Get Textures
-  element = root->FirstChildElement("Textures");
-  if (element) {
-    element = element->FirstChildElement("Texture");
-    while (element) {
-      std::string image_name, interpolation_type, decal_mode, appearance;
-      auto child = element->FirstChildElement("ImageName");
-      image_name = child->GetText();
-      child = element->FirstChildElement("Interpolation");
-      if (child) {
-        interpolation_type = child->GetText();
-      } else {
-        interpolation_type = "bilinear";
-      }
-      child = element->FirstChildElement("DecalMode");
-      if (child) {
-        decal_mode = child->GetText();
-      } else {
-        decal_mode = "blend_kd";
-      }
-      child = element->FirstChildElement("Appearance");
-      if (child) {
-        appearance = child->GetText();
-      } else {
-        appearance = "repeat";
-      }
-      child = element->FirstChildElement("Normalizer");
-      if (child) {
-        stream << child->GetText() << std::endl;
-      } else {
-        stream << "255.0" << std::endl;
-      }
-      child = element->FirstChildElement("ScalingFactor");
-      if (child) {
-        stream << child->GetText() << std::endl;
-      } else {
-        stream << "1.0" << std::endl;
-      }
-      float bumpmap_multiplier =
-          element->FloatAttribute("bumpmapMultiplier", 1.0f);
-      bool is_bump = element->BoolAttribute("bumpmap", false);
-      float normalizer, scaling_factor;
-      stream >> normalizer >> scaling_factor;
-      textures.push_back(std::move(
-          Texture(image_name, interpolation_type, decal_mode, appearance,
-                  normalizer, scaling_factor, is_bump, bumpmap_multiplier,
-                  element->BoolAttribute("degamma", false))));
-
-      element = element->NextSiblingElement("Texture");
-    }
-  }
-  stream.clear();
-  debug("Textures are parsed");
 
   // Parse IntegratorType
   element = root->FirstChildElement("Integrator");
@@ -1579,23 +2198,57 @@ Scene::Scene(const std::string& file_name) {
     if (element && element->GetText() == std::string("ImportanceSampling")) {
       is_uniform_sampling = false;
     }
+    // Warned once here instead of for every hit
+    for (const Texture& texture : textures) {
+      if (texture.get_decal_mode() == Texture::dm_replace_all) {
+        std::cerr << "Path tracing with replace all decal mode is kinda weird"
+                  << std::endl;
+        break;
+      }
+    }
   }
 
-  bvh = BVH::create_bvh(objects);
+  bvh = BVH::create_bvh(objects, arena);
+  if (caustic_max_radius_squared < 0.0f) {
+    // Bounds the k nearest search, which would visit the whole map otherwise
+    const float radius = CAUSTIC_DEFAULT_GATHER_RADIUS_FRACTION *
+                         bvh->get_bounding_box().delta.length();
+    caustic_max_radius_squared =
+        std::isfinite(radius) && radius > 0.0f ? radius * radius : kInf;
+  }
   // Finalize surface normals
   for (Vertex& vertex : vertex_data) {
     if (vertex.has_vertex_normal()) {
       vertex.finalize_normal();
     }
   }
+  if (use_scene_cache && !scene_cache.is_loaded()) {
+    if (scene_cache.save(scene_cache_name, scene_cache_key, vertex_data,
+                         texture_coord_data)) {
+      debug("SceneCache is saved");
+    } else {
+      std::cerr << "SceneCache cannot be saved to " << scene_cache_name
+                << std::endl;
+    }
+  }
+  if (use_compressed_vertices) {
+    compress_vertices();
+  }
+  size_t mesh_bvh_bytes = 0;
+  for (const Mesh* mesh : meshes) {
+    mesh_bvh_bytes += mesh->triangle_mesh->get_bvh_bytes();
+  }
+  std::cout << "Mesh BVHs: " << mesh_bvh_bytes / 1024 << " KB" << std::endl;
+  std::cout << "Scene arena: " << arena.get_allocation_count()
+            << " allocations, " << arena.get_allocated_bytes() / 1024
+            << " KB in " << arena.get_block_count() << " blocks" << std::endl;
 }
 
 void Scene::parse_ply_tinyply(std::string filename,
                               std::vector<Vertex>& vertices,
-                              std::vector<Shape*>& mesh_triangles,
-                              int vertex_offset, int texture_offset,
-                              int material_id, int texture_id,
-                              Triangle_shading_mode tsm) {
+                              std::vector<Triangle_indices>& triangles,
+                              std::vector<Vector3>& face_normals,
+                              int vertex_offset, int texture_offset) {
   try {
     // Read the file and create a std::istringstream suitable
     // for the lib -- tinyply does not perform any file i/o.
@@ -1648,19 +2301,22 @@ void Scene::parse_ply_tinyply(std::string filename,
       std::cerr << "tinyply exception: " << e.what() << std::endl;
     }
     file.read(ss);
-    std::vector<Vector3> face_normals;
+    std::vector<Vector3> file_face_normals;
 
     // Process vertices
     if (ply_vertices) {
       // std::cout << "Parsing vertices" << std::endl;
       const size_t numVerticesBytes = ply_vertices->buffer.size_bytes();
+      if (vertex_offset + ply_vertices->count > vertices.size()) {
+        throw std::runtime_error(filename + " has more vertices than reserved");
+      }
       if (ply_vertices->t == tinyply::Type::FLOAT32) {
         std::vector<float> verts(ply_vertices->count * 3);
         std::memcpy(verts.data(), ply_vertices->buffer.get(), numVerticesBytes);
         size_t index = 0, c = ply_vertices->count;
         for (; index < c; index++) {
-          vertices.push_back(Vector3(verts[3 * index], verts[3 * index + 1],
-                                     verts[3 * index + 2]));
+          vertices[vertex_offset + index] = Vertex(Vector3(
+              verts[3 * index], verts[3 * index + 1], verts[3 * index + 2]));
         }
       } else if (ply_vertices->t == tinyply::Type::FLOAT64) {
         // possible precision loss
@@ -1668,8 +2324,8 @@ void Scene::parse_ply_tinyply(std::string filename,
         std::memcpy(verts.data(), ply_vertices->buffer.get(), numVerticesBytes);
         size_t index = 0, c = ply_vertices->count;
         for (; index < c; index++) {
-          vertices.push_back(Vector3(verts[3 * index], verts[3 * index + 1],
-                                     verts[3 * index + 2]));
+          vertices[vertex_offset + index] = Vertex(Vector3(
+              verts[3 * index], verts[3 * index + 1], verts[3 * index + 2]));
         }
       } else {
         throw std::runtime_error("Unknown vertice type");
@@ -1716,14 +2372,13 @@ void Scene::parse_ply_tinyply(std::string filename,
     // process vertex uvs
     if (ply_vertex_uvs) {
       const size_t numUVsBytes = ply_vertex_uvs->buffer.size_bytes();
-      if (ply_vertice_normals->t == tinyply::Type::FLOAT32) {
-        texture_offset = texture_coord_data.size();
+      if (ply_vertex_uvs->t == tinyply::Type::FLOAT32) {
         std::vector<float> uvs(ply_vertex_uvs->count * 2);
         std::memcpy(uvs.data(), ply_vertex_uvs->buffer.get(), numUVsBytes);
         size_t index = 0, c = ply_vertex_uvs->count;
         for (; index < c; index++) {
           Vector3 uv(uvs[2 * index], uvs[2 * index + 1], 0.0f);
-          texture_coord_data.push_back(uv);
+          texture_coord_data[texture_offset + index] = uv;
         }
       } else {
         throw std::runtime_error("Unknown uv type");
@@ -1740,10 +2395,10 @@ void Scene::parse_ply_tinyply(std::string filename,
                     numFaceNormalsBytes);
         size_t index = 0, c = ply_face_normals->count;
         for (; index < c; index++) {
-          face_normals.push_back(Vector3(vectors[3 * index],
-                                         vectors[3 * index + 1],
-                                         vectors[3 * index + 2])
-                                     .normalize());
+          file_face_normals.push_back(Vector3(vectors[3 * index],
+                                              vectors[3 * index + 1],
+                                              vectors[3 * index + 2])
+                                          .normalize());
         }
         has_face_normals = true;
       } else if (ply_vertice_normals->t == tinyply::Type::FLOAT64) {
@@ -1753,10 +2408,10 @@ void Scene::parse_ply_tinyply(std::string filename,
                     numFaceNormalsBytes);
         size_t index = 0, c = ply_face_normals->count;
         for (; index < c; index++) {
-          face_normals.push_back(Vector3(vectors[3 * index],
-                                         vectors[3 * index + 1],
-                                         vectors[3 * index + 2])
-                                     .normalize());
+          file_face_normals.push_back(Vector3(vectors[3 * index],
+                                              vectors[3 * index + 1],
+                                              vectors[3 * index + 2])
+                                          .normalize());
         }
         has_face_normals = true;
       } else {
@@ -1784,43 +2439,16 @@ void Scene::parse_ply_tinyply(std::string filename,
             int index_2 = verts[index * 4 + 2];
             int index_3 = verts[index * 4 + 3];
 
-            mesh_triangles.push_back(new Mesh_triangle(
-                this, index_0, index_1, index_3, vertex_offset, texture_offset,
-                material_id, texture_id, tsm));
-            mesh_triangles.push_back(new Mesh_triangle(
-                this, index_2, index_3, index_1, vertex_offset, texture_offset,
-                material_id, texture_id, tsm));
-            Mesh_triangle* triangle1 =
-                (Mesh_triangle*)*(mesh_triangles.rbegin()++);
-            Mesh_triangle* triangle2 =
-                (Mesh_triangle*)*(mesh_triangles.rbegin());
+            triangles.push_back({{index_0, index_1, index_3}});
+            triangles.push_back({{index_2, index_3, index_1}});
             if (has_face_normals) {
-              triangle1->normal = face_normals[index];
-              triangle2->normal = face_normals[index];
-            }
-            if (!has_vertice_normals) {
-              {
-                float area = triangle1->get_surface_area();
-                const Vector3& surface_normal = triangle1->normal;
-                vertices[index_0 + vertex_offset].add_vertex_normal(
-                    surface_normal, area);
-                vertices[index_1 + vertex_offset].add_vertex_normal(
-                    surface_normal, area);
-                vertices[index_2 + vertex_offset].add_vertex_normal(
-                    surface_normal, area);
-              }
-              {
-                float area = triangle2->get_surface_area();
-                const Vector3& surface_normal = triangle2->normal;
-                vertices[index_2 + vertex_offset].add_vertex_normal(
-                    surface_normal, area);
-                vertices[index_3 + vertex_offset].add_vertex_normal(
-                    surface_normal, area);
-                vertices[index_1 + vertex_offset].add_vertex_normal(
-                    surface_normal, area);
-              }
+              face_normals.push_back(file_face_normals[index]);
+              face_normals.push_back(file_face_normals[index]);
             }
           }
+          if (!has_vertice_normals) {
+            add_vertex_normals(triangles, face_normals, vertex_offset);
+          }
         } else {
           throw std::runtime_error("This parser doesn't support hybrid files");
         }
@@ -1836,87 +2464,299 @@ void Scene::parse_ply_tinyply(std::string filename,
   }
 }
 
-void Scene::parse_binary_vertexdata(std::string& filename) {
-  FILE* fd = fopen(filename.c_str(), "rb");
-  int N;
-  fread(&N, sizeof(int), 1, fd);
-  for (int i = 0; i < N; i++) {
-    float vi_x, vi_y, vi_z;
-    fread(&vi_x, sizeof(float), 1, fd);
-    fread(&vi_y, sizeof(float), 1, fd);
-    fread(&vi_z, sizeof(float), 1, fd);
-    vertex_data.push_back(Vertex(Vector3(vi_x, vi_y, vi_z)));
-  }
-  fclose(fd);
+bool Scene::parse_ply_native(const std::string& filename,
+                             std::vector<Vertex>& vertices,
+                             std::vector<Triangle_indices>& triangles,
+                             std::vector<Vector3>& face_normals,
+                             int vertex_offset, int texture_offset) {
+  // Values are copied out of the mapping as they are, in host byte order
+  const uint16_t byte_order_test = 1;
+  if (*(const unsigned char*)&byte_order_test != 1) {
+    return false;
+  }
+  Mapped_file file(filename);
+  std::vector<Ply_element> elements;
+  size_t offset;
+  if (!parse_ply_header(file, elements, offset) || elements.size() < 2 ||
+      elements[0].name != "vertex" || elements[1].name != "face") {
+    return false;
+  }
+
+  // Vertex layout, only float positions, normals and uvs are read natively
+  const Ply_element& vertex_element = elements[0];
+  const char* vertex_names[] = {"x", "y", "z", "nx", "ny", "nz", "u", "v"};
+  size_t vertex_offsets[8];
+  bool has_vertex_property[8] = {false};
+  size_t vertex_stride = 0;
+  for (const Ply_property& property : vertex_element.properties) {
+    if (property.is_list) {
+      return false;
+    }
+    for (int i = 0; i < 8; i++) {
+      if (property.name == vertex_names[i]) {
+        if (!is_ply_float(property.type)) {
+          return false;
+        }
+        vertex_offsets[i] = vertex_stride;
+        has_vertex_property[i] = true;
+      }
+    }
+    vertex_stride += ply_type_size(property.type);
+  }
+  if (!has_vertex_property[0] || !has_vertex_property[1] ||
+      !has_vertex_property[2]) {
+    return false;
+  }
+  const bool has_vertex_normals = has_vertex_property[3] &&
+                                  has_vertex_property[4] &&
+                                  has_vertex_property[5];
+  const bool has_uvs = has_vertex_property[6] && has_vertex_property[7];
+
+  // Face layout, a single list of int indices and optional float normals
+  const Ply_element& face_element = elements[1];
+  const char* face_names[] = {"nx", "ny", "nz"};
+  size_t face_offsets[3];
+  bool face_offset_after_list[3];
+  bool has_face_property[3] = {false};
+  bool has_list = false;
+  size_t before_list_size = 0, after_list_size = 0;
+  for (const Ply_property& property : face_element.properties) {
+    if (property.is_list) {
+      if (has_list ||
+          (property.name != "vertex_indices" &&
+           property.name != "vertex_index") ||
+          ply_type_size(property.count_type) != 1 ||
+          ply_type_size(property.type) != 4 || is_ply_float(property.type)) {
+        return false;
+      }
+      has_list = true;
+      continue;
+    }
+    for (int i = 0; i < 3; i++) {
+      if (property.name == face_names[i]) {
+        if (!is_ply_float(property.type)) {
+          return false;
+        }
+        face_offsets[i] = has_list ? after_list_size : before_list_size;
+        face_offset_after_list[i] = has_list;
+        has_face_property[i] = true;
+      }
+    }
+    (has_list ? after_list_size : before_list_size) +=
+        ply_type_size(property.type);
+  }
+  if (!has_list) {
+    return false;
+  }
+  const bool has_face_normals =
+      has_face_property[0] && has_face_property[1] && has_face_property[2];
+
+  const size_t vertex_count = vertex_element.count;
+  if (vertex_offset + vertex_count > vertices.size() ||
+      (has_uvs && texture_offset + vertex_count > texture_coord_data.size())) {
+    throw std::runtime_error("Error: " + filename +
+                             " has more vertices than reserved.");
+  }
+  if (vertex_stride != 0 &&
+      (file.size() - offset) / vertex_stride < vertex_count) {
+    throw std::runtime_error("Error: " + filename + " is truncated.");
+  }
+  for (size_t i = 0; i < vertex_count; i++, offset += vertex_stride) {
+    Vertex& vertex = vertices[vertex_offset + i];
+    vertex = Vertex(Vector3(file.read<float>(offset + vertex_offsets[0]),
+                            file.read<float>(offset + vertex_offsets[1]),
+                            file.read<float>(offset + vertex_offsets[2])));
+    if (has_vertex_normals) {
+      Vector3 normal(file.read<float>(offset + vertex_offsets[3]),
+                     file.read<float>(offset + vertex_offsets[4]),
+                     file.read<float>(offset + vertex_offsets[5]));
+      vertex.add_vertex_normal(normal.normalize(), 1.0f);
+      vertex.finalize_normal();
+    }
+    if (has_uvs) {
+      texture_coord_data[texture_offset + i] =
+          Vector3(file.read<float>(offset + vertex_offsets[6]),
+                  file.read<float>(offset + vertex_offsets[7]), 0.0f);
+    }
+  }
+
+  // Quads are split as in parse_ply_tinyply, larger polygons as fans
+  triangles.reserve(triangles.size() + face_element.count);
+  for (size_t i = 0; i < face_element.count; i++) {
+    const size_t list_start = offset + before_list_size;
+    if (list_start >= file.size()) {
+      throw std::runtime_error("Error: " + filename + " is truncated.");
+    }
+    const int corner_count = file.data()[list_start];
+    const size_t list_end = list_start + 1 + corner_count * sizeof(int);
+    const size_t face_end = list_end + after_list_size;
+    if (face_end > file.size()) {
+      throw std::runtime_error("Error: " + filename + " is truncated.");
+    }
+    if (corner_count < 3) {
+      throw std::runtime_error("Error: " + filename +
+                               " has a face with less than 3 vertices.");
+    }
+    int corners[256];
+    for (int j = 0; j < corner_count; j++) {
+      corners[j] = file.read<int>(list_start + 1 + j * sizeof(int));
+      if (corners[j] < 0 || (size_t)corners[j] >= vertex_count) {
+        throw std::runtime_error("Error: " + filename +
+                                 " has an out of range vertex index.");
+      }
+    }
+    if (corner_count == 4) {
+      triangles.push_back({{corners[0], corners[1], corners[3]}});
+      triangles.push_back({{corners[2], corners[3], corners[1]}});
+    } else {
+      for (int j = 1; j + 1 < corner_count; j++) {
+        triangles.push_back({{corners[0], corners[j], corners[j + 1]}});
+      }
+    }
+    if (has_face_normals) {
+      auto read_face_float = [&](int j) {
+        return file.read<float>(
+            (face_offset_after_list[j] ? list_end : offset) + face_offsets[j]);
+      };
+      Vector3 normal = Vector3(read_face_float(0), read_face_float(1),
+                               read_face_float(2))
+                           .normalize();
+      face_normals.resize(triangles.size(), normal);
+    }
+    offset = face_end;
+  }
+  if (!has_vertex_normals) {
+    // Vertices of a ply file belong to its mesh only
+    add_vertex_normals(triangles, face_normals, vertex_offset);
+  }
+  std::cout << filename << " is parsed" << std::endl;
+  return true;
 }
 
-void Scene::parse_binary_texturedata(std::string& filename) {
-  FILE* fd = fopen(filename.c_str(), "rb");
-  int N;
-  fread(&N, sizeof(int), 1, fd);
-  for (int i = 0; i < N; i++) {
-    float vi_u, vi_v;
-    fread(&vi_u, sizeof(float), 1, fd);
-    fread(&vi_v, sizeof(float), 1, fd);
-    texture_coord_data.push_back(Vector3(vi_u, vi_v, 0.0f));
-  }
-  fclose(fd);
+namespace {
+// Binary files start with an int count followed by count elements. Count is
+// checked against the file size instead of being trusted.
+int read_binary_element_count(const Mapped_file& file, size_t element_size,
+                              const std::string& filename) {
+  if (file.size() < sizeof(int)) {
+    throw std::runtime_error("Error: " + filename + " has no header.");
+  }
+  const int count = file.read<int>(0);
+  if (count < 0 ||
+      (file.size() - sizeof(int)) / element_size < (size_t)count) {
+    throw std::runtime_error("Error: " + filename + " is truncated.");
+  }
+  return count;
+}
+}  // namespace
+
+void Scene::parse_binary_vertexdata(const std::string& filename) {
+  Mapped_file file(filename);
+  const int N = read_binary_element_count(file, 3 * sizeof(float), filename);
+  vertex_data.reserve(vertex_data.size() + N);
+  size_t offset = sizeof(int);
+  for (int i = 0; i < N; i++, offset += 3 * sizeof(float)) {
+    vertex_data.push_back(
+        Vertex(Vector3(file.read<float>(offset),
+                       file.read<float>(offset + sizeof(float)),
+                       file.read<float>(offset + 2 * sizeof(float)))));
+  }
 }
 
-void Scene::parse_binary_facedata(std::string& filename,
-                                  std::vector<Shape*>& mesh_triangles,
-                                  int vertex_offset, int texture_offset,
-                                  int material_id, int texture_id,
-                                  Triangle_shading_mode tsm,
-                                  bool zero_based_indexing) {
-  //
-  FILE* fd = fopen(filename.c_str(), "rb");
-  int N;
-  fread(&N, sizeof(int), 1, fd);
-  for (int i = 0; i < N; i++) {
-    int index_0;
-    int index_1;
-    int index_2;
-    fread(&index_0, sizeof(int), 1, fd);
-    fread(&index_1, sizeof(int), 1, fd);
-    fread(&index_2, sizeof(int), 1, fd);
-    if (!zero_based_indexing) {
-      index_0--;
-      index_1--;
-      index_2--;
-    }
-    mesh_triangles.push_back(new Mesh_triangle(this, index_0, index_1, index_2,
-                                               vertex_offset, texture_offset,
-                                               material_id, texture_id, tsm));
-    Mesh_triangle* triangle = (Mesh_triangle*)*(mesh_triangles.rbegin());
-
-    float area = triangle->get_surface_area();
-    const Vector3& surface_normal = triangle->normal;
-    vertex_data[index_0 + vertex_offset].add_vertex_normal(surface_normal,
-                                                           area);
-    vertex_data[index_1 + vertex_offset].add_vertex_normal(surface_normal,
-                                                           area);
-    vertex_data[index_2 + vertex_offset].add_vertex_normal(surface_normal,
-                                                           area);
+void Scene::parse_binary_texturedata(const std::string& filename) {
+  Mapped_file file(filename);
+  const int N = read_binary_element_count(file, 2 * sizeof(float), filename);
+  texture_coord_data.reserve(texture_coord_data.size() + N);
+  size_t offset = sizeof(int);
+  for (int i = 0; i < N; i++, offset += 2 * sizeof(float)) {
+    texture_coord_data.push_back(
+        Vector3(file.read<float>(offset),
+                file.read<float>(offset + sizeof(float)), 0.0f));
   }
+}
+
+void Scene::parse_binary_facedata(const std::string& filename,
+                                  std::vector<Triangle_indices>& triangles,
+                                  int vertex_offset, bool zero_based_indexing) {
+  Mapped_file file(filename);
+  const int N = read_binary_element_count(file, 3 * sizeof(int), filename);
+  // Mapping is page aligned, so the indices after the header are aligned too
+  create_mesh_triangles((const int*)(file.data() + sizeof(int)), N,
+                        zero_based_indexing ? 0 : 1, triangles, vertex_offset,
+                        filename);
   std::cout << filename << " is parsed" << std::endl;
-  fclose(fd);
 }
-Scene::~Scene() {
-  /*delete bvh;
-  if (background_texture) {
-    delete background_texture;
-  }
-  size_t size = meshes.size();
-  for (size_t i = 0; i < size; i++) {
-    delete meshes[i];
-  }
-  size = lights.size();
-  for (size_t i = 0; i < size; i++) {
-    delete lights[i];
-  }
-  size = brdfs.size();
-  for (size_t i = 0; i < size; i++) {
-    delete brdfs[i];
-  }*/
+
+void Scene::create_mesh_triangles(const int* indices, int triangle_count,
+                                  int index_base,
+                                  std::vector<Triangle_indices>& triangles,
+                                  int vertex_offset,
+                                  const std::string& source_name) {
+  const int first_triangle = (int)triangles.size();
+  triangles.resize(first_triangle + triangle_count);
+  const int vertex_count = (int)vertex_data.size() - vertex_offset;
+
+  // Triangles only read the vertices, so they are created in parallel chunks
+  auto create_triangles = [&](int start, int end, char* invalid_index) {
+    for (int i = start; i < end; i++) {
+      int index_0 = indices[3 * i] - index_base;
+      int index_1 = indices[3 * i + 1] - index_base;
+      int index_2 = indices[3 * i + 2] - index_base;
+      if (index_0 < 0 || index_0 >= vertex_count || index_1 < 0 ||
+          index_1 >= vertex_count || index_2 < 0 ||
+          index_2 >= vertex_count) {
+        *invalid_index = true;
+        return;
+      }
+      triangles[first_triangle + i] = {{index_0, index_1, index_2}};
+    }
+  };
+  int thread_count = std::thread::hardware_concurrency();
+  if (thread_count == 0 ||
+      triangle_count < thread_count * MESH_TRIANGLE_CHUNK_SIZE) {
+    thread_count = 1;
+  }
+  std::vector<char> invalid_index(thread_count, false);
+  std::vector<std::thread> threads;
+  for (int i = 1; i < thread_count; i++) {
+    threads.push_back(std::thread(
+        create_triangles, (int)((long long)triangle_count * i / thread_count),
+        (int)((long long)triangle_count * (i + 1) / thread_count),
+        &invalid_index[i]));
+  }
+  create_triangles(0, triangle_count / thread_count, &invalid_index[0]);
+  for (std::thread& thread : threads) thread.join();
+  for (char invalid : invalid_index) {
+    if (invalid) {
+      throw std::runtime_error("Error: " + source_name +
+                               " has an out of range vertex index.");
+    }
+  }
 }
+
+void Scene::add_vertex_normals(const std::vector<Triangle_indices>& triangles,
+                               const std::vector<Vector3>& face_normals,
+                               int vertex_offset) {
+  for (size_t i = 0; i < triangles.size(); i++) {
+    Vertex& vertex_0 =
+        vertex_data[triangles[i].vertex_index[0] + vertex_offset];
+    Vertex& vertex_1 =
+        vertex_data[triangles[i].vertex_index[1] + vertex_offset];
+    Vertex& vertex_2 =
+        vertex_data[triangles[i].vertex_index[2] + vertex_offset];
+    const Vector3 cross =
+        (vertex_1.get_vertex_position() - vertex_0.get_vertex_position())
+            .cross(vertex_2.get_vertex_position() -
+                   vertex_0.get_vertex_position());
+    const float area = cross.length() / 2;
+    const Vector3 surface_normal =
+        face_normals.empty() ? cross.normalize() : face_normals[i];
+    vertex_0.add_vertex_normal(surface_normal, area);
+    vertex_1.add_vertex_normal(surface_normal, area);
+    vertex_2.add_vertex_normal(surface_normal, area);
+  }
+}
+
+// Shapes, BVH nodes, lights and the background texture are freed with the
+// arena
+Scene::~Scene() {}
@@ -0,0 +1,310 @@
+#include "Scene_cache.h"
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include "Mapped_file.h"
+#include "tinyxml2.h"
+
+// Bump when the layout of the file or of Vertex changes
+#define SCENE_CACHE_VERSION 4
+
+namespace {
+const char kSceneCacheMagic[8] = {'H', 'W', '7', 'C', 'A', 'C', 'H', 'E'};
+
+struct Scene_cache_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t vertex_size;
+  uint64_t key;
+  uint64_t vertex_count;
+  uint64_t texture_coord_count;
+  uint64_t mesh_count;
+  uint64_t triangle_count;
+  uint64_t node_count;
+  uint64_t wide_node_count;
+  uint64_t face_normal_count;
+};
+
+// FNV-1a
+inline uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t hash_referenced_files(uint64_t hash, const tinyxml2::XMLNode* node) {
+  for (const tinyxml2::XMLElement* element = node->FirstChildElement();
+       element; element = element->NextSiblingElement()) {
+    const char* attributes[] = {"plyFile", "binaryFile"};
+    for (const char* attribute : attributes) {
+      const char* file_name = element->Attribute(attribute);
+      if (!file_name) {
+        continue;
+      }
+      // Hashing the content of large binary files would cost as much as
+      // reading them, so only the metadata is used
+      hash = hash_bytes(hash, file_name, std::strlen(file_name));
+      struct stat file_stat;
+      if (stat(file_name, &file_stat) == 0) {
+        int64_t size = (int64_t)file_stat.st_size;
+        int64_t modification_time = (int64_t)file_stat.st_mtime;
+        hash = hash_bytes(hash, &size, sizeof(size));
+        hash = hash_bytes(hash, &modification_time, sizeof(modification_time));
+      }
+    }
+    hash = hash_referenced_files(hash, element);
+  }
+  return hash;
+}
+
+template <typename T>
+inline void write_array(FILE* file, const std::vector<T>& values,
+                        bool& succeeded) {
+  if (!values.empty() &&
+      fwrite(values.data(), sizeof(T), values.size(), file) != values.size()) {
+    succeeded = false;
+  }
+}
+
+// Every record is made of 4 byte fields, except the face normals which come
+// last, and the mapping is page aligned, so the arrays are used in place
+template <typename T>
+inline const unsigned char* map_array(const unsigned char* data,
+                                      uint64_t count, const T*& values) {
+  values = (const T*)data;
+  return data + count * sizeof(T);
+}
+
+// first and count describe a range inside an array of size elements
+inline bool is_range_valid(int64_t first, int64_t count, uint64_t size) {
+  return first >= 0 && count >= 0 && (uint64_t)(first + count) <= size;
+}
+}  // namespace
+
+uint64_t Scene_cache::compute_key(const std::string& xml_file_name,
+                                  const tinyxml2::XMLNode* root) {
+  uint64_t hash = 14695981039346656037ULL;
+  const uint32_t version = SCENE_CACHE_VERSION;
+  hash = hash_bytes(hash, &version, sizeof(version));
+  std::ifstream xml_file(xml_file_name, std::ios::binary);
+  char buffer[4096];
+  while (xml_file) {
+    xml_file.read(buffer, sizeof(buffer));
+    hash = hash_bytes(hash, buffer, (size_t)xml_file.gcount());
+  }
+  return hash_referenced_files(hash, root);
+}
+
+bool Scene_cache::load(const std::string& file_name, uint64_t key) {
+  static_assert(std::is_trivially_copyable<Vertex>::value,
+                "Vertex is written to the cache as is");
+  loaded_ = false;
+  struct stat file_stat;
+  if (stat(file_name.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  std::unique_ptr<Mapped_file> file(new Mapped_file(file_name));
+  if (file->size() < sizeof(Scene_cache_header)) {
+    return false;
+  }
+  const Scene_cache_header header = file->read<Scene_cache_header>(0);
+  if (std::memcmp(header.magic, kSceneCacheMagic, sizeof(header.magic)) ||
+      header.version != SCENE_CACHE_VERSION ||
+      header.vertex_size != sizeof(Vertex) || header.key != key) {
+    return false;
+  }
+  // Every record is at least a byte, larger counts would overflow the size
+  const uint64_t counts[] = {header.vertex_count,   header.texture_coord_count,
+                             header.mesh_count,     header.triangle_count,
+                             header.node_count,     header.wide_node_count,
+                             header.face_normal_count};
+  for (uint64_t count : counts) {
+    if (count > file->size()) {
+      return false;
+    }
+  }
+  const uint64_t expected_size =
+      sizeof(Scene_cache_header) + header.vertex_count * sizeof(Vertex) +
+      header.texture_coord_count * sizeof(Vector3) +
+      header.mesh_count * sizeof(Cached_mesh) +
+      header.triangle_count * sizeof(Triangle_indices) +
+      header.node_count * sizeof(Triangle_mesh::Node) +
+      header.wide_node_count * sizeof(Triangle_mesh::Wide_node) +
+      header.face_normal_count * sizeof(Octahedral_normal);
+  if (file->size() != expected_size) {
+    return false;
+  }
+  const unsigned char* data = file->data() + sizeof(Scene_cache_header);
+  data = map_array(data, header.vertex_count, mapped_vertex_data_.data);
+  data = map_array(data, header.texture_coord_count,
+                   mapped_texture_coord_data_.data);
+  data = map_array(data, header.mesh_count, mapped_meshes_.data);
+  data = map_array(data, header.triangle_count, mapped_triangles_.data);
+  data = map_array(data, header.node_count, mapped_nodes_.data);
+  data = map_array(data, header.wide_node_count, mapped_wide_nodes_.data);
+  map_array(data, header.face_normal_count, mapped_face_normals_.data);
+  mapped_vertex_data_.size = header.vertex_count;
+  mapped_texture_coord_data_.size = header.texture_coord_count;
+  mapped_meshes_.size = header.mesh_count;
+  mapped_triangles_.size = header.triangle_count;
+  mapped_nodes_.size = header.node_count;
+  mapped_wide_nodes_.size = header.wide_node_count;
+  mapped_face_normals_.size = header.face_normal_count;
+  // A cache of the right size can still be stale or corrupt, it is rebuilt
+  // instead of indexing out of its arrays
+  for (size_t i = 0; i < mapped_meshes_.size; i++) {
+    if (!is_valid(mapped_meshes_.data[i])) {
+      return false;
+    }
+  }
+  file_.swap(file);
+  loaded_ = true;
+  return true;
+}
+
+bool Scene_cache::is_valid(const Cached_mesh& mesh) const {
+  if (!is_range_valid(mesh.first_triangle, mesh.triangle_count,
+                      mapped_triangles_.size) ||
+      !is_range_valid(mesh.first_node, mesh.node_count, mapped_nodes_.size) ||
+      !is_range_valid(mesh.first_wide_node, mesh.wide_node_count,
+                      mapped_wide_nodes_.size) ||
+      (mesh.first_face_normal != -1 &&
+       !is_range_valid(mesh.first_face_normal, mesh.triangle_count,
+                       mapped_face_normals_.size)) ||
+      !is_range_valid(mesh.vertex_offset, 0, mapped_vertex_data_.size) ||
+      !is_range_valid(mesh.texture_offset, 0,
+                      mapped_texture_coord_data_.size)) {
+    return false;
+  }
+  const int64_t vertex_count =
+      (int64_t)mapped_vertex_data_.size - mesh.vertex_offset;
+  const Triangle_indices* triangles =
+      mapped_triangles_.data + mesh.first_triangle;
+  for (int i = 0; i < mesh.triangle_count; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (!is_range_valid(triangles[i].vertex_index[j], 1, vertex_count)) {
+        return false;
+      }
+    }
+  }
+  return Triangle_mesh::is_valid_bvh(
+      mapped_nodes_.data + mesh.first_node, mesh.node_count,
+      mapped_wide_nodes_.data + mesh.first_wide_node, mesh.wide_node_count,
+      mesh.triangle_count);
+}
+
+void Scene_cache::restore_vertices(std::vector<Vertex>& vertex_data,
+                                   std::vector<Vector3>& texture_coord_data) {
+  vertex_data.assign(mapped_vertex_data_.data,
+                     mapped_vertex_data_.data + mapped_vertex_data_.size);
+  texture_coord_data.assign(
+      mapped_texture_coord_data_.data,
+      mapped_texture_coord_data_.data + mapped_texture_coord_data_.size);
+}
+
+Triangle_mesh* Scene_cache::restore_mesh(int mesh_index, const Scene* scene,
+                                         int material_id, int texture_id,
+                                         Triangle_shading_mode tsm,
+                                         Arena& arena) const {
+  if (mesh_index >= (int)mapped_meshes_.size) {
+    throw std::runtime_error("Error: Scene cache has less meshes than xml.");
+  }
+  const Cached_mesh& mesh = mapped_meshes_.data[mesh_index];
+  const Triangle_indices* triangles =
+      mapped_triangles_.data + mesh.first_triangle;
+  const Triangle_mesh::Node* nodes = mapped_nodes_.data + mesh.first_node;
+  const Triangle_mesh::Wide_node* wide_nodes =
+      mapped_wide_nodes_.data + mesh.first_wide_node;
+  std::vector<Octahedral_normal> face_normals;
+  if (mesh.first_face_normal >= 0) {
+    const Octahedral_normal* mesh_face_normals =
+        mapped_face_normals_.data + mesh.first_face_normal;
+    face_normals.assign(mesh_face_normals,
+                        mesh_face_normals + mesh.triangle_count);
+  }
+  return arena.create<Triangle_mesh>(
+      scene,
+      std::vector<Triangle_indices>(triangles,
+                                    triangles + mesh.triangle_count),
+      std::move(face_normals),
+      std::vector<Triangle_mesh::Node>(nodes, nodes + mesh.node_count),
+      std::vector<Triangle_mesh::Wide_node>(
+          wide_nodes, wide_nodes + mesh.wide_node_count),
+      mesh.vertex_offset, mesh.texture_offset, material_id, texture_id, tsm);
+}
+
+void Scene_cache::add_mesh(const Triangle_mesh& triangle_mesh) {
+  const std::vector<Triangle_indices>& triangles =
+      triangle_mesh.get_triangles();
+  const std::vector<Triangle_mesh::Node>& nodes = triangle_mesh.get_nodes();
+  const std::vector<Triangle_mesh::Wide_node>& wide_nodes =
+      triangle_mesh.get_wide_nodes();
+  const std::vector<Octahedral_normal>& face_normals =
+      triangle_mesh.get_face_normals();
+  Cached_mesh mesh;
+  mesh.first_triangle = (int32_t)triangles_.size();
+  mesh.triangle_count = (int32_t)triangles.size();
+  mesh.first_node = (int32_t)nodes_.size();
+  mesh.node_count = (int32_t)nodes.size();
+  mesh.first_wide_node = (int32_t)wide_nodes_.size();
+  mesh.wide_node_count = (int32_t)wide_nodes.size();
+  mesh.first_face_normal =
+      face_normals.empty() ? -1 : (int32_t)face_normals_.size();
+  mesh.vertex_offset = triangle_mesh.get_vertex_offset();
+  mesh.texture_offset = triangle_mesh.get_texture_offset();
+  triangles_.insert(triangles_.end(), triangles.begin(), triangles.end());
+  nodes_.insert(nodes_.end(), nodes.begin(), nodes.end());
+  wide_nodes_.insert(wide_nodes_.end(), wide_nodes.begin(), wide_nodes.end());
+  face_normals_.insert(face_normals_.end(), face_normals.begin(),
+                       face_normals.end());
+  meshes_.push_back(mesh);
+}
+
+bool Scene_cache::save(const std::string& file_name, uint64_t key,
+                       const std::vector<Vertex>& vertex_data,
+                       const std::vector<Vector3>& texture_coord_data) const {
+  Scene_cache_header header;
+  std::memcpy(header.magic, kSceneCacheMagic, sizeof(header.magic));
+  header.version = SCENE_CACHE_VERSION;
+  header.vertex_size = sizeof(Vertex);
+  header.key = key;
+  header.vertex_count = vertex_data.size();
+  header.texture_coord_count = texture_coord_data.size();
+  header.mesh_count = meshes_.size();
+  header.triangle_count = triangles_.size();
+  header.node_count = nodes_.size();
+  header.wide_node_count = wide_nodes_.size();
+  header.face_normal_count = face_normals_.size();
+
+  // Written to a temporary file first, so a crash never leaves a half
+  // written cache behind
+  const std::string temporary_name = file_name + ".tmp";
+  FILE* file = fopen(temporary_name.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+  bool succeeded = fwrite(&header, sizeof(header), 1, file) == 1;
+  write_array(file, vertex_data, succeeded);
+  write_array(file, texture_coord_data, succeeded);
+  write_array(file, meshes_, succeeded);
+  write_array(file, triangles_, succeeded);
+  write_array(file, nodes_, succeeded);
+  write_array(file, wide_nodes_, succeeded);
+  write_array(file, face_normals_, succeeded);
+  succeeded = fclose(file) == 0 && succeeded;
+  if (succeeded) {
+    std::remove(file_name.c_str());
+    succeeded = std::rename(temporary_name.c_str(), file_name.c_str()) == 0;
+  }
+  if (!succeeded) {
+    std::remove(temporary_name.c_str());
+  }
+  return succeeded;
+}
@@ -13,7 +13,7 @@ Sphere::Sphere(const Scene* scene, const Vector3& center, float radius,
       velocity(velocity),
       transformation_(transformation),
       scene_(scene) {
-  is_identity_ = transformation_.get_transformation_matrix().is_identity();
+  is_identity_ = transformation_.get_transformation().is_identity();
   const Vector3 delta(radius);
   if (is_identity_) {
     bounding_box_ = Bounding_box(center - delta, center + delta);
@@ -29,56 +29,93 @@ Sphere::Sphere(const Scene* scene, const Vector3& center, float radius,
   }
 }
 
-bool Sphere::intersect(const Ray& ray, Hit_data& hit_data, bool culling) const {
+Ray Sphere::get_local_ray(const Ray& ray, bool with_differentials) const {
   static const Vector3 zero_vector(0.0f);
-  Vector3 delta_position = ray.time * velocity;
-  Translation translation(delta_position.x, delta_position.y, delta_position.z);
-  Matrix4x4 translated_transformation_matrix =
-      translation.get_transformation_matrix() *
-      transformation_.get_transformation_matrix();
-  Arbitrary_transformation transformation(translated_transformation_matrix);
-  const Matrix4x4& inverse_transformation =
-      transformation.get_inverse_transformation_matrix();
-  const Ray ray_local(inverse_transformation.multiply(ray.o),
-                      inverse_transformation.multiply(ray.d, true),
-                      ray.ray_type);
+  const Affine_transform* inverse_transformation =
+      &transformation_.get_inverse_transformation();
+  Affine_transform moved_inverse_transformation;
+  if (velocity != zero_vector) {
+    // Motion blur translates the sphere, so only the translation of the
+    // inverse changes
+    moved_inverse_transformation =
+        inverse_transformation->translated_before(-(ray.time * velocity));
+    inverse_transformation = &moved_inverse_transformation;
+  }
+  Ray ray_local(inverse_transformation->transform_point(ray.o),
+                inverse_transformation->transform_vector(ray.d),
+                ray.ray_type);
+  if (with_differentials && ray.has_differentials) {
+    ray_local.set_differentials(
+        inverse_transformation->transform_point(ray.rx_o),
+        inverse_transformation->transform_vector(ray.rx_d),
+        inverse_transformation->transform_point(ray.ry_o),
+        inverse_transformation->transform_vector(ray.ry_d));
+  }
+  return ray_local;
+}
+
+bool Sphere::intersect(const Ray& ray, Hit_record& hit_record,
+                       bool culling) const {
+  const Ray ray_local = get_local_ray(ray, false);
   Vector3 center_to_origin = ray_local.o - center;
   const float a = ray_local.d.dot(ray_local.d);
   const float b = 2 * ray_local.d.dot(center_to_origin);
   const float c = center_to_origin.dot(center_to_origin) - radius * radius;
   const float determinant = b * b - 4 * a * c;
+  float t;
   if (determinant < -intersection_test_epsilon) {
     return false;
   } else if (determinant < intersection_test_epsilon) {
-    hit_data.t = -b / (2 * a);
+    t = -b / (2 * a);
   } else {
     const float sqrt_det = sqrt(determinant);
     const float t1 = (-b + sqrt_det) / (2 * a);
     const float t2 = (-b - sqrt_det) / (2 * a);
     if (t2 < 0.0f) {
-      hit_data.t = t1;
+      t = t1;
     } else {
-      hit_data.t = t2;
+      t = t2;
     }
   }
-  const Matrix4x4& normal_transformation =
-      transformation.get_normal_transformation_matrix();
-  Vector3 local_intersection_point = ray_local.point_at(hit_data.t);
+  if (t <= 0.0f || t >= hit_record.t) {
+    return false;
+  }
+  hit_record.t = t;
+  hit_record.shape = this;
+  hit_record.primitive = -1;
+  return true;
+}
+
+void Sphere::get_surface_interaction(const Ray& ray,
+                                     const Hit_record& hit_record,
+                                     Surface_interaction& interaction) const {
+  const Ray ray_local = get_local_ray(ray, true);
+  interaction.t = hit_record.t;
+  const Affine_transform& normal_transformation =
+      transformation_.get_normal_transformation();
+  Vector3 local_intersection_point = ray_local.point_at(hit_record.t);
   Vector3 local_coordinates = local_intersection_point - center;
   Vector3 normal = local_coordinates.normalize();
   float u = -1;
   float v = -1;
   float perlin_value = -1;
+  interaction.has_uv_differentials = false;
   if (texture_id != -1) {
     get_uv(local_coordinates, u, v);
     const Texture& texture = scene_->textures[texture_id];
     if (texture.is_perlin_noise()) {
-      perlin_value =
-          texture.get_perlin_noise()->get_value_at(local_intersection_point);
       if (texture.is_bump()) {
-        normal = texture.bump_normal(normal, local_intersection_point);
+        normal = texture.bump_normal(normal, local_intersection_point,
+                                     perlin_value);
+      } else {
+        perlin_value =
+            texture.get_perlin_noise()->get_value_at(local_intersection_point);
       }
     } else {
+      if (ray_local.has_differentials) {
+        calculate_uv_differentials(ray_local, local_coordinates, normal, u, v,
+                                   interaction);
+      }
       if (texture.is_bump()) {
         // calculate gradient vectors
         float theta = M_PI * v;
@@ -92,14 +129,14 @@ bool Sphere::intersect(const Ray& ray, Hit_data& hit_data, bool culling) const {
       }
     }
   }
-  hit_data.u = u;
-  hit_data.v = v;
-  hit_data.perlin_value = perlin_value;
-  hit_data.normal = normal_transformation.multiply(normal, true).normalize();
+  interaction.u = u;
+  interaction.v = v;
+  interaction.perlin_value = perlin_value;
+  interaction.normal =
+      normal_transformation.transform_vector(normal).normalize();
 
-  hit_data.shape = this;
-  hit_data.is_light_object = false;
-  return true;
+  interaction.shape = this;
+  interaction.is_light_object = false;
 }
 
 void Sphere::get_uv(const Vector3& local_coordinates, float& u,
@@ -110,3 +147,36 @@ void Sphere::get_uv(const Vector3& local_coordinates, float& u,
   u = (M_PI - phi) / (2 * M_PI);
   v = theta / M_PI;
 }
+
+void Sphere::calculate_uv_differentials(
+    const Ray& ray_local, const Vector3& local_coordinates,
+    const Vector3& normal, float u, float v,
+    Surface_interaction& interaction) const {
+  // Offset rays are intersected with the tangent plane, their hit points are
+  // projected back to the sphere
+  const Vector3 point = center + local_coordinates;
+  const float dx_dot_n = ray_local.rx_d.dot(normal);
+  const float dy_dot_n = ray_local.ry_d.dot(normal);
+  if (dx_dot_n == 0.0f || dy_dot_n == 0.0f) {
+    return;
+  }
+  const Vector3 p_x =
+      ray_local.rx_o +
+      ray_local.rx_d * ((point - ray_local.rx_o).dot(normal) / dx_dot_n);
+  const Vector3 p_y =
+      ray_local.ry_o +
+      ray_local.ry_d * ((point - ray_local.ry_o).dot(normal) / dy_dot_n);
+  float u_x, v_x, u_y, v_y;
+  get_uv((p_x - center).normalize() * radius, u_x, v_x);
+  get_uv((p_y - center).normalize() * radius, u_y, v_y);
+  // u wraps around at the seam
+  float du_dx = u_x - u;
+  float du_dy = u_y - u;
+  du_dx -= std::round(du_dx);
+  du_dy -= std::round(du_dy);
+  interaction.du_dx = du_dx;
+  interaction.dv_dx = v_x - v;
+  interaction.du_dy = du_dy;
+  interaction.dv_dy = v_y - v;
+  interaction.has_uv_differentials = true;
+}
@@ -41,3 +41,31 @@ Vector3 Spot_light::incoming_radiance(const Vector3& from_point_to_light,
   }
   return Vector3();
 }
+
+int Spot_light::generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                                 std::mt19937& generator) const {
+  std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
+  Vector3 u, v;
+  orthonormal_basis(direction_, u, v);
+  // Uniform over the coverage cone
+  const float solid_angle = 2 * M_PI * (1.0f - cos_half_of_coverage_angle_);
+  for (int i = 0; i < count; i++) {
+    const float cos_theta =
+        1.0f - uniform_dist(generator) * (1.0f - cos_half_of_coverage_angle_);
+    const float sin_theta =
+        std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    const float phi = 2 * M_PI * uniform_dist(generator);
+    const Vector3 direction = direction_ * cos_theta +
+                              v * sin_theta * std::cos(phi) +
+                              u * sin_theta * std::sin(phi);
+    photon_rays[i] = Ray(position_, direction.normalize(), r_photon);
+    if (cos_theta > cos_half_of_falloff_angle_) {
+      fluxes[i] = intensity_ * solid_angle;
+    } else {
+      float c = (cos_theta - cos_half_of_coverage_angle_) /
+                (cos_half_of_falloff_angle_ - cos_half_of_coverage_angle_);
+      fluxes[i] = intensity_ * pow(c, 4) * solid_angle;
+    }
+  }
+  return count;
+}
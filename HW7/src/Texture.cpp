@@ -1,27 +1,21 @@
 #include "Texture.h"
-#define STB_IMAGE_IMPLEMENTATION
 #include <algorithm>
-#include "stb_image.h"
+#include <cmath>
 Texture::Texture(const std::string& image_name,
                  const std::string& interpolation_type,
                  const std::string& decal_mode, const std::string& appearance,
                  const float normalizer, const float scaling_factor,
                  const bool is_bump, const float bumpmap_multiplier,
-                 const bool is_degamma) {
-  int n;
+                 const bool is_degamma, Texture_cache* texture_cache)
+    : texture_cache_(texture_cache),
+      image_id_(-1),
+      width_(0),
+      height_(0),
+      level_count_(1) {
   if (image_name != std::string("perlin")) {
-    unsigned char* texture_image;
-    texture_image = stbi_load(image_name.c_str(), &width_, &height_, &n, 3);
-    int size = width_ * height_ * 3;
-    for (int i = 0; i < size; i++) {
-      if (is_degamma) {
-        texture_image_.push_back(std::pow(texture_image[i] / 255.0f, 2.2) *
-                                 255.0f);
-      } else {
-        texture_image_.push_back(texture_image[i]);
-      }
-    }
-    if (texture_image) stbi_image_free(texture_image);
+    image_id_ =
+        texture_cache_->add_image(image_name, is_degamma, width_, height_);
+    level_count_ = Texture_cache::get_level_count(width_, height_);
     perlin_noise_ = nullptr;
   } else {
     perlin_noise_ = new Perlin_noise(appearance, scaling_factor);
@@ -37,9 +31,11 @@ Texture::Texture(Texture&& rhs)
     : interpolation_type_(rhs.interpolation_type_),
       decal_mode_(rhs.decal_mode_),
       appearance_(rhs.appearance_),
-      texture_image_(rhs.texture_image_),
+      texture_cache_(rhs.texture_cache_),
+      image_id_(rhs.image_id_),
       width_(rhs.width_),
       height_(rhs.height_),
+      level_count_(rhs.level_count_),
       normalizer_(rhs.normalizer_),
       perlin_noise_(rhs.perlin_noise_),
       is_bump_(rhs.is_bump_),
@@ -64,49 +60,84 @@ Vector3 Texture::blend_color(const Vector3& texture_color,
   }
 }
 Vector3 Texture::get_color_at(float u, float v) const {
+  return get_color_at_level(0, u, v);
+}
+
+Vector3 Texture::get_color_at(float u, float v, float du_dx, float dv_dx,
+                              float du_dy, float dv_dy) const {
+  // Level is chosen by the longer side of the pixel footprint in texels and
+  // the two nearest levels are blended
+  const float ds_dx = du_dx * width_;
+  const float dt_dx = dv_dx * height_;
+  const float ds_dy = du_dy * width_;
+  const float dt_dy = dv_dy * height_;
+  const float footprint = std::max(ds_dx * ds_dx + dt_dx * dt_dx,
+                                   ds_dy * ds_dy + dt_dy * dt_dy);
+  // Half of log2 of the squared footprint
+  const float level = 0.5f * std::log2(std::max(footprint, 1e-16f));
+  if (level <= 0.0f) {
+    return get_color_at_level(0, u, v);
+  }
+  if (level >= level_count_ - 1) {
+    return get_color_at_level(level_count_ - 1, u, v);
+  }
+  if (interpolation_type_ == it_nearest) {
+    return get_color_at_level((int)(level + 0.5f), u, v);
+  }
+  const int lower_level = (int)level;
+  const float delta = level - lower_level;
+  return get_color_at_level(lower_level, u, v) * (1.0f - delta) +
+         get_color_at_level(lower_level + 1, u, v) * delta;
+}
+
+void Texture::to_texel_coordinates(int width, int height, float& u,
+                                   float& v) const {
   if (appearance_ == a_clamp) {
     u = std::max(0.0f, std::min(1.0f, u));
     v = std::max(0.0f, std::min(1.0f, v));
   } else {
-    u = std::max(0.0f, std::min(1.0f, u - floor(u)));
-    v = std::max(0.0f, std::min(1.0f, v - floor(v)));
+    u = std::max(0.0f, std::min(1.0f, u - std::floor(u)));
+    v = std::max(0.0f, std::min(1.0f, v - std::floor(v)));
   }
-  u *= width_;
-  if (u >= width_) u--;
-  v *= height_;
-  if (v >= height_) v--;
+  u *= width;
+  if (u >= width) u--;
+  v *= height;
+  if (v >= height) v--;
+}
+
+Vector3 Texture::get_color_at_level(int level, float u, float v) const {
+  const int width = std::max(1, width_ >> level);
+  const int height = std::max(1, height_ >> level);
+  to_texel_coordinates(width, height, u, v);
   Vector3 color;
   if (interpolation_type_ == it_nearest) {
-    unsigned int coord = 3 * width_ * (unsigned int)v + 3 * (unsigned int)u;
-    color.x = texture_image_[coord];
-    color.y = texture_image_[coord + 1];
-    color.z = texture_image_[coord + 2];
+    color = get_texel(level, (unsigned int)u, (unsigned int)v);
   } else {
     if (appearance_ == a_repeat) {
-      const unsigned int p = ((unsigned int)u) % width_;
-      const unsigned int pn = (p + 1) % width_;
-      const unsigned int q = ((unsigned int)v) % height_;
-      const unsigned int qn = (q + 1) % height_;
+      const unsigned int p = ((unsigned int)u) % width;
+      const unsigned int pn = (p + 1) % width;
+      const unsigned int q = ((unsigned int)v) % height;
+      const unsigned int qn = (q + 1) % height;
       const float dx = u - p;
       const float dy = v - q;
-      const int c_p_q = 3 * (width_ * q + p);
-      const int c_pn_q = 3 * (width_ * q + pn);
-      const int c_p_qn = 3 * (width_ * qn + p);
-      const int c_pn_qn = 3 * (width_ * qn + pn);
-      color.x = texture_image_[c_p_q] * (1 - dx) * (1 - dy);
-      color.x += texture_image_[c_pn_q] * (dx) * (1 - dy);
-      color.x += texture_image_[c_pn_qn] * (dx) * (dy);
-      color.x += texture_image_[c_p_qn] * (1 - dx) * (dy);
+      const Vector3 c_p_q = get_texel(level, p, q);
+      const Vector3 c_pn_q = get_texel(level, pn, q);
+      const Vector3 c_p_qn = get_texel(level, p, qn);
+      const Vector3 c_pn_qn = get_texel(level, pn, qn);
+      color.x = c_p_q.x * (1 - dx) * (1 - dy);
+      color.x += c_pn_q.x * (dx) * (1 - dy);
+      color.x += c_pn_qn.x * (dx) * (dy);
+      color.x += c_p_qn.x * (1 - dx) * (dy);
 
-      color.y = texture_image_[c_p_q + 1] * (1 - dx) * (1 - dy);
-      color.y += texture_image_[c_pn_q + 1] * (dx) * (1 - dy);
-      color.y += texture_image_[c_pn_qn + 1] * (dx) * (dy);
-      color.y += texture_image_[c_p_qn + 1] * (1 - dx) * (dy);
+      color.y = c_p_q.y * (1 - dx) * (1 - dy);
+      color.y += c_pn_q.y * (dx) * (1 - dy);
+      color.y += c_pn_qn.y * (dx) * (dy);
+      color.y += c_p_qn.y * (1 - dx) * (dy);
 
-      color.z = texture_image_[c_p_q + 2] * (1 - dx) * (1 - dy);
-      color.z += texture_image_[c_pn_q + 2] * (dx) * (1 - dy);
-      color.z += texture_image_[c_pn_qn + 2] * (dx) * (dy);
-      color.z += texture_image_[c_p_qn + 2] * (1 - dx) * (dy);
+      color.z = c_p_q.z * (1 - dx) * (1 - dy);
+      color.z += c_pn_q.z * (dx) * (1 - dy);
+      color.z += c_pn_qn.z * (dx) * (dy);
+      color.z += c_p_qn.z * (1 - dx) * (dy);
     } else {
       const unsigned int p = u;
       const unsigned int pn = p + 1;
@@ -114,27 +145,15 @@ Vector3 Texture::get_color_at(float u, float v) const {
       const unsigned int qn = v + 1;
       const float dx = u - p;
       const float dy = v - q;
-      const int c_p_q = 3 * (width_ * q + p);
-      const int c_pn_q = 3 * (width_ * q + pn);
-      const int c_p_qn = 3 * (width_ * qn + p);
-      const int c_pn_qn = 3 * (width_ * qn + pn);
-      color.x = texture_image_[c_p_q] * (1 - dx) * (1 - dy);
-      color.y = texture_image_[c_p_q + 1] * (1 - dx) * (1 - dy);
-      color.z = texture_image_[c_p_q + 2] * (1 - dx) * (1 - dy);
-      if (pn < width_) {
-        color.x += texture_image_[c_pn_q] * (dx) * (1 - dy);
-        color.y += texture_image_[c_pn_q + 1] * (dx) * (1 - dy);
-        color.z += texture_image_[c_pn_q + 2] * (dx) * (1 - dy);
+      color = get_texel(level, p, q) * ((1 - dx) * (1 - dy));
+      if (pn < (unsigned int)width) {
+        color += get_texel(level, pn, q) * ((dx) * (1 - dy));
       }
-      if (qn < height_) {
-        color.x += texture_image_[c_pn_qn] * (dx) * (dy);
-        color.y += texture_image_[c_pn_qn + 1] * (dx) * (dy);
-        color.z += texture_image_[c_pn_qn + 2] * (dx) * (dy);
+      if (qn < (unsigned int)height) {
+        color += get_texel(level, p, qn) * ((1 - dx) * (dy));
       }
-      if (pn < width_ && qn < height_) {
-        color.x += texture_image_[c_p_qn] * (1 - dx) * (dy);
-        color.y += texture_image_[c_p_qn + 1] * (1 - dx) * (dy);
-        color.z += texture_image_[c_p_qn + 2] * (1 - dx) * (dy);
+      if (pn < (unsigned int)width && qn < (unsigned int)height) {
+        color += get_texel(level, pn, qn) * ((dx) * (dy));
       }
     }
   }
@@ -142,23 +161,12 @@ Vector3 Texture::get_color_at(float u, float v) const {
   return color;
 }
 
-Vector3 Texture::bump_normal(const Vector3& normal,
-                             const Vector3& position) const {
-  const float perlin_value = perlin_noise_->get_value_at(position);
-  const float epsilon = 0.001;
-  const float dd_dx =
-      (perlin_noise_->get_value_at(position + Vector3(epsilon, 0, 0)) -
-       perlin_value) /
-      epsilon;
-  const float dd_dy =
-      (perlin_noise_->get_value_at(position + Vector3(0, epsilon, 0)) -
-       perlin_value) /
-      epsilon;
-  const float dd_dz =
-      (perlin_noise_->get_value_at(position + Vector3(0, 0, epsilon)) -
-       perlin_value) /
-      epsilon;
-  Vector3 g = bumpmap_multiplier_ * Vector3(dd_dx, dd_dy, dd_dz);
+Vector3 Texture::bump_normal(const Vector3& normal, const Vector3& position,
+                             float& perlin_value_out) const {
+  Vector3 gradient;
+  perlin_value_out =
+      perlin_noise_->get_value_and_gradient_at(position, gradient);
+  Vector3 g = bumpmap_multiplier_ * gradient;
   Vector3 g_ii = normal * (g.dot(normal));
   Vector3 surface_g = g - g_ii;
   return normal - surface_g;
@@ -167,16 +175,41 @@ Vector3 Texture::bump_normal(const Vector3& normal,
 Vector3 Texture::bump_normal(const Vector3& dp_du, const Vector3& dp_dv,
                              const Vector3& normal, const float u,
                              const float v) const {
-  const Vector3 color_u_v = get_color_at(u, v);
-  const Vector3 color_un_v = get_color_at(u + 1.0f / width_, v);
-  const Vector3 color_u_vn = get_color_at(u, v + 1.0f / height_);
-  const float value_u_v = (color_u_v.x + color_u_v.y + color_u_v.z) / 3.0f;
-  const float value_un_v = (color_un_v.x + color_un_v.y + color_un_v.z) / 3.0f;
-  const float value_u_vn = (color_u_vn.x + color_u_vn.y + color_u_vn.z) / 3.0f;
-
-  const float dd_du = (value_un_v - value_u_v) * bumpmap_multiplier_;
-  const float dd_dv = (value_u_vn - value_u_v) * bumpmap_multiplier_;
+  float dd_du, dd_dv;
+  get_height_gradient(u, v, dd_du, dd_dv);
+  dd_du *= bumpmap_multiplier_;
+  dd_dv *= bumpmap_multiplier_;
   const Vector3 dq_du = dp_du + dd_du * normal;
   const Vector3 dq_dv = dp_dv + dd_dv * normal;
   return dq_dv.cross(dq_du).normalize();
 }
+
+void Texture::get_height_gradient(float u, float v, float& dd_du,
+                                  float& dd_dv) const {
+  to_texel_coordinates(width_, height_, u, v);
+  const int p = (int)u;
+  const int q = (int)v;
+  int pn = p + 1;
+  int qn = q + 1;
+  if (appearance_ == a_repeat) {
+    pn %= width_;
+    qn %= height_;
+  } else {
+    pn = std::min(pn, width_ - 1);
+    qn = std::min(qn, height_ - 1);
+  }
+  const float h_p_q = get_height(p, q);
+  const float h_pn_q = get_height(pn, q);
+  const float h_p_qn = get_height(p, qn);
+  if (interpolation_type_ == it_nearest) {
+    dd_du = h_pn_q - h_p_q;
+    dd_dv = h_p_qn - h_p_q;
+    return;
+  }
+  // Derivatives of the bilinear interpolation inside the cell
+  const float h_pn_qn = get_height(pn, qn);
+  const float dx = u - p;
+  const float dy = v - q;
+  dd_du = (h_pn_q - h_p_q) * (1 - dy) + (h_pn_qn - h_p_qn) * dy;
+  dd_dv = (h_p_qn - h_p_q) * (1 - dx) + (h_pn_qn - h_pn_q) * dx;
+}
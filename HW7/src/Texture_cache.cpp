@@ -0,0 +1,329 @@
+#include "Texture_cache.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "Quantization.h"
+#include "stb_image.h"
+// Number of recently used tiles every thread keeps without locking
+#define TEXTURE_CACHE_THREAD_SLOTS 8
+// Level in the key of the whole pyramid of an image, above any real level
+#define TEXTURE_CACHE_PYRAMID_LEVEL 31
+
+namespace {
+std::atomic<int> next_cache_id(0);
+
+struct Tile_slot {
+  int cache_id = -1;
+  uint64_t key = 0;
+  std::shared_ptr<const void> tile;
+  // First texel of the tile and texels per row, a tile read from a pyramid
+  // has the rows of its level
+  const unsigned char* ldr_texels = nullptr;
+  const uint16_t* hdr_texels = nullptr;
+  int row_texels = TEXTURE_TILE_SIZE;
+  const float* ldr_lut = nullptr;
+  bool is_hdr = false;
+};
+
+// Nearest 8 bit channel to value, inverse of the increasing channel table
+unsigned char encode_ldr(float value, const float* ldr_lut) {
+  const float* upper = std::lower_bound(ldr_lut, ldr_lut + 256, value);
+  if (upper == ldr_lut) {
+    return 0;
+  }
+  if (upper == ldr_lut + 256) {
+    return 255;
+  }
+  const bool is_lower_nearer = value - upper[-1] < *upper - value;
+  return (unsigned char)(upper - ldr_lut - (is_lower_nearer ? 1 : 0));
+}
+}  // namespace
+
+Texture_cache::Texture_cache()
+    : budget_bytes_((size_t)TEXTURE_CACHE_DEFAULT_BUDGET_MB << 20),
+      used_bytes_(0),
+      cache_id_(next_cache_id++) {}
+
+void Texture_cache::set_budget(size_t budget_bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  budget_bytes_ = budget_bytes;
+}
+
+int Texture_cache::add_image(const std::string& image_name, bool is_degamma,
+                             int& width, int& height) {
+  int channels;
+  if (!stbi_info(image_name.c_str(), &width, &height, &channels)) {
+    throw std::runtime_error("Error: Texture image " + image_name +
+                             " cannot be read.");
+  }
+  Image image;
+  image.image_name = image_name;
+  image.is_hdr = stbi_is_hdr(image_name.c_str());
+  // Degamma is done once per channel value instead of once per texel
+  for (int i = 0; i < 256; i++) {
+    if (is_degamma) {
+      image.ldr_lut[i] = std::pow(i / 255.0f, 2.2) * 255.0f;
+    } else {
+      image.ldr_lut[i] = i;
+    }
+  }
+  image.width = width;
+  image.height = height;
+  image.level_count = get_level_count(width, height);
+  image.level_offsets.push_back(0);
+  for (int level = 0; level < image.level_count; level++) {
+    image.level_offsets.push_back(image.level_offsets.back() +
+                                  4 * (size_t)std::max(1, width >> level) *
+                                      std::max(1, height >> level));
+  }
+  image.decode_mutex.reset(new std::mutex());
+  images_.push_back(std::move(image));
+  return (int)images_.size() - 1;
+}
+
+Vector3 Texture_cache::get_texel(int image_id, int level, int x, int y) {
+  const int tile_x = x / TEXTURE_TILE_SIZE;
+  const int tile_y = y / TEXTURE_TILE_SIZE;
+  const uint64_t key = tile_key(image_id, level, tile_x, tile_y);
+  // Slots keep their tiles alive even after they are dropped from the cache
+  thread_local static Tile_slot slots[TEXTURE_CACHE_THREAD_SLOTS];
+  Tile_slot& slot = slots[(tile_x + 7 * tile_y + 5 * level + 13 * image_id) %
+                          TEXTURE_CACHE_THREAD_SLOTS];
+  if (slot.cache_id != cache_id_ || slot.key != key) {
+    const Image& image = images_[image_id];
+    std::shared_ptr<const Tile> tile =
+        find_tile(tile_key(image_id, TEXTURE_CACHE_PYRAMID_LEVEL, 0, 0));
+    if (!tile) {
+      tile = find_tile(key);
+    }
+    if (!tile) {
+      tile = load_tile(image_id, level, tile_x, tile_y);
+    }
+    size_t first_channel = 0;
+    slot.row_texels = TEXTURE_TILE_SIZE;
+    if (tile->is_pyramid) {
+      slot.row_texels = std::max(1, image.width >> level);
+      first_channel = image.level_offsets[level] +
+                      4 * TEXTURE_TILE_SIZE *
+                          ((size_t)tile_y * slot.row_texels + tile_x);
+    }
+    slot.cache_id = cache_id_;
+    slot.key = key;
+    slot.ldr_texels =
+        image.is_hdr ? nullptr : tile->ldr_texels.data() + first_channel;
+    slot.hdr_texels =
+        image.is_hdr ? tile->hdr_texels.data() + first_channel : nullptr;
+    slot.ldr_lut = image.ldr_lut;
+    slot.is_hdr = image.is_hdr;
+    slot.tile = tile;
+  }
+  const int index = 4 * ((y % TEXTURE_TILE_SIZE) * slot.row_texels +
+                         x % TEXTURE_TILE_SIZE);
+  if (!slot.is_hdr) {
+    const unsigned char* texel = slot.ldr_texels + index;
+    return Vector3(slot.ldr_lut[texel[0]], slot.ldr_lut[texel[1]],
+                   slot.ldr_lut[texel[2]]);
+  }
+  // Hdr values are scaled to the range of the 8 bit channels
+  const uint16_t* texel = slot.hdr_texels + index;
+  return Vector3(half_to_float(texel[0]), half_to_float(texel[1]),
+                 half_to_float(texel[2])) *
+         255.0f;
+}
+
+std::shared_ptr<const Texture_cache::Tile> Texture_cache::find_tile(
+    uint64_t key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = tiles_.find(key);
+  if (it == tiles_.end()) {
+    return nullptr;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+  return it->second.tile;
+}
+
+std::shared_ptr<const Texture_cache::Tile> Texture_cache::load_tile(
+    int image_id, int level, int tile_x, int tile_y) {
+  const Image& image = images_[image_id];
+  const uint64_t key = tile_key(image_id, level, tile_x, tile_y);
+  std::lock_guard<std::mutex> decode_lock(*image.decode_mutex);
+  // Another thread may have loaded the pyramid or the tile while this one
+  // was waiting
+  const uint64_t pyramid_key =
+      tile_key(image_id, TEXTURE_CACHE_PYRAMID_LEVEL, 0, 0);
+  std::shared_ptr<const Tile> loaded_tile = find_tile(pyramid_key);
+  if (!loaded_tile) {
+    loaded_tile = find_tile(key);
+  }
+  if (loaded_tile) {
+    return loaded_tile;
+  }
+  std::shared_ptr<Tile> pyramid = build_pyramid(image);
+  const size_t pyramid_bytes =
+      image.level_offsets.back() / 4 * texel_bytes(image.is_hdr);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pyramid_bytes <= budget_bytes_) {
+      pyramid->is_pyramid = true;
+      insert_tile(pyramid_key, pyramid, pyramid_bytes);
+      return pyramid;
+    }
+  }
+  const size_t bytes = tile_bytes(image.is_hdr);
+  // A pyramid larger than the budget is built again on every miss, so the
+  // missing tiles of every level are cut from it as long as they fit,
+  // smallest levels first
+  for (int tile_level = image.level_count - 1; tile_level >= 0;
+       tile_level--) {
+    const int level_width = std::max(1, image.width >> tile_level);
+    const int level_height = std::max(1, image.height >> tile_level);
+    const int tile_count_x =
+        (level_width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    const int tile_count_y =
+        (level_height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+    for (int y = 0; y < tile_count_y; y++) {
+      for (int x = 0; x < tile_count_x; x++) {
+        const uint64_t tile_key_xy = tile_key(image_id, tile_level, x, y);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (tile_key_xy == key || tiles_.count(tile_key_xy) ||
+              used_bytes_ + bytes > budget_bytes_) {
+            continue;
+          }
+        }
+        std::shared_ptr<const Tile> tile =
+            cut_tile(image, *pyramid, tile_level, x, y);
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert_tile(tile_key_xy, tile, bytes);
+      }
+    }
+  }
+  std::shared_ptr<const Tile> requested_tile =
+      cut_tile(image, *pyramid, level, tile_x, tile_y);
+  // Requested tile is added last so that it is the most recently used one
+  std::lock_guard<std::mutex> lock(mutex_);
+  insert_tile(key, requested_tile, bytes);
+  return requested_tile;
+}
+
+std::shared_ptr<Texture_cache::Tile> Texture_cache::build_pyramid(
+    const Image& image) {
+  std::shared_ptr<Tile> pyramid = std::make_shared<Tile>();
+  const size_t channel_count = image.level_offsets.back();
+  int width, height, channels;
+  if (image.is_hdr) {
+    float* pixels =
+        stbi_loadf(image.image_name.c_str(), &width, &height, &channels, 4);
+    if (pixels && width == image.width && height == image.height) {
+      pyramid->hdr_texels.resize(channel_count);
+      for (size_t i = 0; i < image.level_offsets[1]; i++) {
+        pyramid->hdr_texels[i] = float_to_half(pixels[i]);
+      }
+    }
+    if (pixels) stbi_image_free(pixels);
+  } else {
+    unsigned char* pixels =
+        stbi_load(image.image_name.c_str(), &width, &height, &channels, 4);
+    if (pixels && width == image.width && height == image.height) {
+      pyramid->ldr_texels.resize(channel_count);
+      std::memcpy(pyramid->ldr_texels.data(), pixels, image.level_offsets[1]);
+    }
+    if (pixels) stbi_image_free(pixels);
+  }
+  if (pyramid->ldr_texels.empty() && pyramid->hdr_texels.empty()) {
+    throw std::runtime_error("Error: Texture image " + image.image_name +
+                             " cannot be decoded.");
+  }
+  // Levels above the image are box filtered from the level below. Values are
+  // averaged after the channel table, so degamma images do not darken.
+  auto value = [&](size_t index) -> float {
+    if (image.is_hdr) {
+      return half_to_float(pyramid->hdr_texels[index]);
+    }
+    const unsigned char channel = pyramid->ldr_texels[index];
+    return index % 4 == 3 ? channel : image.ldr_lut[channel];
+  };
+  for (int level = 1; level < image.level_count; level++) {
+    const int level_width = std::max(1, image.width >> level);
+    const int level_height = std::max(1, image.height >> level);
+    const int below_width = std::max(1, image.width >> (level - 1));
+    const int below_height = std::max(1, image.height >> (level - 1));
+    const size_t offset = image.level_offsets[level];
+    const size_t below = image.level_offsets[level - 1];
+    for (int y = 0; y < level_height; y++) {
+      const size_t row_0 = (size_t)std::min(2 * y, below_height - 1);
+      const size_t row_1 = (size_t)std::min(2 * y + 1, below_height - 1);
+      for (int x = 0; x < level_width; x++) {
+        const int x_0 = std::min(2 * x, below_width - 1);
+        const int x_1 = std::min(2 * x + 1, below_width - 1);
+        for (int c = 0; c < 4; c++) {
+          const float average =
+              0.25f * (value(below + 4 * (row_0 * below_width + x_0) + c) +
+                       value(below + 4 * (row_0 * below_width + x_1) + c) +
+                       value(below + 4 * (row_1 * below_width + x_0) + c) +
+                       value(below + 4 * (row_1 * below_width + x_1) + c));
+          const size_t index = offset + 4 * ((size_t)y * level_width + x) + c;
+          if (image.is_hdr) {
+            pyramid->hdr_texels[index] = float_to_half(average);
+          } else {
+            pyramid->ldr_texels[index] =
+                c == 3 ? (unsigned char)(average + 0.5f)
+                       : encode_ldr(average, image.ldr_lut);
+          }
+        }
+      }
+    }
+  }
+  return pyramid;
+}
+
+std::shared_ptr<const Texture_cache::Tile> Texture_cache::cut_tile(
+    const Image& image, const Tile& pyramid, int level, int tile_x,
+    int tile_y) {
+  std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+  const int texel_count = TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+  if (image.is_hdr) {
+    tile->hdr_texels.resize(4 * texel_count, 0);
+  } else {
+    tile->ldr_texels.resize(4 * texel_count, 0);
+  }
+  const int level_width = std::max(1, image.width >> level);
+  const int level_height = std::max(1, image.height >> level);
+  const int start_x = tile_x * TEXTURE_TILE_SIZE;
+  const int end_x = std::min(level_width, start_x + TEXTURE_TILE_SIZE);
+  const int end_y = std::min(level_height, (tile_y + 1) * TEXTURE_TILE_SIZE);
+  const int channel_count = 4 * (end_x - start_x);
+  for (int y = tile_y * TEXTURE_TILE_SIZE; y < end_y; y++) {
+    const int row = 4 * (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE;
+    const size_t pixel =
+        image.level_offsets[level] + 4 * ((size_t)y * level_width + start_x);
+    if (image.is_hdr) {
+      std::memcpy(&tile->hdr_texels[row], &pyramid.hdr_texels[pixel],
+                  channel_count * sizeof(uint16_t));
+    } else {
+      std::memcpy(&tile->ldr_texels[row], &pyramid.ldr_texels[pixel],
+                  channel_count);
+    }
+  }
+  return tile;
+}
+
+void Texture_cache::insert_tile(uint64_t key,
+                                const std::shared_ptr<const Tile>& tile,
+                                size_t bytes) {
+  if (tiles_.count(key)) {
+    return;
+  }
+  while (!lru_.empty() && used_bytes_ + bytes > budget_bytes_) {
+    auto it = tiles_.find(lru_.back());
+    used_bytes_ -= it->second.bytes;
+    tiles_.erase(it);
+    lru_.pop_back();
+  }
+  lru_.push_front(key);
+  tiles_[key] = Cached_tile{tile, bytes, lru_.begin()};
+  used_bytes_ += bytes;
+}
@@ -2,32 +2,40 @@
 #include <cmath>
 #include "Vector3.h"
 
+void Transformation::set_transformation(
+    const Matrix4x4& transformation, const Matrix4x4& inverse_transformation) {
+  transformation_ = Affine_transform(transformation);
+  inverse_transformation_ = Affine_transform(inverse_transformation);
+  normal_transformation_ = inverse_transformation_.transpose_linear();
+}
+
 // Scaling
 Scaling::Scaling(float x, float y, float z) {
-  transformation_[0][0] = x;
-  transformation_[1][1] = y;
-  transformation_[2][2] = z;
-  transformation_[3][3] = 1.0f;
-  inverse_transformation_[0][0] = 1.0f / x;
-  inverse_transformation_[1][1] = 1.0f / y;
-  inverse_transformation_[2][2] = 1.0f / z;
-  inverse_transformation_[3][3] = 1.0f;
-
-  normal_transformation_ = inverse_transformation_.transpose();
+  Matrix4x4 transformation;
+  transformation[0][0] = x;
+  transformation[1][1] = y;
+  transformation[2][2] = z;
+  transformation[3][3] = 1.0f;
+  Matrix4x4 inverse_transformation;
+  inverse_transformation[0][0] = 1.0f / x;
+  inverse_transformation[1][1] = 1.0f / y;
+  inverse_transformation[2][2] = 1.0f / z;
+  inverse_transformation[3][3] = 1.0f;
+  set_transformation(transformation, inverse_transformation);
 }
 //
 
 // Translation
 Translation::Translation(float x, float y, float z) {
-  transformation_.make_identity();
-  transformation_[0][3] = x;
-  transformation_[1][3] = y;
-  transformation_[2][3] = z;
-  inverse_transformation_.make_identity();
-  inverse_transformation_[0][3] = -x;
-  inverse_transformation_[1][3] = -y;
-  inverse_transformation_[2][3] = -z;
-  normal_transformation_ = inverse_transformation_.transpose();
+  Matrix4x4 transformation(true);
+  transformation[0][3] = x;
+  transformation[1][3] = y;
+  transformation[2][3] = z;
+  Matrix4x4 inverse_transformation(true);
+  inverse_transformation[0][3] = -x;
+  inverse_transformation[1][3] = -y;
+  inverse_transformation[2][3] = -z;
+  set_transformation(transformation, inverse_transformation);
 }
 //
 
@@ -66,20 +74,19 @@ Rotation::Rotation(float angle, float x, float y, float z) {
   inv_rot[2][2] = inv_rot[1][1];
   inv_rot[3][3] = 1.0f;
   Matrix4x4 m_transpose = m.transpose();
-  transformation_ = m_transpose * (rot * m);
-  inverse_transformation_ = m_transpose * (inv_rot * m);
-
-  normal_transformation_ = inverse_transformation_.transpose();
+  set_transformation(m_transpose * (rot * m), m_transpose * (inv_rot * m));
 }
 //
 
 // ArbitraryTransformation
 Arbitrary_transformation::Arbitrary_transformation(
     const Matrix4x4& transformation_matrix) {
-  transformation_ = transformation_matrix;
-  if (!(transformation_matrix.invert_matrix(inverse_transformation_))) {
+  transformation_ = Affine_transform(transformation_matrix);
+  // Transformations are composed of scalings, translations and rotations,
+  // so the closed form affine inverse is enough
+  if (!(transformation_.invert(inverse_transformation_))) {
     std::cerr << "NOT INVERTIBLE MATRIX!" << std::endl;
     exit(-1);
   }
-  normal_transformation_ = inverse_transformation_.transpose();
+  normal_transformation_ = inverse_transformation_.transpose_linear();
 }
@@ -1,6 +1,5 @@
 #include "Triangle.h"
 #include <algorithm>
-#include "Hit_data.h"
 #include "Scene.h"
 Triangle::Triangle(const Scene* scene, int index_0, int index_1, int index_2,
                    int offset, int material_id, int texture_id,
@@ -13,16 +12,13 @@ Triangle::Triangle(const Scene* scene, int index_0, int index_1, int index_2,
       texture_id(texture_id),
       transformation_(transformation),
       scene_(scene) {
-  const Vector3& v_0 =
-      scene_->get_vertex_at(index_0 + offset).get_vertex_position();
-  const Vector3& v_1 =
-      scene_->get_vertex_at(index_1 + offset).get_vertex_position();
-  const Vector3& v_2 =
-      scene_->get_vertex_at(index_2 + offset).get_vertex_position();
+  const Vector3& v_0 = scene_->get_vertex_position(index_0 + offset);
+  const Vector3& v_1 = scene_->get_vertex_position(index_1 + offset);
+  const Vector3& v_2 = scene_->get_vertex_position(index_2 + offset);
   normal = (v_1 - v_0).cross(v_2 - v_0).normalize();
   Vector3 min_c = v_0;
   Vector3 max_c = v_0;
-  is_identity_ = transformation_.get_transformation_matrix().is_identity();
+  is_identity_ = transformation_.get_transformation().is_identity();
   min_c.x = std::min(min_c.x, v_1.x);
   min_c.y = std::min(min_c.y, v_1.y);
   min_c.z = std::min(min_c.z, v_1.z);
@@ -46,22 +42,16 @@ Triangle::Triangle(const Scene* scene, int index_0, int index_1, int index_2,
   }
 }
 float Triangle::get_surface_area() const {
-  const Vector3& v_0 =
-      scene_->get_vertex_at(index_0 + offset).get_vertex_position();
-  const Vector3& v_1 =
-      scene_->get_vertex_at(index_1 + offset).get_vertex_position();
-  const Vector3& v_2 =
-      scene_->get_vertex_at(index_2 + offset).get_vertex_position();
+  const Vector3& v_0 = scene_->get_vertex_position(index_0 + offset);
+  const Vector3& v_1 = scene_->get_vertex_position(index_1 + offset);
+  const Vector3& v_2 = scene_->get_vertex_position(index_2 + offset);
   return (v_1 - v_0).cross(v_2 - v_0).length() / 2;
 }
-bool Triangle::intersect(const Ray& ray, Hit_data& hit_data,
+bool Triangle::intersect(const Ray& ray, Hit_record& hit_record,
                          bool culling) const {
-  const Vector3& v_0 =
-      scene_->get_vertex_at(index_0 + offset).get_vertex_position();
-  const Vector3& v_1 =
-      scene_->get_vertex_at(index_1 + offset).get_vertex_position();
-  const Vector3& v_2 =
-      scene_->get_vertex_at(index_2 + offset).get_vertex_position();
+  const Vector3& v_0 = scene_->get_vertex_position(index_0 + offset);
+  const Vector3& v_1 = scene_->get_vertex_position(index_1 + offset);
+  const Vector3& v_2 = scene_->get_vertex_position(index_2 + offset);
   const Vector3 a_col1 = v_0 - v_1;
   const Vector3 a_col2 = v_0 - v_2;
 
@@ -82,19 +72,20 @@ bool Triangle::intersect(const Ray& ray, Hit_data& hit_data,
       return false;
     }
     const float t = determinant(a_col1, a_col2, b);
-    if (t > 0.0f) {
-      hit_data.t = t;
-      hit_data.shape = this;
-      hit_data.normal = this->normal;
-      hit_data.is_light_object = false;
+    if (t > 0.0f && t < hit_record.t) {
+      hit_record.t = t;
+      hit_record.shape = this;
+      hit_record.primitive = -1;
+      hit_record.beta = beta;
+      hit_record.gamma = gamma;
       return true;
     }
     return false;
   } else {
-    const Matrix4x4& inverse_transformation =
-        transformation_.get_inverse_transformation_matrix();
-    const Ray ray_local(inverse_transformation.multiply(ray.o),
-                        inverse_transformation.multiply(ray.d, true),
+    const Affine_transform& inverse_transformation =
+        transformation_.get_inverse_transformation();
+    const Ray ray_local(inverse_transformation.transform_point(ray.o),
+                        inverse_transformation.transform_vector(ray.d),
                         ray.ray_type);
     const Vector3& a_col3 = ray_local.d;
     if (culling && a_col3.dot(normal) > 0) {
@@ -112,18 +103,32 @@ bool Triangle::intersect(const Ray& ray, Hit_data& hit_data,
       return false;
     }
     const float t = determinant(a_col1, a_col2, b);
-    if (t > 0.0f) {
-      hit_data.t = t;
-      hit_data.shape = this;
-      const Matrix4x4& normal_transformation =
-          transformation_.get_normal_transformation_matrix();
-      // TODO: Check if it is precomputable?
-      hit_data.normal =
-          normal_transformation.multiply(this->normal, true).normalize();
-      hit_data.is_light_object = false;
+    if (t > 0.0f && t < hit_record.t) {
+      hit_record.t = t;
+      hit_record.shape = this;
+      hit_record.primitive = -1;
+      hit_record.beta = beta;
+      hit_record.gamma = gamma;
       return true;
     }
-    // TODO ADD Texture support for primitive triangles
     return false;
   }
 }
+
+void Triangle::get_surface_interaction(const Ray&,
+                                       const Hit_record& hit_record,
+                                       Surface_interaction& interaction) const {
+  interaction.t = hit_record.t;
+  interaction.shape = this;
+  if (is_identity_) {
+    interaction.normal = this->normal;
+  } else {
+    const Affine_transform& normal_transformation =
+        transformation_.get_normal_transformation();
+    // TODO: Check if it is precomputable?
+    interaction.normal =
+        normal_transformation.transform_vector(this->normal).normalize();
+  }
+  // TODO ADD Texture support for primitive triangles
+  interaction.is_light_object = false;
+}
@@ -0,0 +1,810 @@
+#include "Triangle_mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Float8.h"
+#include "Scene.h"
+// Ranges with at most this many triangles become leaves. Leaf children of a
+// Wide_node keep their count in 3 bits and their start in 5 bits, so it
+// must stay at most 4.
+#define TRIANGLE_MESH_MAX_LEAF_SIZE 4
+// Size of the traversal stack. Nodes deeper than TRIANGLE_MESH_BALANCED_DEPTH
+// are split at the median, so the depth stays below it.
+#define TRIANGLE_MESH_MAX_DEPTH 64
+#define TRIANGLE_MESH_BALANCED_DEPTH 32
+// A wide node is never deeper than its binary node, so internal wide nodes
+// are at most TRIANGLE_MESH_MAX_DEPTH - 2 deep. A node pushes up to 8
+// children and is popped before its children are, so the stack holds at most
+// 7 entries for each node above the current one plus 8 for the current one,
+// 7 * (TRIANGLE_MESH_MAX_DEPTH - 2) + 8 in total.
+#define TRIANGLE_MESH_WIDE_STACK_SIZE (7 * TRIANGLE_MESH_MAX_DEPTH)
+
+namespace {
+struct Stack_entry {
+  int node;
+  float t_entry;
+};
+
+// Clips [0, max_t] to the node. Axes parallel to the ray are skipped like
+// in Bounding_box::intersect.
+inline bool intersect_node(const Triangle_mesh::Node& node,
+                           const Vector3& origin,
+                           const Vector3& inverse_direction,
+                           const bool* is_parallel, float max_t,
+                           float& t_entry) {
+  float t_min = 0.0f;
+  float t_max = max_t;
+  for (int i = 0; i < 3; i++) {
+    if (is_parallel[i]) continue;
+    float t_0 = (node.min_corner[i] - origin[i]) * inverse_direction[i];
+    float t_1 = (node.max_corner[i] - origin[i]) * inverse_direction[i];
+    if (t_0 > t_1) std::swap(t_0, t_1);
+    t_min = std::max(t_min, t_0);
+    t_max = std::min(t_max, t_1);
+  }
+  t_entry = t_min;
+  return t_min <= t_max;
+}
+
+// 2^(exponent - 127), cells are powers of two so that q * cell size is exact
+// and decoding a coordinate rounds only once
+inline float get_cell_size(uint8_t exponent) {
+  const uint32_t bits = (uint32_t)exponent << 23;
+  float cell_size;
+  std::memcpy(&cell_size, &bits, sizeof(cell_size));
+  return cell_size;
+}
+
+inline float decode(float origin, int quantized, float cell_size) {
+  return origin + (float)quantized * cell_size;
+}
+
+// Clips [0, max_t] to the decoded child boxes of the node. Returns the
+// entry distances, bit i of hit_mask is set when child i is hit.
+inline Float8 intersect_wide_node(const Triangle_mesh::Wide_node& node,
+                                  const Vector3& origin,
+                                  const Vector3& inverse_direction,
+                                  const bool* is_parallel, float max_t,
+                                  int& hit_mask) {
+  Float8 t_min(0.0f);
+  Float8 t_max(max_t);
+  for (int i = 0; i < 3; i++) {
+    if (is_parallel[i]) continue;
+    const Float8 cell_size(get_cell_size(node.exponent[i]));
+    const Float8 node_origin(node.origin[i]);
+    const Float8 min_corner =
+        node_origin + Float8::load_bytes(node.quantized_min[i]) * cell_size;
+    const Float8 max_corner =
+        node_origin + Float8::load_bytes(node.quantized_max[i]) * cell_size;
+    const Float8 ray_origin(origin[i]);
+    const Float8 inverse(inverse_direction[i]);
+    const Float8 t_0 = (min_corner - ray_origin) * inverse;
+    const Float8 t_1 = (max_corner - ray_origin) * inverse;
+    t_min = max(min(t_0, t_1), t_min);
+    t_max = min(max(t_0, t_1), t_max);
+  }
+  hit_mask = (t_min <= t_max).bits();
+  return t_min;
+}
+
+// Axes with a direction component below the epsilon are marked parallel and
+// are skipped by the node tests
+inline void get_inverse_direction(const Ray& ray, Vector3& inverse_direction,
+                                  bool* is_parallel) {
+  inverse_direction = Vector3(0.0f);
+  for (int i = 0; i < 3; i++) {
+    is_parallel[i] = std::fabs(ray.d[i]) < intersection_test_epsilon;
+    if (!is_parallel[i]) {
+      inverse_direction[i] = 1.0f / ray.d[i];
+    }
+  }
+}
+}  // namespace
+
+Triangle_mesh::Tangent_frame Triangle_mesh::Tangent_frame::pack(
+    const Vector3& dp_du, const Vector3& dp_dv) {
+  const float largest = std::max(
+      std::max(std::max(std::fabs(dp_du.x), std::fabs(dp_du.y)),
+               std::max(std::fabs(dp_du.z), std::fabs(dp_dv.x))),
+      std::max(std::fabs(dp_dv.y), std::fabs(dp_dv.z)));
+  Tangent_frame frame;
+  frame.scale = largest / 32767.0f;
+  const float inverse_scale = largest > 0.0f ? 32767.0f / largest : 0.0f;
+  auto quantize = [inverse_scale](float value) {
+    return (int16_t)std::lround(value * inverse_scale);
+  };
+  frame.dp_du[0] = quantize(dp_du.x);
+  frame.dp_du[1] = quantize(dp_du.y);
+  frame.dp_du[2] = quantize(dp_du.z);
+  frame.dp_dv[0] = quantize(dp_dv.x);
+  frame.dp_dv[1] = quantize(dp_dv.y);
+  frame.dp_dv[2] = quantize(dp_dv.z);
+  return frame;
+}
+
+Triangle_mesh::Triangle_mesh(const Scene* scene,
+                             std::vector<Triangle_indices> triangles,
+                             const std::vector<Vector3>& face_normals,
+                             int vertex_offset, int texture_offset,
+                             int material_id, int texture_id,
+                             Triangle_shading_mode tsm, bool compressed_bvh)
+    : triangles_(std::move(triangles)),
+      scene_(scene),
+      vertex_offset_(vertex_offset),
+      texture_offset_(texture_offset),
+      material_id_(material_id),
+      texture_id_(texture_id),
+      triangle_shading_mode_(tsm) {
+  build_bvh(face_normals, compressed_bvh);
+  build_tangent_frames();
+}
+
+Triangle_mesh::Triangle_mesh(const Scene* scene,
+                             std::vector<Triangle_indices> triangles,
+                             std::vector<Octahedral_normal> face_normals,
+                             std::vector<Node> nodes,
+                             std::vector<Wide_node> wide_nodes,
+                             int vertex_offset, int texture_offset,
+                             int material_id, int texture_id,
+                             Triangle_shading_mode tsm)
+    : triangles_(std::move(triangles)),
+      face_normals_(std::move(face_normals)),
+      nodes_(std::move(nodes)),
+      wide_nodes_(std::move(wide_nodes)),
+      scene_(scene),
+      vertex_offset_(vertex_offset),
+      texture_offset_(texture_offset),
+      material_id_(material_id),
+      texture_id_(texture_id),
+      triangle_shading_mode_(tsm) {
+  if (!nodes_.empty()) {
+    bounding_box_ = Bounding_box(nodes_[0].min_corner, nodes_[0].max_corner);
+  } else if (!wide_nodes_.empty()) {
+    bounding_box_ = get_wide_bounding_box();
+  }
+  build_tangent_frames();
+}
+
+bool Triangle_mesh::is_valid_bvh(const Node* nodes, int node_count,
+                                 const Wide_node* wide_nodes,
+                                 int wide_node_count, int triangle_count) {
+  std::vector<int> depths(std::max(node_count, wide_node_count), 0);
+  for (int i = 0; i < node_count; i++) {
+    const Node& node = nodes[i];
+    if (node.triangle_count > 0) {
+      if (node.offset < 0 ||
+          node.triangle_count > triangle_count - node.offset) {
+        return false;
+      }
+      continue;
+    }
+    if (node.offset <= i + 1 || node.offset >= node_count ||
+        depths[i] + 1 >= TRIANGLE_MESH_MAX_DEPTH) {
+      return false;
+    }
+    depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+    depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+  }
+  std::fill(depths.begin(), depths.end(), 0);
+  for (int i = 0; i < wide_node_count; i++) {
+    const Wide_node& node = wide_nodes[i];
+    int internal_count = 0;
+    for (int slot = 0; slot < 8; slot++) {
+      if (node.internal_mask & (1 << slot)) {
+        internal_count++;
+      } else if (node.leaf[slot]) {
+        const int64_t first =
+            (int64_t)node.triangle_offset + (node.leaf[slot] >> 3);
+        if (first < 0 || first + (node.leaf[slot] & 7) > triangle_count) {
+          return false;
+        }
+      }
+    }
+    if (internal_count == 0) {
+      continue;
+    }
+    if (node.child_offset <= i ||
+        node.child_offset > wide_node_count - internal_count ||
+        depths[i] + 1 >= TRIANGLE_MESH_MAX_DEPTH) {
+      return false;
+    }
+    for (int child = 0; child < internal_count; child++) {
+      int& depth = depths[node.child_offset + child];
+      depth = std::max(depth, depths[i] + 1);
+    }
+  }
+  return true;
+}
+
+void Triangle_mesh::build_tangent_frames() {
+  if (texture_id_ == -1) {
+    return;
+  }
+  const Texture& texture = scene_->textures[texture_id_];
+  if (!texture.is_bump() || texture.is_perlin_noise()) {
+    return;
+  }
+  const int triangle_count = get_triangle_count();
+  tangent_frames_.resize(triangle_count);
+  for (int triangle = 0; triangle < triangle_count; triangle++) {
+    const Triangle_indices& indices = triangles_[triangle];
+    const Vector3 uva =
+        scene_->get_texture_coord(indices.vertex_index[0] + texture_offset_);
+    const Vector3 uvb =
+        scene_->get_texture_coord(indices.vertex_index[1] + texture_offset_);
+    const Vector3 uvc =
+        scene_->get_texture_coord(indices.vertex_index[2] + texture_offset_);
+    const Vector3& p_0 = get_vertex_position(triangle, 0);
+    float ub_ua = uvb.x - uva.x;
+    float uc_ua = uvc.x - uva.x;
+    float vb_va = uvb.y - uva.y;
+    float vc_va = uvc.y - uva.y;
+    Vector3 pb_pa = get_vertex_position(triangle, 1) - p_0;
+    Vector3 pc_pa = get_vertex_position(triangle, 2) - p_0;
+    float inverse_constant = (ub_ua * vc_va) - (vb_va * uc_ua);
+    if (inverse_constant == 0.0f) {
+      // Degenerate texture coordinates
+      inverse_constant = 0.000001f;
+    }
+    inverse_constant = 1.0f / inverse_constant;
+    tangent_frames_[triangle] = Tangent_frame::pack(
+        inverse_constant * (vc_va * pb_pa - vb_va * pc_pa),
+        inverse_constant * (ub_ua * pc_pa - uc_ua * pb_pa));
+  }
+}
+
+const Vector3& Triangle_mesh::get_vertex_position(int triangle,
+                                                  int corner) const {
+  return scene_->get_vertex_position(triangles_[triangle].vertex_index[corner] +
+                                     vertex_offset_);
+}
+
+Vector3 Triangle_mesh::get_face_normal(int triangle) const {
+  if (!face_normals_.empty()) {
+    return face_normals_[triangle].unpack();
+  }
+  const Vector3& v_0 = get_vertex_position(triangle, 0);
+  const Vector3& v_1 = get_vertex_position(triangle, 1);
+  const Vector3& v_2 = get_vertex_position(triangle, 2);
+  return (v_1 - v_0).cross(v_2 - v_0).normalize();
+}
+
+void Triangle_mesh::print_debug(int indentation) const {
+  for (int index = 0; index < indentation; index++) {
+    std::cout << "\t";
+  }
+  std::cout << "Triangle_mesh(" << triangles_.size() << " triangles, ";
+  if (wide_nodes_.empty()) {
+    std::cout << nodes_.size() << " nodes";
+  } else {
+    std::cout << wide_nodes_.size() << " compressed nodes";
+  }
+  std::cout << "), material: " << material_id_ << std::endl;
+}
+
+void Triangle_mesh::build_bvh(const std::vector<Vector3>& face_normals,
+                              bool compressed_bvh) {
+  const int count = (int)triangles_.size();
+  if (count == 0) {
+    return;
+  }
+  // Bounds of the triangles are only needed while the nodes are built
+  std::vector<Vector3> min_corners(count, Vector3(0.0f));
+  std::vector<Vector3> max_corners(count, Vector3(0.0f));
+  std::vector<Vector3> centers(count, Vector3(0.0f));
+  std::vector<int> order(count);
+  for (int i = 0; i < count; i++) {
+    const Vector3& v_0 = get_vertex_position(i, 0);
+    const Vector3& v_1 = get_vertex_position(i, 1);
+    const Vector3& v_2 = get_vertex_position(i, 2);
+    Vector3 min_c = v_0;
+    Vector3 max_c = v_0;
+    for (int j = 0; j < 3; j++) {
+      min_c[j] = std::min(min_c[j], std::min(v_1[j], v_2[j]));
+      max_c[j] = std::max(max_c[j], std::max(v_1[j], v_2[j]));
+    }
+    min_corners[i] = min_c;
+    max_corners[i] = max_c;
+    centers[i] = (max_c + min_c) / 2;
+    order[i] = i;
+  }
+  nodes_.reserve(2 * count / TRIANGLE_MESH_MAX_LEAF_SIZE + 1);
+  build_node(order, min_corners, max_corners, centers, 0, count, 0, 0);
+  nodes_.shrink_to_fit();
+  if (compressed_bvh) {
+    // Leaf children of a wide node get their triangles next to each other,
+    // so the triangles are ordered once more
+    std::vector<int> wide_order;
+    wide_order.reserve(count);
+    wide_nodes_.push_back(Wide_node());
+    build_wide_node(0, 0, order, wide_order);
+    wide_nodes_.shrink_to_fit();
+    order.swap(wide_order);
+  }
+
+  // Leaves refer to contiguous ranges, so triangles are stored in the order
+  // of the leaves
+  std::vector<Triangle_indices> ordered_triangles(count);
+  for (int i = 0; i < count; i++) {
+    ordered_triangles[i] = triangles_[order[i]];
+  }
+  triangles_.swap(ordered_triangles);
+  if (!face_normals.empty()) {
+    face_normals_.resize(count);
+    for (int i = 0; i < count; i++) {
+      face_normals_[i] = Octahedral_normal::pack(face_normals[order[i]]);
+    }
+  }
+  if (compressed_bvh) {
+    std::vector<Node>().swap(nodes_);
+    bounding_box_ = get_wide_bounding_box();
+  } else {
+    bounding_box_ = Bounding_box(nodes_[0].min_corner, nodes_[0].max_corner);
+  }
+}
+
+int Triangle_mesh::build_node(std::vector<int>& order,
+                              const std::vector<Vector3>& min_corners,
+                              const std::vector<Vector3>& max_corners,
+                              const std::vector<Vector3>& centers, int start,
+                              int end, int dimension, int depth) {
+  const int index = (int)nodes_.size();
+  nodes_.push_back(Node());
+  Node node;
+  node.min_corner = Vector3(kInf);
+  node.max_corner = Vector3(-kInf);
+  for (int i = start; i < end; i++) {
+    const Vector3& min_c = min_corners[order[i]];
+    const Vector3& max_c = max_corners[order[i]];
+    for (int j = 0; j < 3; j++) {
+      node.min_corner[j] = std::min(node.min_corner[j], min_c[j]);
+      node.max_corner[j] = std::max(node.max_corner[j], max_c[j]);
+    }
+  }
+  if (end - start <= TRIANGLE_MESH_MAX_LEAF_SIZE) {
+    node.offset = start;
+    node.triangle_count = end - start;
+    nodes_[index] = node;
+    return index;
+  }
+
+  // Same split as BVH, at the center of the node on cycling axes
+  int mid_index = start;
+  if (depth < TRIANGLE_MESH_BALANCED_DEPTH) {
+    const float center =
+        (node.max_corner[dimension] + node.min_corner[dimension]) / 2;
+    for (int i = start; i < end; i++) {
+      if (centers[order[i]][dimension] < center) {
+        std::swap(order[i], order[mid_index++]);
+      }
+    }
+  }
+  if (mid_index == start || mid_index == end) {
+    mid_index = start + ((end - start) / 2);
+    if (depth >= TRIANGLE_MESH_BALANCED_DEPTH) {
+      std::nth_element(order.begin() + start, order.begin() + mid_index,
+                       order.begin() + end, [&](int a, int b) {
+                         return centers[a][dimension] < centers[b][dimension];
+                       });
+    }
+  }
+  build_node(order, min_corners, max_corners, centers, start, mid_index,
+             (dimension + 1) % 3, depth + 1);
+  node.offset = build_node(order, min_corners, max_corners, centers,
+                           mid_index, end, (dimension + 1) % 3, depth + 1);
+  node.triangle_count = 0;
+  nodes_[index] = node;
+  return index;
+}
+
+void Triangle_mesh::build_wide_node(int index, int binary_node,
+                                    const std::vector<int>& order,
+                                    std::vector<int>& wide_order) {
+  int children[8];
+  int child_count = 1;
+  children[0] = binary_node;
+  while (child_count < 8) {
+    int largest = -1;
+    float largest_area = -1.0f;
+    for (int i = 0; i < child_count; i++) {
+      const Node& child = nodes_[children[i]];
+      if (child.triangle_count > 0) continue;
+      const Vector3 delta = child.max_corner - child.min_corner;
+      const float area =
+          delta.x * delta.y + delta.y * delta.z + delta.z * delta.x;
+      if (area > largest_area) {
+        largest_area = area;
+        largest = i;
+      }
+    }
+    if (largest < 0) {
+      break;
+    }
+    const int opened = children[largest];
+    children[largest] = opened + 1;
+    children[child_count++] = nodes_[opened].offset;
+  }
+
+  const Node& parent = nodes_[binary_node];
+  Wide_node node;
+  node.origin = parent.min_corner;
+  float cell_sizes[3];
+  for (int i = 0; i < 3; i++) {
+    // Smallest power of two whose 255 cells reach the far side
+    int exponent;
+    std::frexp((parent.max_corner[i] - parent.min_corner[i]) / 255.0f,
+               &exponent);
+    int biased = std::min(254, std::max(1, exponent + 127));
+    while (biased < 254 && decode(node.origin[i], 255, get_cell_size(biased)) <
+                               parent.max_corner[i]) {
+      biased++;
+    }
+    node.exponent[i] = (uint8_t)biased;
+    cell_sizes[i] = get_cell_size(biased);
+  }
+  node.internal_mask = 0;
+  node.child_offset = (int32_t)wide_nodes_.size();
+  node.triangle_offset = (int32_t)wide_order.size();
+  int internal_children[8];
+  int internal_count = 0;
+  for (int slot = 0; slot < 8; slot++) {
+    node.leaf[slot] = 0;
+    if (slot >= child_count) {
+      // Unused slot. The slab test swaps its inverted corners, so the box
+      // may be hit like the whole node. Traversal skips it because it has
+      // neither an internal bit nor a leaf entry.
+      for (int i = 0; i < 3; i++) {
+        node.quantized_min[i][slot] = 255;
+        node.quantized_max[i][slot] = 0;
+      }
+      continue;
+    }
+    const Node& child = nodes_[children[slot]];
+    for (int i = 0; i < 3; i++) {
+      const float origin = node.origin[i];
+      const float cell_size = cell_sizes[i];
+      // Rounding of the division is corrected by decoding
+      int q_min = (int)std::floor((child.min_corner[i] - origin) / cell_size);
+      q_min = std::min(255, std::max(0, q_min));
+      while (q_min > 0 &&
+             decode(origin, q_min, cell_size) > child.min_corner[i]) {
+        q_min--;
+      }
+      int q_max = (int)std::ceil((child.max_corner[i] - origin) / cell_size);
+      q_max = std::min(255, std::max(0, q_max));
+      while (q_max < 255 &&
+             decode(origin, q_max, cell_size) < child.max_corner[i]) {
+        q_max++;
+      }
+      node.quantized_min[i][slot] = (uint8_t)q_min;
+      node.quantized_max[i][slot] = (uint8_t)q_max;
+    }
+    if (child.triangle_count > 0) {
+      const int start = (int)wide_order.size() - node.triangle_offset;
+      node.leaf[slot] = (uint8_t)((start << 3) | child.triangle_count);
+      for (int i = child.offset; i < child.offset + child.triangle_count;
+           i++) {
+        wide_order.push_back(order[i]);
+      }
+    } else {
+      node.internal_mask |= 1 << slot;
+      internal_children[internal_count++] = children[slot];
+    }
+  }
+  wide_nodes_.resize(wide_nodes_.size() + internal_count);
+  wide_nodes_[index] = node;
+  for (int i = 0; i < internal_count; i++) {
+    build_wide_node(node.child_offset + i, internal_children[i], order,
+                    wide_order);
+  }
+}
+
+Bounding_box Triangle_mesh::get_wide_bounding_box() const {
+  const Wide_node& root = wide_nodes_[0];
+  Vector3 min_corner(kInf);
+  Vector3 max_corner(-kInf);
+  for (int slot = 0; slot < 8; slot++) {
+    if (!(root.internal_mask & (1 << slot)) && !root.leaf[slot]) {
+      continue;
+    }
+    for (int i = 0; i < 3; i++) {
+      const float cell_size = get_cell_size(root.exponent[i]);
+      min_corner[i] =
+          std::min(min_corner[i], decode(root.origin[i],
+                                         root.quantized_min[i][slot],
+                                         cell_size));
+      max_corner[i] =
+          std::max(max_corner[i], decode(root.origin[i],
+                                         root.quantized_max[i][slot],
+                                         cell_size));
+    }
+  }
+  return Bounding_box(min_corner, max_corner);
+}
+
+bool Triangle_mesh::intersect(const Ray& ray, Hit_record& hit_record,
+                              bool culling) const {
+  if (!wide_nodes_.empty()) {
+    return intersect_wide(ray, hit_record, culling);
+  }
+  if (nodes_.empty()) {
+    return false;
+  }
+  bool is_parallel[3];
+  Vector3 inverse_direction;
+  get_inverse_direction(ray, inverse_direction, is_parallel);
+  float closest_t = hit_record.t;
+  int closest_triangle = -1;
+  float closest_beta = 0.0f, closest_gamma = 0.0f;
+  float t_entry;
+  if (!intersect_node(nodes_[0], ray.o, inverse_direction, is_parallel,
+                      closest_t, t_entry)) {
+    return false;
+  }
+
+  // Nearer child is visited first, the other one waits on the stack
+  Stack_entry stack[TRIANGLE_MESH_MAX_DEPTH];
+  int stack_size = 0;
+  int node_index = 0;
+  while (true) {
+    const Node& node = nodes_[node_index];
+    if (node.triangle_count > 0) {
+      intersect_leaf(ray, node.offset, node.triangle_count, culling,
+                     closest_t, closest_triangle, closest_beta,
+                     closest_gamma);
+    } else {
+      int first = node_index + 1;
+      int second = node.offset;
+      float t_first, t_second;
+      const bool hits_first =
+          intersect_node(nodes_[first], ray.o, inverse_direction, is_parallel,
+                         closest_t, t_first);
+      const bool hits_second =
+          intersect_node(nodes_[second], ray.o, inverse_direction,
+                         is_parallel, closest_t, t_second);
+      if (hits_first && hits_second) {
+        if (t_second < t_first) {
+          std::swap(first, second);
+          std::swap(t_first, t_second);
+        }
+        stack[stack_size].node = second;
+        stack[stack_size].t_entry = t_second;
+        stack_size++;
+        node_index = first;
+        continue;
+      } else if (hits_first) {
+        node_index = first;
+        continue;
+      } else if (hits_second) {
+        node_index = second;
+        continue;
+      }
+    }
+    // Nodes behind the closest hit found after they were pushed are skipped
+    do {
+      if (stack_size == 0) {
+        if (closest_triangle < 0) {
+          return false;
+        }
+        hit_record.t = closest_t;
+        hit_record.shape = this;
+        hit_record.primitive = closest_triangle;
+        hit_record.beta = closest_beta;
+        hit_record.gamma = closest_gamma;
+        return true;
+      }
+      stack_size--;
+    } while (stack[stack_size].t_entry > closest_t);
+    node_index = stack[stack_size].node;
+  }
+}
+
+bool Triangle_mesh::intersect_wide(const Ray& ray, Hit_record& hit_record,
+                                   bool culling) const {
+  bool is_parallel[3];
+  Vector3 inverse_direction;
+  get_inverse_direction(ray, inverse_direction, is_parallel);
+  float closest_t = hit_record.t;
+  int closest_triangle = -1;
+  float closest_beta = 0.0f, closest_gamma = 0.0f;
+
+  // Leaf children are tested as soon as they are hit. Internal children are
+  // pushed sorted, so the nearest one is popped first.
+  Stack_entry stack[TRIANGLE_MESH_WIDE_STACK_SIZE];
+  int stack_size = 0;
+  int node_index = 0;
+  while (true) {
+    const Wide_node& node = wide_nodes_[node_index];
+    int hit_mask;
+    float t_entries[8];
+    intersect_wide_node(node, ray.o, inverse_direction, is_parallel,
+                        closest_t, hit_mask)
+        .store(t_entries);
+    const int first_pushed = stack_size;
+    int internal_rank = 0;
+    for (int slot = 0; slot < 8; slot++) {
+      const bool is_internal = node.internal_mask & (1 << slot);
+      const int child = node.child_offset + internal_rank;
+      internal_rank += is_internal;
+      if (!(hit_mask & (1 << slot))) continue;
+      if (is_internal) {
+        // Insertion sort, farther entries end up below nearer ones
+        int position = stack_size++;
+        while (position > first_pushed &&
+               stack[position - 1].t_entry < t_entries[slot]) {
+          stack[position] = stack[position - 1];
+          position--;
+        }
+        stack[position].node = child;
+        stack[position].t_entry = t_entries[slot];
+      } else if (node.leaf[slot]) {
+        // Unused slots have no leaf entry and are skipped here
+        intersect_leaf(ray, node.triangle_offset + (node.leaf[slot] >> 3),
+                       node.leaf[slot] & 7, culling, closest_t,
+                       closest_triangle, closest_beta, closest_gamma);
+      }
+    }
+    // Nodes behind the closest hit found after they were pushed are skipped
+    do {
+      if (stack_size == 0) {
+        if (closest_triangle < 0) {
+          return false;
+        }
+        hit_record.t = closest_t;
+        hit_record.shape = this;
+        hit_record.primitive = closest_triangle;
+        hit_record.beta = closest_beta;
+        hit_record.gamma = closest_gamma;
+        return true;
+      }
+      stack_size--;
+    } while (stack[stack_size].t_entry > closest_t);
+    node_index = stack[stack_size].node;
+  }
+}
+
+bool Triangle_mesh::intersect_triangle(const Ray& ray, int triangle,
+                                       bool culling, float& t, float& beta,
+                                       float& gamma) const {
+  const Vector3& p_0 = get_vertex_position(triangle, 0);
+  const Vector3& p_1 = get_vertex_position(triangle, 1);
+  const Vector3& p_2 = get_vertex_position(triangle, 2);
+  const Vector3 a_col1 = p_0 - p_1;
+  const Vector3 a_col2 = p_0 - p_2;
+  const Vector3& a_col3 = ray.d;
+
+  // Only the sign matters, so neither normal is normalized
+  if (culling) {
+    const Vector3 normal = face_normals_.empty()
+                               ? a_col1.cross(a_col2)
+                               : face_normals_[triangle].unpack_raw();
+    if (a_col3.dot(normal) > 0.0f) {
+      return false;
+    }
+  }
+
+  const float det_a = determinant(a_col1, a_col2, a_col3);
+  if (det_a == 0.0f) {
+    return false;
+  }
+  const Vector3 b = (p_0 - ray.o) / det_a;
+  beta = determinant(b, a_col2, a_col3);
+  if (beta < -intersection_test_epsilon) return false;
+  gamma = determinant(a_col1, b, a_col3);
+  if (gamma < -intersection_test_epsilon ||
+      beta + gamma > 1.0f + intersection_test_epsilon) {
+    return false;
+  }
+  t = determinant(a_col1, a_col2, b);
+  return t > -intersection_test_epsilon;
+}
+
+void Triangle_mesh::get_surface_interaction(
+    const Ray& ray, const Hit_record& hit_record,
+    Surface_interaction& interaction) const {
+  const int triangle = hit_record.primitive;
+  const float beta = hit_record.beta;
+  const float gamma = hit_record.gamma;
+  const Triangle_indices& indices = triangles_[triangle];
+  const int vertex_0 = indices.vertex_index[0] + vertex_offset_;
+  const int vertex_1 = indices.vertex_index[1] + vertex_offset_;
+  const int vertex_2 = indices.vertex_index[2] + vertex_offset_;
+  const Vector3& p_0 = scene_->get_vertex_position(vertex_0);
+  const Vector3& p_1 = scene_->get_vertex_position(vertex_1);
+  const Vector3& p_2 = scene_->get_vertex_position(vertex_2);
+  interaction.t = hit_record.t;
+  Vector3 local_intersection_point = ray.point_at(hit_record.t);
+  interaction.shape = this;
+  float u = -1;
+  float v = -1;
+  float perlin_value = -1;
+  interaction.has_uv_differentials = false;
+  Vector3 normal;
+  switch (triangle_shading_mode_) {
+    case tsm_smooth:
+      normal = ((1 - beta - gamma) * scene_->get_vertex_normal(vertex_0) +
+                beta * scene_->get_vertex_normal(vertex_1) +
+                gamma * scene_->get_vertex_normal(vertex_2))
+                   .normalize();
+      break;
+    case tsm_flat:
+      normal = get_face_normal(triangle);
+      break;
+  }
+  if (texture_id_ != -1) {
+    // TODO: Maybe do this calculations outside to give different textures to
+    // different mesh instances like materials
+    const Texture& texture = scene_->textures[texture_id_];
+    if (texture.is_perlin_noise()) {
+      if (texture.is_bump()) {
+        normal = texture.bump_normal(normal, local_intersection_point,
+                                     perlin_value);
+      } else {
+        perlin_value =
+            texture.get_perlin_noise()->get_value_at(local_intersection_point);
+      }
+    } else {
+      const Vector3 uva =
+          scene_->get_texture_coord(indices.vertex_index[0] + texture_offset_);
+      const Vector3 uvb =
+          scene_->get_texture_coord(indices.vertex_index[1] + texture_offset_);
+      const Vector3 uvc =
+          scene_->get_texture_coord(indices.vertex_index[2] + texture_offset_);
+      u = uva.x + beta * (uvb.x - uva.x) + gamma * (uvc.x - uva.x);
+      v = uva.y + beta * (uvb.y - uva.y) + gamma * (uvc.y - uva.y);
+      if (ray.has_differentials) {
+        calculate_uv_differentials(ray, get_face_normal(triangle), p_0, p_1,
+                                   p_2, uva, uvb, uvc, u, v, interaction);
+      }
+      if (texture.is_bump()) {
+        Vector3 dp_du, dp_dv;
+        tangent_frames_[triangle].unpack(dp_du, dp_dv);
+        normal = texture.bump_normal(dp_du, dp_dv, normal, u, v);
+      }
+    }
+  }
+  interaction.u = u;
+  interaction.v = v;
+  interaction.perlin_value = perlin_value;
+  interaction.normal = normal;
+  interaction.is_light_object = false;
+}
+
+void Triangle_mesh::calculate_uv_differentials(
+    const Ray& ray, const Vector3& normal, const Vector3& p_0,
+    const Vector3& p_1, const Vector3& p_2, const Vector3& uva,
+    const Vector3& uvb, const Vector3& uvc, float u, float v,
+    Surface_interaction& interaction) const {
+  // Offset rays are intersected with the plane of the triangle and the
+  // texture coordinates are interpolated at their barycentric coordinates
+  const Vector3 e_1 = p_1 - p_0;
+  const Vector3 e_2 = p_2 - p_0;
+  const float d_11 = e_1.dot(e_1);
+  const float d_12 = e_1.dot(e_2);
+  const float d_22 = e_2.dot(e_2);
+  const float denominator = d_11 * d_22 - d_12 * d_12;
+  const float dx_dot_n = ray.rx_d.dot(normal);
+  const float dy_dot_n = ray.ry_d.dot(normal);
+  if (denominator == 0.0f || dx_dot_n == 0.0f || dy_dot_n == 0.0f) {
+    return;
+  }
+  auto uv_at = [&](const Vector3& point, float& u_out, float& v_out) {
+    const Vector3 w = point - p_0;
+    const float d_w1 = w.dot(e_1);
+    const float d_w2 = w.dot(e_2);
+    const float beta = (d_22 * d_w1 - d_12 * d_w2) / denominator;
+    const float gamma = (d_11 * d_w2 - d_12 * d_w1) / denominator;
+    u_out = uva.x + beta * (uvb.x - uva.x) + gamma * (uvc.x - uva.x);
+    v_out = uva.y + beta * (uvb.y - uva.y) + gamma * (uvc.y - uva.y);
+  };
+  float u_x, v_x, u_y, v_y;
+  uv_at(ray.rx_o + ray.rx_d * ((p_0 - ray.rx_o).dot(normal) / dx_dot_n), u_x,
+        v_x);
+  uv_at(ray.ry_o + ray.ry_d * ((p_0 - ray.ry_o).dot(normal) / dy_dot_n), u_y,
+        v_y);
+  interaction.du_dx = u_x - u;
+  interaction.dv_dx = v_x - v;
+  interaction.du_dy = u_y - u;
+  interaction.dv_dy = v_y - v;
+  interaction.has_uv_differentials = true;
+}
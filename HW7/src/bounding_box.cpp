@@ -1,6 +1,6 @@
 #include "Bounding_box.h"
 #include <algorithm>
-#include "Matrix4x4.h"
+#include "Affine_transform.h"
 #include "Transformation.h"
 
 void Bounding_box::expand(const Bounding_box& bounding_box) {
@@ -17,6 +17,19 @@ void Bounding_box::expand(const Bounding_box& bounding_box) {
 }
 
 float Bounding_box::intersect(const Ray& ray) const {
+  float tmin, tmax;
+  if (!intersect(ray, tmin, tmax)) {
+    return kInf;
+  }
+  if (tmin > 0.0f) {
+    return tmin;
+  } else {
+    return tmax;
+  }
+}
+
+bool Bounding_box::intersect(const Ray& ray, float& t_entry,
+                             float& t_exit) const {
   float tmin = -kInf;
   float tmax = kInf;
   const Vector3& origin = ray.o;
@@ -28,39 +41,41 @@ float Bounding_box::intersect(const Ray& ray) const {
     if (direction[i] < 0) std::swap(ti_min, ti_max);
     if (ti_min > tmin) tmin = ti_min;
     if (ti_max < tmax) tmax = ti_max;
-    if (tmin > tmax) return kInf;
-  }
-
-  if (tmin > 0.0f) {
-    return tmin;
-  } else {
-    return tmax;
+    if (tmin > tmax) return false;
   }
+  t_entry = tmin;
+  t_exit = tmax;
+  return true;
 }
 
 Bounding_box Bounding_box::apply_transform(const Bounding_box& bounding_box,
                                            const Transformation& transform) {
-  const Matrix4x4& transformation_matrix =
-      transform.get_transformation_matrix();
+  const Affine_transform& transformation_matrix =
+      transform.get_transformation();
   const Vector3& min = bounding_box.min_corner;
   const Vector3& max = bounding_box.max_corner;
+  if (transformation_matrix.is_translation()) {
+    // Corners keep their order, only the two extremes are needed
+    return Bounding_box(transformation_matrix.transform_point(min),
+                        transformation_matrix.transform_point(max));
+  }
 
   const Vector3 v000 =
-      transformation_matrix.multiply(Vector3(min.x, min.y, min.z));
+      transformation_matrix.transform_point(Vector3(min.x, min.y, min.z));
   const Vector3 v001 =
-      transformation_matrix.multiply(Vector3(min.x, min.y, max.z));
+      transformation_matrix.transform_point(Vector3(min.x, min.y, max.z));
   const Vector3 v010 =
-      transformation_matrix.multiply(Vector3(min.x, max.y, min.z));
+      transformation_matrix.transform_point(Vector3(min.x, max.y, min.z));
   const Vector3 v011 =
-      transformation_matrix.multiply(Vector3(min.x, max.y, max.z));
+      transformation_matrix.transform_point(Vector3(min.x, max.y, max.z));
   const Vector3 v100 =
-      transformation_matrix.multiply(Vector3(max.x, min.y, min.z));
+      transformation_matrix.transform_point(Vector3(max.x, min.y, min.z));
   const Vector3 v101 =
-      transformation_matrix.multiply(Vector3(max.x, min.y, max.z));
+      transformation_matrix.transform_point(Vector3(max.x, min.y, max.z));
   const Vector3 v110 =
-      transformation_matrix.multiply(Vector3(max.x, max.y, min.z));
+      transformation_matrix.transform_point(Vector3(max.x, max.y, min.z));
   const Vector3 v111 =
-      transformation_matrix.multiply(Vector3(max.x, max.y, max.z));
+      transformation_matrix.transform_point(Vector3(max.x, max.y, max.z));
 
   /// v000
   Vector3 min_c = v000;
@@ -20,5 +20,28 @@ class Hit_point {
   float pixel_weight;
 
   std::mutex mutex;
+
+  // Reflected portion of a photon arriving from w_i towards the eye
+  Vector3 get_color(const Vector3& w_i) const {
+    Vector3 color(0.0f);
+    if (material.brdf_id == -1) {
+      // all things except w_i should be used from hit_point
+      float cos_theta_i = normal.dot(w_i);
+      if (cos_theta_i > 1.0f || cos_theta_i <= 0.0f) {
+        color = 0.0f;
+      } else {
+        float specular_cos_theta =
+            std::max(0.0f, normal.dot((w_o + w_i).normalize()));
+        color = (material.diffuse +
+                 material.specular *
+                     std::pow(specular_cos_theta, material.phong_exponent) /
+                     cos_theta_i) *
+                attenuation;
+      }
+    } else {
+      // parse brdfs, use brdfs with hit_point's diffuse, specular
+    }
+    return color;
+  }
 };
 #endif
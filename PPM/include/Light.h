@@ -1,5 +1,6 @@
 #ifndef LIGHT_H_
 #define LIGHT_H_
+#include <random>
 #include "Ray.h"
 #include "Vector3.h"
 class Light {
@@ -11,6 +12,9 @@ class Light {
   // Incoming radiance to the point from the light
   virtual Vector3 incoming_radiance(const Vector3& from_point_to_light,
                                     float probability) const = 0;*/
-  virtual void generate_photon(Ray& photon_ray, Vector3& flux) const = 0;
+  // Fills the first count elements of photon_rays and fluxes, the generator
+  // is owned by the calling thread
+  virtual void generate_photons(Ray* photon_rays, Vector3* fluxes, int count,
+                                std::mt19937& generator) const = 0;
 };
 #endif
@@ -0,0 +1,15 @@
+#pragma once
+#ifndef PHOTON_H_
+#define PHOTON_H_
+#include "Vector3.h"
+class Photon {
+ public:
+  Vector3 position;
+  // Direction towards where the photon came from
+  Vector3 w_i;
+  Vector3 normal;
+  Vector3 flux;
+  // Splitting axis of the node in the photon map
+  int axis;
+};
+#endif
@@ -1,6 +1,7 @@
 #pragma once
 #ifndef SCENE_H_
 #define SCENE_H_
+#include <atomic>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -10,6 +11,8 @@
 #include "Light.h"
 #include "Material.h"
 #include "Mesh.h"
+#include "Photon.h"
+#include "Photon_map.h"
 #include "Photographic_tmo.h"
 #include "Pixel.h"
 #include "Shape.h"
@@ -26,13 +29,30 @@ class Scene {
   unsigned int num_hash;
   unsigned int num_photon;
   float hash_scale;
+  // Initial radius of the hit points, size of the hash grid cells
+  float hash_grid_radius;
   std::vector<std::vector<Hit_point*>> hash_grid;
   std::vector<Hit_point*> hit_points;
+  // Photons emitted since the hit points are created, every density
+  // estimation is normalised with it
+  std::atomic<long long> emitted_photon_count;
   Bounding_box hit_point_bbox;
 
+  // Photon map mode, photons are traced once and shared by all cameras
+  bool use_photon_map;
+  int photon_map_photon_count;
+  int photon_map_nearest_count;
+  float photon_map_max_radius_squared;
+  Photon_map photon_map;
+
   int max_recursion_depth;
   int photon_count_per_iteration;
   int number_of_iterations;
+  // Progressive output, disabled when zero
+  int preview_interval;
+  float time_budget;
+  float convergence_threshold;
+  int checkpoint_interval;
   Vector3 ambient_light;
   std::vector<Scaling> scaling_transformations;
   std::vector<Translation> translation_transformations;
@@ -47,12 +67,26 @@ class Scene {
   }
   void reset_hash_grid();
   void build_hash_grid(const int width, const int height);
+  void insert_hit_points_to_hash_grid();
+  void save_checkpoint(const std::string& file_name, int width, int height,
+                       int iterations_done) const;
+  // Replaces the hit points with the saved ones and rebuilds the hash grid.
+  // Returns false if there is no valid checkpoint for the given image size.
+  bool load_checkpoint(const std::string& file_name, int width, int height,
+                       int& iterations_done);
   void eye_trace_lines(int index, int starting_row, int height_increase);
   void eye_trace(const Ray& ray, int depth, const Vector3& attenuation,
                  unsigned int pixel_index, float pixel_weight = 1.0f);
   void trace_n_photons(int n, int iteration_count);
-  void photon_trace(const Ray& ray, int depth, const Vector3& flux);
-  void density_estimation(Pixel* pixels, int total_num_of_photons);
+  void trace_photons_into(int n, std::vector<Photon>* photons);
+  void build_photon_map(std::vector<std::vector<Photon>>& photon_lists);
+  // If photons is given, photons are stored in it instead of being gathered
+  // by the hit points in the hash grid
+  void photon_trace(const Ray& ray, int depth, const Vector3& flux,
+                    std::vector<Photon>* photons = nullptr);
+  void density_estimation(Pixel* pixels);
+  void photon_map_estimation(Pixel* pixels, int starting_index,
+                             int index_increase);
   void sample_hemisphere(const Vector3& w, Vector3& d, float& p,
                          bool is_uniform_sampling = false);
   void add_hit_point(Hit_point* hit_point) {
@@ -62,6 +96,10 @@ class Scene {
 
  private:
   std::mutex mutex_;
+  // Emits photons from the light in batches and traces them
+  void trace_photon_batches(long long n, std::vector<Photon>* photons);
+  // Hit points loaded from a checkpoint are allocated at once
+  Hit_point* hit_point_block_;
   inline unsigned int hash(const int ix, const int iy, const int iz) {
     return (unsigned int)((ix * 73856093) ^ (iy * 19349663) ^ (iz * 83492791)) %
            num_hash;
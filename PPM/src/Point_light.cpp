@@ -4,29 +4,28 @@
 Point_light::Point_light(const Vector3& position, const Vector3& intensity)
     : position_(position), intensity_(intensity) {}
 
-void Point_light::generate_photon(Ray& photon_ray, Vector3& flux) const {
-  flux = intensity_ * (M_PI * 4.0f);
-  // Sample sphere
-  thread_local static std::random_device rd;
-  thread_local static std::mt19937 generator(rd());
+void Point_light::generate_photons(Ray* photon_rays, Vector3* fluxes,
+                                   int count, std::mt19937& generator) const {
+  const Vector3 flux = intensity_ * (M_PI * 4.0f);
+  // Random numbers are drawn first so that the direction loop has no
+  // dependency on the generator
+  thread_local static std::vector<float> epsilons;
+  epsilons.resize(2 * count);
   std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
-  float epsilon_1 = uniform_dist(generator);
-  float epsilon_2 = uniform_dist(generator);
-
-  float phi;
-  float theta;
-  Vector3 w(0.0f, 1.0f, 0.0f);
-  const Vector3 u = ((w.x != 0.0f || w.y != 0.0f) ? Vector3(-w.y, w.x, 0.0f)
-                                                  : Vector3(0.0f, 1.0f, 0.0f))
-                        .normalize();
-  const Vector3 v = w.cross(u);
-  phi = 2 * M_PI * epsilon_1;
-  theta = 2 * M_PI * epsilon_2;
-
-  photon_ray.d = (w * std::cos(theta) + v * std::sin(theta) * std::cos(phi) +
-                  u * std::sin(theta) * std::sin(phi))
-                     .normalize();
-  photon_ray.o = position_;
+  for (int i = 0; i < 2 * count; i++) {
+    epsilons[i] = uniform_dist(generator);
+  }
+  // Sample sphere uniformly, pdf is 1 / (4 * pi)
+  for (int i = 0; i < count; i++) {
+    const float cos_theta = 1.0f - 2.0f * epsilons[2 * i];
+    const float sin_theta =
+        std::sqrt(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    const float phi = 2.0f * M_PI * epsilons[2 * i + 1];
+    photon_rays[i].o = position_;
+    photon_rays[i].d = Vector3(sin_theta * std::cos(phi), cos_theta,
+                               sin_theta * std::sin(phi));
+    fluxes[i] = flux;
+  }
 }
 
 void Point_light::load_point_lights_from_xml(tinyxml2::XMLElement* element,
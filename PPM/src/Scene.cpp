@@ -11,6 +11,7 @@
 #include "tinyxml2.h"
 //#define GAUSSIAN_FILTER
 #define ALPHA 0.7f
+#define PHOTON_BATCH_SIZE 1024
 
 void Scene::sample_hemisphere(const Vector3& w, Vector3& d, float& p,
                               bool is_uniform_sampling) {
@@ -45,8 +46,13 @@ void Scene::sample_hemisphere(const Vector3& w, Vector3& d, float& p,
 
 void Scene::reset_hash_grid() {
   hash_grid.clear();
-  for (int i = 0; i < hit_points.size(); i++) {
-    delete hit_points[i];
+  if (hit_point_block_) {
+    delete[] hit_point_block_;
+    hit_point_block_ = nullptr;
+  } else {
+    for (int i = 0; i < hit_points.size(); i++) {
+      delete hit_points[i];
+    }
   }
   hit_points.clear();
 }
@@ -59,18 +65,28 @@ void Scene::build_hash_grid(const int width, const int height) {
   Vector3 bbox_size = hit_point_bbox.delta;
   float initial_radius = ((bbox_size.x + bbox_size.y + bbox_size.z) / 3.0f) /
                          ((width + height) / 2.0f) * 2.0f * 4.0f;
-  hit_point_bbox = Bounding_box();
-  num_hash = hit_points.size();
   for (int i = 0; i < hit_points.size(); i++) {
     Hit_point* hit_point = hit_points[i];
     hit_point->radius_squared = initial_radius * initial_radius;
     hit_point->n = 0;
     hit_point->flux = Vector3(0.0f);
+  }
+  emitted_photon_count = 0;
+  hash_grid_radius = initial_radius;
+  insert_hit_points_to_hash_grid();
+}
+void Scene::insert_hit_points_to_hash_grid() {
+  const float initial_radius = hash_grid_radius;
+  hit_point_bbox = Bounding_box();
+  num_hash = hit_points.size();
+  for (int i = 0; i < hit_points.size(); i++) {
+    Hit_point* hit_point = hit_points[i];
     hit_point_bbox.fit(hit_point->position - initial_radius);
     hit_point_bbox.fit(hit_point->position + initial_radius);
   }
   hash_scale = 1.0 / (initial_radius * 2.0);
 
+  hash_grid.clear();
   hash_grid.resize(num_hash);
   for (int i = 0; i < hit_points.size(); i++) {
     Hit_point* hit_point = hit_points[i];
@@ -92,18 +108,204 @@ void Scene::build_hash_grid(const int width, const int height) {
   }
 }
 
+namespace {
+constexpr char kCheckpointMagic[8] = {'P', 'P', 'M', 'C', 'K', 'P', 'T', 0};
+constexpr int kCheckpointVersion = 1;
+// Records are written and read through a fixed size buffer
+constexpr size_t kCheckpointBufferSize = 4096;
+struct Checkpoint_header {
+  char magic[8];
+  int version;
+  int width;
+  int height;
+  int iterations_done;
+  long long emitted_photon_count;
+  unsigned long long hit_point_count;
+  float hash_grid_radius;
+};
+struct Hit_point_record {
+  Material material;
+  Vector3 attenuation;
+  Vector3 w_o;
+  Vector3 normal;
+  Vector3 position;
+  Vector3 flux;
+  float radius_squared;
+  unsigned int n;
+  int pixel;
+  float pixel_weight;
+};
+}  // namespace
+
+void Scene::save_checkpoint(const std::string& file_name, int width,
+                            int height, int iterations_done) const {
+  // Written next to the old checkpoint and renamed, so an interruption while
+  // writing does not destroy the previous one
+  const std::string temporary_name = file_name + ".tmp";
+  std::ofstream file(temporary_name, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "Checkpoint cannot be written: " << temporary_name
+              << std::endl;
+    return;
+  }
+  Checkpoint_header header;
+  std::copy(kCheckpointMagic, kCheckpointMagic + 8, header.magic);
+  header.version = kCheckpointVersion;
+  header.width = width;
+  header.height = height;
+  header.iterations_done = iterations_done;
+  header.emitted_photon_count = emitted_photon_count;
+  header.hit_point_count = hit_points.size();
+  header.hash_grid_radius = hash_grid_radius;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<Hit_point_record> buffer(kCheckpointBufferSize);
+  size_t buffer_size = 0;
+  for (const Hit_point* hit_point : hit_points) {
+    Hit_point_record& record = buffer[buffer_size++];
+    record.material = hit_point->material;
+    record.attenuation = hit_point->attenuation;
+    record.w_o = hit_point->w_o;
+    record.normal = hit_point->normal;
+    record.position = hit_point->position;
+    record.flux = hit_point->flux;
+    record.radius_squared = hit_point->radius_squared;
+    record.n = hit_point->n;
+    record.pixel = hit_point->pixel;
+    record.pixel_weight = hit_point->pixel_weight;
+    if (buffer_size == kCheckpointBufferSize) {
+      file.write(reinterpret_cast<const char*>(buffer.data()),
+                 sizeof(Hit_point_record) * buffer_size);
+      buffer_size = 0;
+    }
+  }
+  file.write(reinterpret_cast<const char*>(buffer.data()),
+             sizeof(Hit_point_record) * buffer_size);
+  file.close();
+  if (!file || std::rename(temporary_name.c_str(), file_name.c_str()) != 0) {
+    std::cerr << "Checkpoint cannot be written: " << file_name << std::endl;
+  }
+}
+
+bool Scene::load_checkpoint(const std::string& file_name, int width,
+                            int height, int& iterations_done) {
+  std::ifstream file(file_name, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  const unsigned long long file_size = file.tellg();
+  file.seekg(0, std::ios::beg);
+
+  Checkpoint_header header;
+  if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      !std::equal(kCheckpointMagic, kCheckpointMagic + 8, header.magic) ||
+      header.version != kCheckpointVersion || header.width != width ||
+      header.height != height ||
+      file_size != sizeof(header) +
+                       header.hit_point_count * sizeof(Hit_point_record)) {
+    std::cerr << "Checkpoint is not valid for this image: " << file_name
+              << std::endl;
+    return false;
+  }
+
+  reset_hash_grid();
+  const size_t hit_point_count = header.hit_point_count;
+  hit_point_block_ = new Hit_point[hit_point_count];
+  hit_points.resize(hit_point_count);
+  std::vector<Hit_point_record> buffer(kCheckpointBufferSize);
+  for (size_t i = 0; i < hit_point_count; i += kCheckpointBufferSize) {
+    const size_t buffer_size =
+        std::min(kCheckpointBufferSize, hit_point_count - i);
+    file.read(reinterpret_cast<char*>(buffer.data()),
+              sizeof(Hit_point_record) * buffer_size);
+    for (size_t j = 0; j < buffer_size; j++) {
+      const Hit_point_record& record = buffer[j];
+      Hit_point* hit_point = &hit_point_block_[i + j];
+      hit_point->material = record.material;
+      hit_point->attenuation = record.attenuation;
+      hit_point->w_o = record.w_o;
+      hit_point->normal = record.normal;
+      hit_point->position = record.position;
+      hit_point->flux = record.flux;
+      hit_point->radius_squared = record.radius_squared;
+      hit_point->n = record.n;
+      hit_point->pixel = record.pixel;
+      hit_point->pixel_weight = record.pixel_weight;
+      hit_points[i + j] = hit_point;
+    }
+  }
+  if (!file) {
+    std::cerr << "Checkpoint cannot be read: " << file_name << std::endl;
+    reset_hash_grid();
+    return false;
+  }
+  iterations_done = header.iterations_done;
+  emitted_photon_count = header.emitted_photon_count;
+  hash_grid_radius = header.hash_grid_radius;
+  insert_hit_points_to_hash_grid();
+  return true;
+}
+
 void Scene::trace_n_photons(int n, int iteration_count) {
+  trace_photon_batches((long long)n * iteration_count, nullptr);
+}
+
+void Scene::trace_photons_into(int n, std::vector<Photon>* photons) {
+  trace_photon_batches(n, photons);
+}
+
+void Scene::trace_photon_batches(long long n, std::vector<Photon>* photons) {
   // For now, only one light source
   const Light* light = lights[0];
-  Ray photon_ray(0.0f, 0.0f);
-  Vector3 flux;
-  for (int i = 0; i < n * iteration_count; i++) {
-    light->generate_photon(photon_ray, flux);
-    photon_trace(photon_ray, 0, flux);
+  thread_local static std::random_device rd;
+  thread_local static std::mt19937 generator(rd());
+  std::vector<Ray> photon_rays(PHOTON_BATCH_SIZE, Ray(0.0f, 0.0f));
+  std::vector<Vector3> fluxes(PHOTON_BATCH_SIZE);
+  for (long long i = 0; i < n; i += PHOTON_BATCH_SIZE) {
+    int count = (int)std::min<long long>(PHOTON_BATCH_SIZE, n - i);
+    light->generate_photons(photon_rays.data(), fluxes.data(), count,
+                            generator);
+    emitted_photon_count += count;
+    for (int j = 0; j < count; j++) {
+      photon_trace(photon_rays[j], 0, fluxes[j], photons);
+    }
+  }
+}
+
+void Scene::build_photon_map(std::vector<std::vector<Photon>>& photon_lists) {
+  photon_map.build(photon_lists, emitted_photon_count);
+}
+
+void Scene::photon_map_estimation(Pixel* pixels, int starting_index,
+                                  int index_increase) {
+  const float total_num_of_photons =
+      (float)photon_map.get_emitted_photon_count();
+  std::vector<Photon_map::Nearest_photon> nearest;
+  nearest.reserve(photon_map_nearest_count);
+  for (int i = starting_index; i < hit_points.size(); i += index_increase) {
+    const Hit_point* hit_point = hit_points[i];
+    float radius_squared =
+        photon_map.locate_nearest(hit_point->position, photon_map_nearest_count,
+                                  photon_map_max_radius_squared, nearest);
+    if (radius_squared <= 0.0f) {
+      continue;
+    }
+    Vector3 flux(0.0f);
+    for (const Photon_map::Nearest_photon& nearest_photon : nearest) {
+      const Photon* photon = nearest_photon.second;
+      if (hit_point->normal.dot(photon->normal) > 1e-3f) {
+        flux += hit_point->get_color(photon->w_i) * photon->flux;
+      }
+    }
+    pixels[hit_point->pixel].add_color(
+        flux * (1.0f / (M_PI * radius_squared * total_num_of_photons)),
+        hit_point->pixel_weight);
   }
 }
 
-void Scene::photon_trace(const Ray& ray, int depth, const Vector3& flux) {
+void Scene::photon_trace(const Ray& ray, int depth, const Vector3& flux,
+                         std::vector<Photon>* photons) {
   thread_local static std::random_device rd;
   thread_local static std::mt19937 generator(rd());
   std::uniform_real_distribution<float> uniform_dist(0.0f, 1.0f);
@@ -122,51 +324,41 @@ void Scene::photon_trace(const Ray& ray, int depth, const Vector3& flux) {
   if (material.material_type == mt_diffuse) {
     // Use Quasi-Monte Carlo to sample the next direction
 
-    Vector3 hh = (intersection_point - hit_point_bbox.min_corner) * hash_scale;
-    int ix = abs(int(hh.x));
-    int iy = abs(int(hh.y));
-    int iz = abs(int(hh.z));
-    {
-      std::vector<Hit_point*>& hpoints = hash_grid[hash(ix, iy, iz)];
-      for (int i = 0; i < hpoints.size(); i++) {
-        Hit_point* hit_point = hpoints[i];
-
-        Vector3 v = hit_point->position - intersection_point;
-        hit_point->mutex.lock();
-        if ((hit_point->normal.dot(normal) > 1e-3f) &&
-            (v.dot(v) <= hit_point->radius_squared)) {
-          // Unlike N in the paper, hit_point->n stores "N / ALPHA" to make it
-          // an integer value
-          float radius_reduction =
-              (hit_point->n * ALPHA + ALPHA) / (hit_point->n * ALPHA + 1.0);
-          hit_point->radius_squared =
-              hit_point->radius_squared * radius_reduction;
-          hit_point->n++;
-          Vector3 color(0.0f);
-          Vector3 w_i = -ray.d.normalize();
-          if (hit_point->material.brdf_id == -1) {
-            // all things except w_i should be used from hit_point
-            float cos_theta_i = hit_point->normal.dot(w_i);
-            if (cos_theta_i > 1.0f || cos_theta_i <= 0.0f) {
-              color = 0.0f;
-            } else {
-              float specular_cos_theta = std::max(
-                  0.0f,
-                  hit_point->normal.dot((hit_point->w_o + w_i).normalize()));
-              color = (hit_point->material.diffuse +
-                       hit_point->material.specular *
-                           std::pow(specular_cos_theta,
-                                    hit_point->material.phong_exponent) /
-                           cos_theta_i) *
-                      hit_point->attenuation;
-            }
-
-          } else {
-            // parse brdfs, use brdfs with hit_point's diffuse, specular
+    if (photons) {
+      Photon photon;
+      photon.position = intersection_point;
+      photon.w_i = -ray.d.normalize();
+      photon.normal = normal;
+      photon.flux = flux;
+      photons->push_back(photon);
+    } else {
+      Vector3 hh =
+          (intersection_point - hit_point_bbox.min_corner) * hash_scale;
+      int ix = abs(int(hh.x));
+      int iy = abs(int(hh.y));
+      int iz = abs(int(hh.z));
+      {
+        std::vector<Hit_point*>& hpoints = hash_grid[hash(ix, iy, iz)];
+        for (int i = 0; i < hpoints.size(); i++) {
+          Hit_point* hit_point = hpoints[i];
+
+          Vector3 v = hit_point->position - intersection_point;
+          hit_point->mutex.lock();
+          if ((hit_point->normal.dot(normal) > 1e-3f) &&
+              (v.dot(v) <= hit_point->radius_squared)) {
+            // Unlike N in the paper, hit_point->n stores "N / ALPHA" to make
+            // it an integer value
+            float radius_reduction =
+                (hit_point->n * ALPHA + ALPHA) / (hit_point->n * ALPHA + 1.0);
+            hit_point->radius_squared =
+                hit_point->radius_squared * radius_reduction;
+            hit_point->n++;
+            Vector3 color = hit_point->get_color(-ray.d.normalize());
+            hit_point->flux =
+                (hit_point->flux + color * flux) * radius_reduction;
           }
-          hit_point->flux = (hit_point->flux + color * flux) * radius_reduction;
+          hit_point->mutex.unlock();
         }
-        hit_point->mutex.unlock();
       }
     }
     float probability;
@@ -195,13 +387,13 @@ void Scene::photon_trace(const Ray& ray, int depth, const Vector3& flux) {
     base_color *= cos_theta_o;
     if (uniform_dist(generator) < probability) {
       photon_trace(Ray(intersection_point + (d * shadow_ray_epsilon), d), depth,
-                   (base_color * flux) / probability);
+                   (base_color * flux) / probability, photons);
     }
   } else if (material.material_type == mt_mirror) {
     const Vector3 w_o = (ray.o - intersection_point).normalize();
     const Vector3 w_r = ((2.0f * normal.dot(w_o) * normal) - w_o).normalize();
     Ray mirror_ray(intersection_point + (w_r * shadow_ray_epsilon), w_r);
-    photon_trace(mirror_ray, depth, material.mirror * flux);
+    photon_trace(mirror_ray, depth, material.mirror * flux, photons);
 
   } else if (material.material_type == mt_refractive) {
     const Vector3 nl = normal.dot(ray.d) < 0.0f ? normal : normal * -1;
@@ -218,7 +410,7 @@ void Scene::photon_trace(const Ray& ray, int depth, const Vector3& flux) {
     float ddn = ray.d.dot(nl);
     float cos2t = 1 - nnt * nnt * (1 - ddn * ddn);
     if (cos2t < 0.0f) {
-      photon_trace(reflection_ray, depth, flux);
+      photon_trace(reflection_ray, depth, flux, photons);
       return;
     }
     Vector3 refraction_direction =
@@ -238,12 +430,12 @@ void Scene::photon_trace(const Ray& ray, int depth, const Vector3& flux) {
         refraction_direction);
     if (into) {
       if (uniform_dist(generator) < P) {
-        photon_trace(reflection_ray, depth, flux);
+        photon_trace(reflection_ray, depth, flux, photons);
       } else {
-        photon_trace(refraction_ray, depth, flux);
+        photon_trace(refraction_ray, depth, flux, photons);
       }
     } else {
-      photon_trace(refraction_ray, depth, flux);
+      photon_trace(refraction_ray, depth, flux, photons);
     }
   }
 }
@@ -360,7 +552,8 @@ void Scene::eye_trace(const Ray& ray, int depth, const Vector3& attenuation,
     }
   }
 }
-void Scene::density_estimation(Pixel* pixels, int total_num_of_photons) {
+void Scene::density_estimation(Pixel* pixels) {
+  const float total_num_of_photons = (float)emitted_photon_count;
   for (int i = 0; i < hit_points.size(); i++) {
     const Hit_point* hit_point = hit_points[i];
     int pixel_index = hit_point->pixel;
@@ -371,7 +564,8 @@ void Scene::density_estimation(Pixel* pixels, int total_num_of_photons) {
   }
 }
 
-Scene::Scene(const std::string& file_name) {
+Scene::Scene(const std::string& file_name)
+    : emitted_photon_count(0), hit_point_block_(nullptr) {
   tinyxml2::XMLDocument file;
   std::stringstream stream;
   auto res = file.LoadFile(file_name.c_str());
@@ -416,6 +610,78 @@ Scene::Scene(const std::string& file_name) {
   std::cout << "NumberOfIterations is parsed" << std::endl;
   //
 
+  // Get PreviewInterval
+  element = root->FirstChildElement("PreviewInterval");
+  if (element) {
+    stream << element->GetText() << std::endl;
+  } else {
+    stream << "0" << std::endl;
+  }
+  stream >> preview_interval;
+  std::cout << "PreviewInterval is parsed" << std::endl;
+  //
+
+  // Get TimeBudget, in seconds
+  element = root->FirstChildElement("TimeBudget");
+  if (element) {
+    stream << element->GetText() << std::endl;
+  } else {
+    stream << "0" << std::endl;
+  }
+  stream >> time_budget;
+  std::cout << "TimeBudget is parsed" << std::endl;
+  //
+
+  // Get ConvergenceThreshold
+  element = root->FirstChildElement("ConvergenceThreshold");
+  if (element) {
+    stream << element->GetText() << std::endl;
+  } else {
+    stream << "0" << std::endl;
+  }
+  stream >> convergence_threshold;
+  std::cout << "ConvergenceThreshold is parsed" << std::endl;
+  //
+
+  // Get CheckpointInterval
+  element = root->FirstChildElement("CheckpointInterval");
+  if (element) {
+    stream << element->GetText() << std::endl;
+  } else {
+    stream << "0" << std::endl;
+  }
+  stream >> checkpoint_interval;
+  std::cout << "CheckpointInterval is parsed" << std::endl;
+  //
+
+  // Get PhotonMap
+  element = root->FirstChildElement("PhotonMap");
+  use_photon_map = element != nullptr;
+  photon_map_photon_count = 1000000;
+  photon_map_nearest_count = 100;
+  photon_map_max_radius_squared = kInf;
+  if (element) {
+    auto child = element->FirstChildElement("PhotonCount");
+    if (child) {
+      stream << child->GetText() << std::endl;
+      stream >> photon_map_photon_count;
+    }
+    child = element->FirstChildElement("NearestPhotons");
+    if (child) {
+      stream << child->GetText() << std::endl;
+      stream >> photon_map_nearest_count;
+    }
+    child = element->FirstChildElement("MaxGatherRadius");
+    if (child) {
+      float max_gather_radius;
+      stream << child->GetText() << std::endl;
+      stream >> max_gather_radius;
+      photon_map_max_radius_squared = max_gather_radius * max_gather_radius;
+    }
+    std::cout << "PhotonMap is parsed" << std::endl;
+  }
+  //
+
   // Get MaxRecursionDepth
   element = root->FirstChildElement("MaxRecursionDepth");
   if (element) {
@@ -17,12 +17,26 @@ void write_png(const std::vector<Vector3>& pixel_colors,
                const std::string& file_name, int width, int height);
 void write_exr(const std::vector<Vector3>& hdr_image,
                const std::string& file_name, int width, int height);
+std::vector<Vector3> get_pixel_colors(Pixel* pixels, int width, int height);
+void save_image(const Camera& camera, std::vector<Vector3>& pixel_colors,
+                const std::string& file_name);
+float relative_change(const std::vector<Vector3>& previous_colors,
+                      const std::vector<Vector3>& current_colors);
+int greatest_common_divisor(int a, int b);
+int photons_of_thread(int photon_count, int thread_index, int thread_count);
 
 int main(int argc, char* argv[]) {
   if (argc < 2) {
     std::cerr << "Please provide scene file as argument" << std::endl;
     return 1;
   }
+  // Continue from the checkpoints of the previous run if they exist
+  bool resume = false;
+  for (int i = 2; i < argc; i++) {
+    if (std::string(argv[i]) == "--resume") {
+      resume = true;
+    }
+  }
   system("pause");
   Scene scene(argv[1]);
   std::cout << "Scene is parsed" << std::endl;
@@ -30,6 +44,28 @@ int main(int argc, char* argv[]) {
   if (thread_count == 0) {
     thread_count = 1;
   }
+  if (scene.use_photon_map) {
+    // Photon map does not depend on the camera, it is traced only once
+    auto start = std::chrono::system_clock::now();
+    std::vector<std::vector<Photon>> photon_lists(thread_count);
+    std::cout << "Starting photon map tracing on #" << thread_count
+              << " thread(s)" << std::endl;
+    std::thread* threads = new std::thread[thread_count];
+    for (int i = 0; i < thread_count; i++) {
+      threads[i] = std::thread(
+          &Scene::trace_photons_into, &scene,
+          photons_of_thread(scene.photon_map_photon_count, i, thread_count),
+          &photon_lists[i]);
+    }
+    for (int i = 0; i < thread_count; i++) threads[i].join();
+    delete[] threads;
+    scene.build_photon_map(photon_lists);
+    auto end = std::chrono::system_clock::now();
+    std::cout << "Photon map with " << scene.photon_map.size()
+              << " photons is built in: ";
+    print_time_diff(std::cout, start, end);
+    std::cout << std::endl;
+  }
   for (int index = 0; index < scene.cameras.size(); index++) {
     const Camera& camera = scene.cameras[index];
     scene.reset_hash_grid();
@@ -37,126 +73,160 @@ int main(int argc, char* argv[]) {
     const int width = image_plane.width;
     const int height = image_plane.height;
     int size = width * height;
+    std::string filename = camera.get_filename().substr(
+        0, camera.get_filename().find_last_of("."));
+    std::string checkpoint_name = filename + "_checkpoint.bin";
+    int iterations_done = 0;
+    bool resumed = resume && !scene.use_photon_map &&
+                   scene.load_checkpoint(checkpoint_name, width, height,
+                                         iterations_done);
     auto start = std::chrono::system_clock::now();
-    if (height < thread_count) {
-      std::cout << "Starting eye_trace on #1 thread" << std::endl;
-      scene.eye_trace_lines(index, 0, 1);
+    auto end = start;
+    if (resumed) {
+      std::cout << "Resuming from " << checkpoint_name << " after "
+                << iterations_done << " iterations" << std::endl;
     } else {
-      std::cout << "Starting eye_trace on #" << thread_count << " thread(s)"
-                << std::endl;
-      std::thread* threads = new std::thread[thread_count];
-      for (int i = 0; i < thread_count; i++) {
-        threads[i] = std::thread(&Scene::eye_trace_lines, &scene, index, i,
-                                 thread_count);
+      if (height < thread_count) {
+        std::cout << "Starting eye_trace on #1 thread" << std::endl;
+        scene.eye_trace_lines(index, 0, 1);
+      } else {
+        std::cout << "Starting eye_trace on #" << thread_count << " thread(s)"
+                  << std::endl;
+        std::thread* threads = new std::thread[thread_count];
+        for (int i = 0; i < thread_count; i++) {
+          threads[i] = std::thread(&Scene::eye_trace_lines, &scene, index, i,
+                                   thread_count);
+        }
+        for (int i = 0; i < thread_count; i++) threads[i].join();
+        delete[] threads;
       }
-      for (int i = 0; i < thread_count; i++) threads[i].join();
-      delete[] threads;
+      end = std::chrono::system_clock::now();
+      std::cout << "Eye pass is completed in: ";
+      print_time_diff(std::cout, start, end);
+      std::cout << std::endl;
     }
-    auto end = std::chrono::system_clock::now();
-    std::cout << "Eye pass is completed in: ";
-    print_time_diff(std::cout, start, end);
-    std::cout << std::endl;
-
-    start = std::chrono::system_clock::now();
-    scene.build_hash_grid(width, height);
-    end = std::chrono::system_clock::now();
-    std::cout << "Building hash grid is completed in: ";
-    print_time_diff(std::cout, start, end);
-    std::cout << std::endl;
-
-    start = std::chrono::system_clock::now();
-    // generate photon is implemented by lights
-    // photon trace is implemented by scene, it is used for photon, thread
-    // safe(I guess)
-
-    int number_of_iterations = scene.number_of_iterations;
-    int photon_count_per_iteration = scene.photon_count_per_iteration;
-    int photons_per_thread = photon_count_per_iteration / thread_count;
-    if (height < thread_count) {
-      std::cout << "Starting photon_trace on #1 thread" << std::endl;
-      scene.trace_n_photons(photon_count_per_iteration, number_of_iterations);
 
-    } else {
-      std::cout << "Starting photon_trace on #" << thread_count << " thread(s)"
-                << std::endl;
+    Pixel* pixels = new Pixel[width * height];
+    if (scene.use_photon_map) {
+      start = std::chrono::system_clock::now();
+      std::cout << "Starting photon map estimation on #" << thread_count
+                << " thread(s)" << std::endl;
       std::thread* threads = new std::thread[thread_count];
       for (int i = 0; i < thread_count; i++) {
-        threads[i] = std::thread(&Scene::trace_n_photons, &scene,
-                                 photons_per_thread, number_of_iterations);
+        threads[i] = std::thread(&Scene::photon_map_estimation, &scene, pixels,
+                                 i, thread_count);
       }
       for (int i = 0; i < thread_count; i++) threads[i].join();
       delete[] threads;
-    }
-    end = std::chrono::system_clock::now();
-    std::cout << "Tracing photon rays is completed in: ";
-    print_time_diff(std::cout, start, end);
-    std::cout << std::endl;
+      end = std::chrono::system_clock::now();
+      std::cout << "Photon map estimation is completed in: ";
+      print_time_diff(std::cout, start, end);
+      std::cout << std::endl;
+    } else {
+      if (!resumed) {
+        start = std::chrono::system_clock::now();
+        scene.build_hash_grid(width, height);
+        end = std::chrono::system_clock::now();
+        std::cout << "Building hash grid is completed in: ";
+        print_time_diff(std::cout, start, end);
+        std::cout << std::endl;
+      }
 
-    Pixel* pixels = new Pixel[width * height];
-    start = std::chrono::system_clock::now();
-    scene.density_estimation(
-        pixels, photon_count_per_iteration * photons_per_thread * thread_count);
-    end = std::chrono::system_clock::now();
-    std::cout << "Density estimation is completed in: ";
-    print_time_diff(std::cout, start, end);
-    std::cout << std::endl;
+      start = std::chrono::system_clock::now();
+      // generate photon is implemented by lights
+      // photon trace is implemented by scene, it is used for photon, thread
+      // safe(I guess)
 
-    std::vector<Vector3> pixel_colors;
-    for (int j = 0; j < height; j++) {
-      for (int i = 0; i < width; i++) {
-        pixel_colors.push_back(pixels[j * width + i].get_color());
+      int number_of_iterations = scene.number_of_iterations;
+      int photon_count_per_iteration = scene.photon_count_per_iteration;
+      int tracing_thread_count = height < thread_count ? 1 : thread_count;
+      // Threads are synchronised every pass_iterations iterations to write
+      // previews and checkpoints, and to check the stopping criteria
+      bool check_convergence = scene.convergence_threshold > 0.0f;
+      int pass_iterations = number_of_iterations;
+      if (scene.preview_interval > 0 || scene.checkpoint_interval > 0) {
+        pass_iterations =
+            greatest_common_divisor(std::max(0, scene.preview_interval),
+                                    std::max(0, scene.checkpoint_interval));
+      } else if (scene.time_budget > 0.0f || check_convergence) {
+        pass_iterations = 1;
       }
-    }
-    delete[] pixels;
-
-    std::string filename = camera.get_filename().substr(
-        0, camera.get_filename().find_last_of("."));
+      std::cout << "Starting photon_trace on #" << tracing_thread_count
+                << " thread(s)" << std::endl;
+      std::vector<Vector3> previous_colors;
+      while (iterations_done < number_of_iterations) {
+        int iterations =
+            std::min(pass_iterations, number_of_iterations - iterations_done);
+        std::thread* threads = new std::thread[tracing_thread_count];
+        for (int i = 0; i < tracing_thread_count; i++) {
+          threads[i] = std::thread(
+              &Scene::trace_n_photons, &scene,
+              photons_of_thread(photon_count_per_iteration, i,
+                                tracing_thread_count),
+              iterations);
+        }
+        for (int i = 0; i < tracing_thread_count; i++) threads[i].join();
+        delete[] threads;
+        iterations_done += iterations;
+        if (iterations_done == number_of_iterations) {
+          break;
+        }
 
-    const Tonemapping_operator* tmo = camera.get_tmo();
-    if (tmo) {
-      write_exr(pixel_colors, filename, width, height);
-      std::vector<Vector3> tonemapped_colors;
-      tmo->apply_tmo(pixel_colors, tonemapped_colors);
-      // TODO: parse gammacorrection style
-      if (true) {
-        constexpr float inverse = 1.0f / 2.4f;
-        for (int j = 0; j < height; j++) {
-          for (int i = 0; i < width; i++) {
-            Vector3 old_rgb = tonemapped_colors[j * width + i];
-            float r =
-                clamp(
-                    0.0f, 1.0f,
-                    (1.055f * std::pow(clamp(0.0f, 1.0f, old_rgb.x), inverse) -
-                     0.055f)) *
-                255.0f;
-            float g =
-                clamp(
-                    0.0f, 1.0f,
-                    (1.055f * std::pow(clamp(0.0f, 1.0f, old_rgb.y), inverse) -
-                     0.055f)) *
-                255.0f;
-            float b =
-                clamp(
-                    0.0f, 1.0f,
-                    (1.055f * std::pow(clamp(0.0f, 1.0f, old_rgb.z), inverse) -
-                     0.055f)) *
-                255.0f;
-            tonemapped_colors[j * width + i] = Vector3(r, g, b);
+        std::chrono::duration<float> elapsed =
+            std::chrono::system_clock::now() - start;
+        bool stop = scene.time_budget > 0.0f &&
+                    elapsed.count() >= scene.time_budget;
+        bool write_preview = scene.preview_interval > 0 &&
+                             iterations_done % scene.preview_interval == 0;
+        if (write_preview || check_convergence) {
+          Pixel* preview_pixels = new Pixel[width * height];
+          scene.density_estimation(preview_pixels);
+          std::vector<Vector3> preview_colors =
+              get_pixel_colors(preview_pixels, width, height);
+          delete[] preview_pixels;
+          if (check_convergence) {
+            if (!previous_colors.empty() &&
+                relative_change(previous_colors, preview_colors) <
+                    scene.convergence_threshold) {
+              stop = true;
+            }
+            previous_colors = preview_colors;
+          }
+          if (write_preview) {
+            save_image(camera, preview_colors, filename + "_preview");
           }
         }
+        if (scene.checkpoint_interval > 0 &&
+            iterations_done % scene.checkpoint_interval == 0) {
+          scene.save_checkpoint(checkpoint_name, width, height,
+                                iterations_done);
+        }
+        if (stop) {
+          std::cout << "Stopping photon_trace after " << iterations_done
+                    << " iterations" << std::endl;
+          break;
+        }
       }
-      write_png(tonemapped_colors, filename, width, height);
-    } else {
-      for (int i = 0; i < width * height; i++) {
-        pixel_colors[i].x =
-            int(pow(1 - exp(-pixel_colors[i].x), 1 / 2.2f) * 255 + 0.5f);
-        pixel_colors[i].y =
-            int(pow(1 - exp(-pixel_colors[i].y), 1 / 2.2f) * 255 + 0.5f);
-        pixel_colors[i].z =
-            int(pow(1 - exp(-pixel_colors[i].z), 1 / 2.2f) * 255 + 0.5f);
+      if (scene.checkpoint_interval > 0) {
+        scene.save_checkpoint(checkpoint_name, width, height,
+                              iterations_done);
       }
-      write_png(pixel_colors, filename, width, height);
+      end = std::chrono::system_clock::now();
+      std::cout << "Tracing photon rays is completed in: ";
+      print_time_diff(std::cout, start, end);
+      std::cout << std::endl;
+
+      start = std::chrono::system_clock::now();
+      scene.density_estimation(pixels);
+      end = std::chrono::system_clock::now();
+      std::cout << "Density estimation is completed in: ";
+      print_time_diff(std::cout, start, end);
+      std::cout << std::endl;
     }
+
+    std::vector<Vector3> pixel_colors = get_pixel_colors(pixels, width, height);
+    delete[] pixels;
+    save_image(camera, pixel_colors, filename);
   }
   return 0;
   /*const int camera_count = (int)scene.cameras.size();
@@ -320,3 +390,102 @@ void write_exr(const std::vector<Vector3>& hdr_image,
   free(header.pixel_types);
   free(header.requested_pixel_types);
 }
+
+std::vector<Vector3> get_pixel_colors(Pixel* pixels, int width, int height) {
+  std::vector<Vector3> pixel_colors;
+  for (int j = 0; j < height; j++) {
+    for (int i = 0; i < width; i++) {
+      pixel_colors.push_back(pixels[j * width + i].get_color());
+    }
+  }
+  return pixel_colors;
+}
+
+void save_image(const Camera& camera, std::vector<Vector3>& pixel_colors,
+                const std::string& file_name) {
+  const Image_plane& image_plane = camera.get_image_plane();
+  const int width = image_plane.width;
+  const int height = image_plane.height;
+  const Tonemapping_operator* tmo = camera.get_tmo();
+  if (tmo) {
+    write_exr(pixel_colors, file_name, width, height);
+    std::vector<Vector3> tonemapped_colors;
+    tmo->apply_tmo(pixel_colors, tonemapped_colors);
+    // TODO: parse gammacorrection style
+    if (true) {
+      constexpr float inverse = 1.0f / 2.4f;
+      for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+          Vector3 old_rgb = tonemapped_colors[j * width + i];
+          float r =
+              clamp(
+                  0.0f, 1.0f,
+                  (1.055f * std::pow(clamp(0.0f, 1.0f, old_rgb.x), inverse) -
+                   0.055f)) *
+              255.0f;
+          float g =
+              clamp(
+                  0.0f, 1.0f,
+                  (1.055f * std::pow(clamp(0.0f, 1.0f, old_rgb.y), inverse) -
+                   0.055f)) *
+              255.0f;
+          float b =
+              clamp(
+                  0.0f, 1.0f,
+                  (1.055f * std::pow(clamp(0.0f, 1.0f, old_rgb.z), inverse) -
+                   0.055f)) *
+              255.0f;
+          tonemapped_colors[j * width + i] = Vector3(r, g, b);
+        }
+      }
+    }
+    write_png(tonemapped_colors, file_name, width, height);
+  } else {
+    for (int i = 0; i < width * height; i++) {
+      pixel_colors[i].x =
+          int(pow(1 - exp(-pixel_colors[i].x), 1 / 2.2f) * 255 + 0.5f);
+      pixel_colors[i].y =
+          int(pow(1 - exp(-pixel_colors[i].y), 1 / 2.2f) * 255 + 0.5f);
+      pixel_colors[i].z =
+          int(pow(1 - exp(-pixel_colors[i].z), 1 / 2.2f) * 255 + 0.5f);
+    }
+    write_png(pixel_colors, file_name, width, height);
+  }
+}
+
+// Mean absolute luminance change between two estimates of the same image,
+// relative to the mean luminance of the current estimate
+float relative_change(const std::vector<Vector3>& previous_colors,
+                      const std::vector<Vector3>& current_colors) {
+  double difference = 0.0;
+  double total = 0.0;
+  for (size_t i = 0; i < current_colors.size(); i++) {
+    const Vector3& previous = previous_colors[i];
+    const Vector3& current = current_colors[i];
+    float previous_lum =
+        0.21f * previous.x + 0.72f * previous.y + 0.07f * previous.z;
+    float current_lum =
+        0.21f * current.x + 0.72f * current.y + 0.07f * current.z;
+    difference += std::fabs(current_lum - previous_lum);
+    total += current_lum;
+  }
+  if (total <= 0.0) {
+    return kInf;
+  }
+  return (float)(difference / total);
+}
+
+int greatest_common_divisor(int a, int b) {
+  while (b != 0) {
+    int remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+// Splits photon_count between the threads without dropping the remainder
+int photons_of_thread(int photon_count, int thread_index, int thread_count) {
+  return photon_count / thread_count +
+         (thread_index < photon_count % thread_count ? 1 : 0);
+}